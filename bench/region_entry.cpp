@@ -0,0 +1,50 @@
+#include "omp.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Region-entry latency benchmark. For team sizes doubling from 1 up to
+ * omp_get_max_threads() (or the first argument), time many empty parallel
+ * regions and report the mean time from the start of each region until every
+ * implicit task has started, and the mean time per region overall. Run it
+ * with and without the tool loaded to see what the tool adds to region entry.
+ *
+ * Usage: region_entry [max threads] [regions per team size], and with the tool:
+ *   OMP_TOOL_LIBRARIES=<path>/libancestry_tracker.so TASK_TREE_MODE=tree \
+ *     region_entry [max threads] [regions per team size]
+ *
+ * The tool must run in tree mode: the default counters mode never registers
+ * implicit tasks with their region, so it does not exercise that path. In
+ * tree mode each implicit task takes the lock of one task map shard and
+ * writes its own padded slot in the region, so the entry time should stay
+ * flat as the team grows.
+ */
+
+int main(int argc, char ** argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : omp_get_max_threads();
+  int regions = argc > 2 ? atoi(argv[2]) : 10000;
+
+  const char * mode = getenv("TASK_TREE_MODE");
+  printf("TASK_TREE_MODE=%s\n", mode != NULL ? mode : "(unset, counters mode if the tool is loaded)");
+  printf("%8s %16s %16s\n", "threads", "entry (us)", "region (us)");
+  for (int threads = 1; ; threads *= 2) {
+    if (threads > max_threads) {
+      threads = max_threads;
+    }
+    double entry = 0.0;
+    double begin = omp_get_wtime();
+    for (int r = 0; r < regions; r++) {
+      double fork = omp_get_wtime();
+      double last_start = fork;
+      #pragma omp parallel num_threads(threads) reduction(max: last_start)
+      {
+        last_start = omp_get_wtime();
+      }
+      entry += last_start - fork;
+    }
+    double total = omp_get_wtime() - begin;
+    printf("%8d %16.3f %16.3f\n", threads, 1e6 * entry / regions, 1e6 * total / regions);
+    if (threads == max_threads) {
+      break;
+    }
+  }
+}
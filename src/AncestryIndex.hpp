@@ -0,0 +1,410 @@
+#ifndef ANCESTRY_INDEX_H
+#define ANCESTRY_INDEX_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+/******************************************************************************\
+ * Offline ancestry queries over a built task tree.
+ *
+ * The index is written once after build_tree and can be memory-mapped by any
+ * analysis program without rebuilding anything. It stores an Euler tour of the
+ * tree plus a sparse table over the tour, so that lowest common ancestor,
+ * depth, subtree size and ancestor tests are all O(1) after linear (plus
+ * sparse table) preprocessing. Task/region IDs are mapped to vertex indices
+ * through an open-addressing hash table that also lives in the file.
+ *
+ * This header deliberately does not depend on OMPT or Boost so that external
+ * tools can include it on its own.
+\******************************************************************************/
+
+#define ANCESTRY_INDEX_MAGIC "ANCIDX1"
+#define ANCESTRY_INDEX_VERSION 1
+#define ANCESTRY_INDEX_NONE UINT32_MAX
+
+typedef struct ancestry_index_header {
+  char magic[8];
+  uint32_t version;
+  // Number of levels in the sparse table
+  uint32_t n_levels;
+  // Number of real vertices. Index n_vertices is a virtual root that joins
+  // all the trees of the forest together.
+  uint64_t n_vertices;
+  uint64_t euler_length;
+  uint64_t hash_capacity;
+  // Byte offsets of each section from the start of the file
+  uint64_t ids_offset;
+  uint64_t parents_offset;
+  uint64_t levels_offset;
+  uint64_t first_offset;
+  uint64_t preorder_offset;
+  uint64_t subtree_size_offset;
+  uint64_t euler_offset;
+  uint64_t sparse_offset;
+  uint64_t hash_offset;
+  uint64_t file_size;
+} ancestry_index_header_t;
+
+
+static inline uint64_t ancestry_index_hash(uint64_t id) {
+  // splitmix64 finalizer
+  id ^= id >> 30;
+  id *= 0xbf58476d1ce4e5b9ULL;
+  id ^= id >> 27;
+  id *= 0x94d049bb133111ebULL;
+  id ^= id >> 31;
+  return id;
+}
+
+static inline uint64_t ancestry_index_align(uint64_t offset) {
+  return (offset + 7) & ~((uint64_t)7);
+}
+
+
+/* Build the index for a forest given as an ID per vertex and the index of
+ * each vertex's parent (ANCESTRY_INDEX_NONE for roots) and write it to path.
+ * Returns false if the file could not be written.
+ */
+static inline bool write_ancestry_index_file(const std::string & path,
+                                             const std::vector<uint64_t> & ids,
+                                             const std::vector<uint32_t> & parents)
+{
+  const uint32_t n = ids.size();
+  const uint32_t root = n;
+
+  // Children in CSR form, virtual root included
+  std::vector<uint32_t> child_offsets(n + 2, 0);
+  for (uint32_t v = 0; v < n; v++) {
+    uint32_t p = parents[v] == ANCESTRY_INDEX_NONE ? root : parents[v];
+    child_offsets[p + 1]++;
+  }
+  for (uint32_t v = 0; v <= n; v++) {
+    child_offsets[v + 1] += child_offsets[v];
+  }
+  std::vector<uint32_t> children(n);
+  std::vector<uint32_t> fill(child_offsets.begin(), child_offsets.end() - 1);
+  for (uint32_t v = 0; v < n; v++) {
+    uint32_t p = parents[v] == ANCESTRY_INDEX_NONE ? root : parents[v];
+    children[fill[p]++] = v;
+  }
+
+  // Iterative DFS producing the Euler tour, levels, preorder numbers and
+  // subtree sizes. Task trees can be very deep, so no recursion here.
+  const uint64_t euler_length = 2 * (uint64_t)n + 1;
+  std::vector<uint32_t> levels(n + 1, 0);
+  std::vector<uint32_t> first(n + 1, 0);
+  std::vector<uint32_t> preorder(n + 1, 0);
+  std::vector<uint32_t> subtree_size(n + 1, 1);
+  std::vector<uint32_t> euler;
+  euler.reserve(euler_length);
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> next_child(child_offsets.begin(), child_offsets.end() - 1);
+  uint32_t preorder_counter = 0;
+  stack.push_back(root);
+  first[root] = 0;
+  preorder[root] = preorder_counter++;
+  euler.push_back(root);
+  while (!stack.empty()) {
+    uint32_t v = stack.back();
+    if (next_child[v] < child_offsets[v + 1]) {
+      uint32_t c = children[next_child[v]++];
+      levels[c] = levels[v] + 1;
+      first[c] = euler.size();
+      preorder[c] = preorder_counter++;
+      euler.push_back(c);
+      stack.push_back(c);
+    } else {
+      stack.pop_back();
+      if (!stack.empty()) {
+        subtree_size[stack.back()] += subtree_size[v];
+        euler.push_back(stack.back());
+      }
+    }
+  }
+
+  // Sparse table over the Euler tour: entry [k][i] holds the vertex of
+  // minimal level in euler[i, i + 2^k)
+  uint32_t n_levels = 1;
+  while (((uint64_t)1 << n_levels) <= euler_length) {
+    n_levels++;
+  }
+
+  // Open-addressing hash table from ID to vertex index
+  uint64_t hash_capacity = 16;
+  while (hash_capacity < 2 * (uint64_t)n) {
+    hash_capacity <<= 1;
+  }
+  std::vector<uint32_t> hash(hash_capacity, ANCESTRY_INDEX_NONE);
+  for (uint32_t v = 0; v < n; v++) {
+    uint64_t slot = ancestry_index_hash(ids[v]) & (hash_capacity - 1);
+    while (hash[slot] != ANCESTRY_INDEX_NONE) {
+      slot = (slot + 1) & (hash_capacity - 1);
+    }
+    hash[slot] = v;
+  }
+
+  // Lay out the file
+  ancestry_index_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ANCESTRY_INDEX_MAGIC, sizeof(ANCESTRY_INDEX_MAGIC));
+  header.version = ANCESTRY_INDEX_VERSION;
+  header.n_levels = n_levels;
+  header.n_vertices = n;
+  header.euler_length = euler_length;
+  header.hash_capacity = hash_capacity;
+  uint64_t offset = ancestry_index_align(sizeof(header));
+  header.ids_offset = offset;
+  offset = ancestry_index_align(offset + n * sizeof(uint64_t));
+  header.parents_offset = offset;
+  offset = ancestry_index_align(offset + n * sizeof(uint32_t));
+  header.levels_offset = offset;
+  offset = ancestry_index_align(offset + (n + 1) * sizeof(uint32_t));
+  header.first_offset = offset;
+  offset = ancestry_index_align(offset + (n + 1) * sizeof(uint32_t));
+  header.preorder_offset = offset;
+  offset = ancestry_index_align(offset + (n + 1) * sizeof(uint32_t));
+  header.subtree_size_offset = offset;
+  offset = ancestry_index_align(offset + (n + 1) * sizeof(uint32_t));
+  header.euler_offset = offset;
+  offset = ancestry_index_align(offset + euler_length * sizeof(uint32_t));
+  header.sparse_offset = offset;
+  offset = ancestry_index_align(offset + n_levels * euler_length * sizeof(uint32_t));
+  header.hash_offset = offset;
+  offset = ancestry_index_align(offset + hash_capacity * sizeof(uint32_t));
+  header.file_size = offset;
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Could not open ancestry index file %s\n", path.c_str());
+    return false;
+  }
+  if (ftruncate(fd, header.file_size) != 0) {
+    printf("Could not resize ancestry index file %s\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  void * map = mmap(NULL, header.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Could not map ancestry index file %s\n", path.c_str());
+    return false;
+  }
+  char * base = (char *) map;
+  memcpy(base, &header, sizeof(header));
+  memcpy(base + header.ids_offset, ids.data(), n * sizeof(uint64_t));
+  memcpy(base + header.parents_offset, parents.data(), n * sizeof(uint32_t));
+  memcpy(base + header.levels_offset, levels.data(), (n + 1) * sizeof(uint32_t));
+  memcpy(base + header.first_offset, first.data(), (n + 1) * sizeof(uint32_t));
+  memcpy(base + header.preorder_offset, preorder.data(), (n + 1) * sizeof(uint32_t));
+  memcpy(base + header.subtree_size_offset, subtree_size.data(), (n + 1) * sizeof(uint32_t));
+  memcpy(base + header.euler_offset, euler.data(), euler_length * sizeof(uint32_t));
+  memcpy(base + header.hash_offset, hash.data(), hash_capacity * sizeof(uint32_t));
+
+  // The sparse table is the bulk of the file, so fill it in place
+  uint32_t * sparse = (uint32_t *)(base + header.sparse_offset);
+  memcpy(sparse, euler.data(), euler_length * sizeof(uint32_t));
+  for (uint32_t k = 1; k < n_levels; k++) {
+    const uint32_t * prev = sparse + (k - 1) * euler_length;
+    uint32_t * cur = sparse + k * euler_length;
+    const uint64_t half = (uint64_t)1 << (k - 1);
+    for (uint64_t i = 0; i + 2 * half <= euler_length; i++) {
+      uint32_t a = prev[i];
+      uint32_t b = prev[i + half];
+      cur[i] = levels[a] <= levels[b] ? a : b;
+    }
+  }
+
+  munmap(map, header.file_size);
+  return true;
+}
+
+
+/* Read-only, memory-mapped view of an ancestry index file. Vertices are
+ * addressed by their index in the file; use find() to translate an OpenMP
+ * task or parallel region ID into an index.
+ */
+class AncestryIndex
+{
+  private:
+    void * map;
+    uint64_t map_size;
+    const ancestry_index_header_t * header;
+    const uint64_t * ids;
+    const uint32_t * parents;
+    const uint32_t * levels;
+    const uint32_t * first;
+    const uint32_t * preorder;
+    const uint32_t * subtree_sizes;
+    const uint32_t * euler;
+    const uint32_t * sparse;
+    const uint32_t * hash;
+
+    static uint32_t floor_log2(uint64_t x) {
+      return 63 - __builtin_clzll(x);
+    }
+
+    // Whether count entries of entry_size bytes at offset lie inside the
+    // mapping
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t entry_size) const {
+      return offset % 8 == 0 && offset <= map_size &&
+             count <= (map_size - offset) / entry_size;
+    }
+
+    // Whether the header describes the layout write_ancestry_index_file
+    // produces, with every section inside the mapping
+    bool header_is_valid() const {
+      const uint64_t n = header->n_vertices;
+      if (n >= ANCESTRY_INDEX_NONE || header->euler_length != 2 * n + 1 ||
+          header->n_levels == 0 || header->n_levels > 64 ||
+          ((uint64_t)1 << (header->n_levels - 1)) > header->euler_length ||
+          header->hash_capacity <= n ||
+          (header->hash_capacity & (header->hash_capacity - 1)) != 0) {
+        return false;
+      }
+      return section_fits(header->ids_offset, n, sizeof(uint64_t)) &&
+             section_fits(header->parents_offset, n, sizeof(uint32_t)) &&
+             section_fits(header->levels_offset, n + 1, sizeof(uint32_t)) &&
+             section_fits(header->first_offset, n + 1, sizeof(uint32_t)) &&
+             section_fits(header->preorder_offset, n + 1, sizeof(uint32_t)) &&
+             section_fits(header->subtree_size_offset, n + 1, sizeof(uint32_t)) &&
+             section_fits(header->euler_offset, header->euler_length, sizeof(uint32_t)) &&
+             section_fits(header->sparse_offset, header->euler_length,
+                          header->n_levels * sizeof(uint32_t)) &&
+             section_fits(header->hash_offset, header->hash_capacity, sizeof(uint32_t));
+    }
+
+  public:
+    static const uint32_t npos = ANCESTRY_INDEX_NONE;
+
+    AncestryIndex() : map(NULL), map_size(0), header(NULL) {}
+
+    explicit AncestryIndex(const std::string & path) : map(NULL), map_size(0), header(NULL) {
+      open(path);
+    }
+
+    ~AncestryIndex() {
+      close();
+    }
+
+    AncestryIndex(const AncestryIndex &) = delete;
+    AncestryIndex & operator=(const AncestryIndex &) = delete;
+
+    bool open(const std::string & path) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(ancestry_index_header_t)) {
+        ::close(fd);
+        return false;
+      }
+      map_size = st.st_size;
+      map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        map = NULL;
+        return false;
+      }
+      header = (const ancestry_index_header_t *) map;
+      if (memcmp(header->magic, ANCESTRY_INDEX_MAGIC, sizeof(ANCESTRY_INDEX_MAGIC)) != 0 ||
+          header->version != ANCESTRY_INDEX_VERSION ||
+          header->file_size > map_size || !header_is_valid()) {
+        close();
+        return false;
+      }
+      const char * base = (const char *) map;
+      ids = (const uint64_t *)(base + header->ids_offset);
+      parents = (const uint32_t *)(base + header->parents_offset);
+      levels = (const uint32_t *)(base + header->levels_offset);
+      first = (const uint32_t *)(base + header->first_offset);
+      preorder = (const uint32_t *)(base + header->preorder_offset);
+      subtree_sizes = (const uint32_t *)(base + header->subtree_size_offset);
+      euler = (const uint32_t *)(base + header->euler_offset);
+      sparse = (const uint32_t *)(base + header->sparse_offset);
+      hash = (const uint32_t *)(base + header->hash_offset);
+      return true;
+    }
+
+    void close() {
+      if (map != NULL) {
+        munmap(map, map_size);
+      }
+      map = NULL;
+      map_size = 0;
+      header = NULL;
+    }
+
+    bool is_open() const {
+      return header != NULL;
+    }
+
+    uint64_t size() const {
+      return header->n_vertices;
+    }
+
+    // Translate an OpenMP entity ID into a vertex index, or npos
+    uint32_t find(uint64_t id) const {
+      const uint64_t mask = header->hash_capacity - 1;
+      uint64_t slot = ancestry_index_hash(id) & mask;
+      // A corrupt table may have no empty slot or out of range entries
+      for (uint64_t probes = 0; probes < header->hash_capacity && hash[slot] != npos; probes++) {
+        if (hash[slot] < header->n_vertices && ids[hash[slot]] == id) {
+          return hash[slot];
+        }
+        slot = (slot + 1) & mask;
+      }
+      return npos;
+    }
+
+    uint64_t get_id(uint32_t v) const {
+      return ids[v];
+    }
+
+    uint32_t get_parent(uint32_t v) const {
+      return parents[v];
+    }
+
+    // Roots of the forest have depth 0
+    uint32_t get_depth(uint32_t v) const {
+      return levels[v] - 1;
+    }
+
+    // Number of vertices in the subtree rooted at v, including v
+    uint32_t get_subtree_size(uint32_t v) const {
+      return subtree_sizes[v];
+    }
+
+    // True if a is an ancestor of b. Every vertex is its own ancestor.
+    bool is_ancestor(uint32_t a, uint32_t b) const {
+      return preorder[a] <= preorder[b] &&
+             preorder[b] < preorder[a] + subtree_sizes[a];
+    }
+
+    // Lowest common ancestor of a and b, or npos if they are in different
+    // trees of the forest
+    uint32_t lca(uint32_t a, uint32_t b) const {
+      uint64_t lo = first[a];
+      uint64_t hi = first[b];
+      if (lo > hi) {
+        uint64_t tmp = lo; lo = hi; hi = tmp;
+      }
+      const uint64_t len = hi - lo + 1;
+      const uint32_t k = floor_log2(len);
+      const uint32_t * row = sparse + k * header->euler_length;
+      uint32_t x = row[lo];
+      uint32_t y = row[hi + 1 - ((uint64_t)1 << k)];
+      uint32_t result = levels[x] <= levels[y] ? x : y;
+      return result == header->n_vertices ? npos : result;
+    }
+};
+
+#endif // ANCESTRY_INDEX_H
@@ -0,0 +1,488 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(TRACE_COMPRESSION_ZSTD)
+#include <zstd.h>
+#elif defined(TRACE_COMPRESSION_ZLIB)
+#include <zlib.h>
+#endif
+
+/******************************************************************************\
+ * Block-compressed output files.
+ *
+ * The stream is cut into fixed-size blocks that are compressed independently
+ * on a dedicated tool thread, so the thread producing the output never pays
+ * for compression. The file layout is
+ *
+ *   block_file_header_t
+ *   block 0 data, block 1 data, ...
+ *   block_index_entry_t[n_blocks]
+ *   block_file_footer_t
+ *
+ * The footer locates the index, and the index gives the compressed and raw
+ * offset of every block, so readers can seek to any block and decompress
+ * blocks in parallel. The codec is chosen at build time with
+ * TRACE_COMPRESSION_ZLIB or TRACE_COMPRESSION_ZSTD; without either, outputs
+ * are written uncompressed. Each index entry records the codec of its block,
+ * since a block the codec fails on is stored raw.
+\******************************************************************************/
+
+#define BLOCK_FILE_MAGIC "OMPTBLK1"
+#define BLOCK_INDEX_MAGIC "OMPTIDX2"
+#define BLOCK_FILE_DEFAULT_BLOCK_SIZE (1 << 20)
+// Larger block sizes in a file header are taken as corruption
+#define BLOCK_FILE_MAX_BLOCK_SIZE (1 << 30)
+// Blocks waiting for the compression thread before the writer blocks
+#define BLOCK_FILE_MAX_PENDING 8
+
+#ifndef BLOCK_COMPRESSION_LEVEL
+#define BLOCK_COMPRESSION_LEVEL 1
+#endif
+
+enum class BlockCodec : uint32_t {None = 0, Zlib = 1, Zstd = 2};
+
+typedef struct block_file_header {
+  char magic[8];
+  uint32_t codec;
+  uint32_t block_size;
+} block_file_header_t;
+
+typedef struct block_index_entry {
+  uint64_t offset;
+  uint64_t raw_offset;
+  uint32_t compressed_size;
+  uint32_t raw_size;
+  // BlockCodec of this block: the file's codec, or None if it is stored raw
+  uint32_t codec;
+  uint32_t reserved;
+} block_index_entry_t;
+
+typedef struct block_file_footer {
+  uint64_t index_offset;
+  uint64_t n_blocks;
+  char magic[8];
+} block_file_footer_t;
+
+
+#if defined(TRACE_COMPRESSION_ZSTD)
+static const BlockCodec block_codec = BlockCodec::Zstd;
+#elif defined(TRACE_COMPRESSION_ZLIB)
+static const BlockCodec block_codec = BlockCodec::Zlib;
+#else
+static const BlockCodec block_codec = BlockCodec::None;
+#endif
+
+static inline bool block_compression_available() {
+  return block_codec != BlockCodec::None;
+}
+
+/* Compress one block with the codec the tool was built with */
+static inline bool block_compress(const char * src, size_t size, std::vector<char> & dst)
+{
+#if defined(TRACE_COMPRESSION_ZSTD)
+  dst.resize(ZSTD_compressBound(size));
+  size_t n = ZSTD_compress(dst.data(), dst.size(), src, size, BLOCK_COMPRESSION_LEVEL);
+  if (ZSTD_isError(n)) {
+    return false;
+  }
+  dst.resize(n);
+  return true;
+#elif defined(TRACE_COMPRESSION_ZLIB)
+  uLongf n = compressBound(size);
+  dst.resize(n);
+  if (compress2((Bytef *) dst.data(), &n, (const Bytef *) src, size,
+                BLOCK_COMPRESSION_LEVEL) != Z_OK) {
+    return false;
+  }
+  dst.resize(n);
+  return true;
+#else
+  dst.assign(src, src + size);
+  return true;
+#endif
+}
+
+/* Decompress one block written with the given codec */
+static inline bool block_decompress(BlockCodec codec, const char * src, size_t size,
+                                    char * dst, size_t raw_size)
+{
+  switch (codec) {
+    case BlockCodec::None:
+    {
+      if (size != raw_size) {
+        return false;
+      }
+      memcpy(dst, src, size);
+      return true;
+    }
+#if defined(TRACE_COMPRESSION_ZSTD)
+    case BlockCodec::Zstd:
+    {
+      size_t n = ZSTD_decompress(dst, raw_size, src, size);
+      return !ZSTD_isError(n) && n == raw_size;
+    }
+#endif
+#if defined(TRACE_COMPRESSION_ZLIB)
+    case BlockCodec::Zlib:
+    {
+      uLongf n = raw_size;
+      return uncompress((Bytef *) dst, &n, (const Bytef *) src, size) == Z_OK &&
+             n == raw_size;
+    }
+#endif
+    default:
+      printf("Block file uses a codec this build does not support\n");
+      return false;
+  }
+}
+
+
+/* Stream buffer that writes a block-compressed file. Full blocks are handed
+ * to a compression thread; close() flushes the last partial block and writes
+ * the index.
+ */
+class BlockCompressedStreambuf : public std::streambuf
+{
+  private:
+    FILE * file;
+    uint32_t block_size;
+    std::vector<char> current;
+    uint64_t raw_offset;
+    uint64_t file_offset;
+    std::vector<block_index_entry_t> index;
+
+    std::mutex queue_mtx;
+    std::condition_variable queue_cv;
+    std::deque<std::vector<char> > pending;
+    std::vector<std::vector<char> > free_blocks;
+    bool done;
+    std::thread compressor;
+
+    void compress_loop() {
+      std::vector<char> compressed;
+      for (;;) {
+        std::vector<char> block;
+        {
+          std::unique_lock<std::mutex> lock(queue_mtx);
+          queue_cv.wait(lock, [this] { return done || !pending.empty(); });
+          if (pending.empty()) {
+            return;
+          }
+          block.swap(pending.front());
+          pending.pop_front();
+        }
+        queue_cv.notify_all();
+        block_index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.codec = (uint32_t) block_codec;
+        if (!block_compress(block.data(), block.size(), compressed)) {
+          printf("Block compression failed, writing block uncompressed\n");
+          compressed = block;
+          entry.codec = (uint32_t) BlockCodec::None;
+        }
+        entry.offset = file_offset;
+        entry.raw_offset = raw_offset;
+        entry.compressed_size = compressed.size();
+        entry.raw_size = block.size();
+        fwrite(compressed.data(), 1, compressed.size(), file);
+        file_offset += compressed.size();
+        raw_offset += block.size();
+        index.push_back(entry);
+        {
+          std::lock_guard<std::mutex> lock(queue_mtx);
+          block.clear();
+          free_blocks.push_back(std::move(block));
+        }
+      }
+    }
+
+    void submit_current() {
+      if (current.empty()) {
+        return;
+      }
+      std::unique_lock<std::mutex> lock(queue_mtx);
+      queue_cv.wait(lock, [this] { return pending.size() < BLOCK_FILE_MAX_PENDING; });
+      pending.push_back(std::move(current));
+      if (!free_blocks.empty()) {
+        current = std::move(free_blocks.back());
+        free_blocks.pop_back();
+      } else {
+        current = std::vector<char>();
+      }
+      lock.unlock();
+      queue_cv.notify_all();
+      current.reserve(block_size);
+      setp(NULL, NULL);
+    }
+
+    void reset_put_area() {
+      current.resize(block_size);
+      setp(current.data(), current.data() + block_size);
+    }
+
+  protected:
+    int_type overflow(int_type ch) {
+      if (file == NULL) {
+        return traits_type::eof();
+      }
+      if (pptr() != NULL) {
+        current.resize(pptr() - pbase());
+        if (current.size() >= block_size) {
+          submit_current();
+        }
+      }
+      reset_put_area();
+      if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+      }
+      return traits_type::not_eof(ch);
+    }
+
+    // Flushing must not cut blocks short: stream manipulators like std::endl
+    // flush on every line
+    int sync() {
+      return 0;
+    }
+
+  public:
+    BlockCompressedStreambuf(const std::string & path,
+                             uint32_t block_size = BLOCK_FILE_DEFAULT_BLOCK_SIZE) :
+      file(NULL), block_size(block_size), raw_offset(0), file_offset(0), done(false)
+    {
+      file = fopen(path.c_str(), "wb");
+      if (file == NULL) {
+        printf("Could not open %s for writing\n", path.c_str());
+        return;
+      }
+      block_file_header_t header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, BLOCK_FILE_MAGIC, 8);
+      header.codec = (uint32_t) block_codec;
+      header.block_size = block_size;
+      fwrite(&header, sizeof(header), 1, file);
+      file_offset = sizeof(header);
+      compressor = std::thread(&BlockCompressedStreambuf::compress_loop, this);
+    }
+
+    ~BlockCompressedStreambuf() {
+      close();
+    }
+
+    bool is_open() {
+      return file != NULL;
+    }
+
+    void close() {
+      if (file == NULL) {
+        return;
+      }
+      if (pptr() != NULL) {
+        current.resize(pptr() - pbase());
+      }
+      submit_current();
+      {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        done = true;
+      }
+      queue_cv.notify_all();
+      compressor.join();
+      block_file_footer_t footer;
+      memset(&footer, 0, sizeof(footer));
+      footer.index_offset = file_offset;
+      footer.n_blocks = index.size();
+      memcpy(footer.magic, BLOCK_INDEX_MAGIC, 8);
+      fwrite(index.data(), sizeof(block_index_entry_t), index.size(), file);
+      fwrite(&footer, sizeof(footer), 1, file);
+      fclose(file);
+      file = NULL;
+    }
+};
+
+
+/* Output stream for the tool's writers. When the tool was built with a codec
+ * and compression is requested, the output goes through a
+ * BlockCompressedStreambuf and ".blk" is appended to the file name;
+ * otherwise it is a plain file.
+ */
+class ToolOutputStream : public std::ostream
+{
+  private:
+    std::filebuf plain;
+    std::unique_ptr<BlockCompressedStreambuf> compressed;
+    std::string path;
+
+  public:
+    ToolOutputStream(const std::string & requested_path, bool compress) :
+      std::ostream(NULL), path(requested_path)
+    {
+      if (compress && block_compression_available()) {
+        path += ".blk";
+        compressed.reset(new BlockCompressedStreambuf(path));
+        if (compressed->is_open()) {
+          rdbuf(compressed.get());
+          return;
+        }
+        compressed.reset();
+      }
+      if (plain.open(path, std::ios::out | std::ios::trunc | std::ios::binary)) {
+        rdbuf(&plain);
+      } else {
+        setstate(std::ios::badbit);
+      }
+    }
+
+    ~ToolOutputStream() {
+      close();
+    }
+
+    const std::string & get_path() {
+      return path;
+    }
+
+    void close() {
+      flush();
+      if (compressed) {
+        compressed->close();
+      } else if (plain.is_open()) {
+        plain.close();
+      }
+    }
+};
+
+
+/* Random access to the blocks of a block-compressed file */
+class BlockFileReader
+{
+  private:
+    int fd;
+    block_file_header_t header;
+    std::vector<block_index_entry_t> index;
+
+    // Whether the index describes the layout BlockCompressedStreambuf
+    // writes: blocks back to back between the header and the index, each
+    // at most one block of raw data, with consecutive raw offsets
+    bool index_is_valid(uint64_t index_offset) const {
+      uint64_t offset = sizeof(header);
+      uint64_t raw_offset = 0;
+      for (const block_index_entry_t & entry : index) {
+        if (entry.offset != offset || entry.raw_offset != raw_offset ||
+            entry.compressed_size > index_offset - offset ||
+            entry.raw_size > header.block_size ||
+            entry.codec > (uint32_t) BlockCodec::Zstd ||
+            (entry.codec == (uint32_t) BlockCodec::None &&
+             entry.compressed_size != entry.raw_size)) {
+          return false;
+        }
+        offset += entry.compressed_size;
+        raw_offset += entry.raw_size;
+      }
+      return offset == index_offset;
+    }
+
+  public:
+    BlockFileReader() : fd(-1) {}
+
+    explicit BlockFileReader(const std::string & path) : fd(-1) {
+      open(path);
+    }
+
+    ~BlockFileReader() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+
+    BlockFileReader(const BlockFileReader &) = delete;
+    BlockFileReader & operator=(const BlockFileReader &) = delete;
+
+    bool open(const std::string & path) {
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      block_file_footer_t footer;
+      off_t end = lseek(fd, 0, SEEK_END);
+      if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(header.magic, BLOCK_FILE_MAGIC, 8) != 0 ||
+          end < (off_t)(sizeof(header) + sizeof(footer)) ||
+          pread(fd, &footer, sizeof(footer), end - sizeof(footer)) != sizeof(footer) ||
+          memcmp(footer.magic, BLOCK_INDEX_MAGIC, 8) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+      // The index sits right before the footer, so its size follows from
+      // the file size and a corrupt footer cannot ask for more
+      const uint64_t index_end = end - sizeof(footer);
+      if (footer.index_offset < sizeof(header) || footer.index_offset > index_end ||
+          footer.n_blocks != (index_end - footer.index_offset) / sizeof(block_index_entry_t) ||
+          footer.n_blocks * sizeof(block_index_entry_t) != index_end - footer.index_offset ||
+          header.block_size == 0 || header.block_size > BLOCK_FILE_MAX_BLOCK_SIZE) {
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+      index.resize(footer.n_blocks);
+      ssize_t index_bytes = footer.n_blocks * sizeof(block_index_entry_t);
+      if (pread(fd, index.data(), index_bytes, footer.index_offset) != index_bytes ||
+          !index_is_valid(footer.index_offset)) {
+        index.clear();
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+      return true;
+    }
+
+    bool is_open() const {
+      return fd >= 0;
+    }
+
+    BlockCodec get_codec() const {
+      return (BlockCodec) header.codec;
+    }
+
+    size_t get_num_blocks() const {
+      return index.size();
+    }
+
+    const block_index_entry_t & get_block(size_t i) const {
+      return index[i];
+    }
+
+    uint64_t get_raw_size() const {
+      return index.empty() ? 0 : index.back().raw_offset + index.back().raw_size;
+    }
+
+    // Decompress block i into out. Safe to call from several threads at once.
+    bool read_block(size_t i, std::vector<char> & out) const {
+      const block_index_entry_t & entry = index[i];
+      std::vector<char> compressed(entry.compressed_size);
+      if (pread(fd, compressed.data(), entry.compressed_size, entry.offset) !=
+          (ssize_t) entry.compressed_size) {
+        return false;
+      }
+      out.resize(entry.raw_size);
+      return block_decompress((BlockCodec) entry.codec, compressed.data(), compressed.size(),
+                              out.data(), entry.raw_size);
+    }
+};
+
+#endif // BLOCK_COMPRESSION_H
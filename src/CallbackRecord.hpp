@@ -0,0 +1,138 @@
+#ifndef CALLBACK_RECORD_H
+#define CALLBACK_RECORD_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/******************************************************************************\
+ * Recorded OMPT callback invocations.
+ *
+ * With RECORD_CALLBACKS defined the tool logs every callback it receives,
+ * in the order the runtime invoked them, along with the thread that received
+ * it. Each ompt_data_t the runtime passed is recorded by its address, which
+ * is all the replay needs to give the callbacks the same aliasing between
+ * invocations (the same task's data seen at creation and when scheduled, a
+ * runtime reusing a task descriptor, etc.). The replay harness in
+ * tools/replay_callbacks feeds the log back into the tool's callbacks without
+ * an OpenMP runtime.
+ *
+ * File layout:
+ *   callback_log_header_t
+ *   callback_record_t[n_records], in invocation order
+\******************************************************************************/
+
+#define CALLBACK_LOG_MAGIC "OMPTREC1"
+#define CALLBACK_LOG_VERSION 1
+
+enum class CallbackKind : uint16_t {
+  TaskCreate,
+  ImplicitTask,
+  ParallelBegin,
+  ParallelEnd,
+  SyncRegion,
+  SyncRegionWait,
+  TaskSchedule,
+  TaskDependence,
+  Work,
+  Dispatch,
+  MutexAcquire,
+  MutexAcquired,
+  MutexReleased
+};
+
+typedef struct callback_log_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_threads;
+  uint64_t n_records;
+} callback_log_header_t;
+
+/* One callback invocation. Which fields are used depends on the kind:
+ *   TaskCreate      data = {encountering task, new task, parallel*}
+ *                   args = {type, has_dependences}
+ *   ImplicitTask    data = {parallel, task}
+ *                   args = {endpoint, team_size, thread_num}
+ *   ParallelBegin   data = {encountering task, parallel}
+ *                   args = {requested_team_size, invoker}
+ *   ParallelEnd     data = {parallel, encountering task}
+ *                   args = {invoker}
+ *   SyncRegion(Wait) data = {parallel, task}
+ *                   args = {kind, endpoint}
+ *   TaskSchedule    data = {prior task, next task}
+ *                   args = {prior_task_status}
+ *   TaskDependence  data = {task}
+ *                   args = {address, flags, index << 32 | ndeps}
+ *                   one record per dependence, in list order
+ *   Work            data = {parallel, task}
+ *                   args = {wstype, endpoint, count}
+ *   Dispatch        data = {parallel, task}
+ *                   args = {kind, instance}
+ *   MutexAcquire    args = {kind, wait_id, hint}
+ *   MutexAcquired, MutexReleased
+ *                   args = {kind, wait_id}
+ * (*) the region returned by ompt_get_parallel_info for the initial task
+ */
+typedef struct callback_record {
+  // Position in the global invocation order
+  uint64_t seq;
+  // Tool-assigned index of the thread that received the callback
+  uint32_t thread;
+  CallbackKind kind;
+  uint16_t reserved;
+  // Addresses of the ompt_data_t arguments, 0 for NULL
+  uint64_t data[3];
+  uint64_t args[3];
+  uint64_t codeptr_ra;
+} callback_record_t;
+
+
+static inline bool write_callback_log(const std::string & path, uint32_t n_threads,
+                                      const std::vector<callback_record_t> & records)
+{
+  FILE * f = fopen(path.c_str(), "wb");
+  if (f == NULL) {
+    printf("Could not open callback log %s\n", path.c_str());
+    return false;
+  }
+  callback_log_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CALLBACK_LOG_MAGIC, 8);
+  header.version = CALLBACK_LOG_VERSION;
+  header.n_threads = n_threads;
+  header.n_records = records.size();
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  if (ok && !records.empty()) {
+    ok = fwrite(records.data(), sizeof(callback_record_t), records.size(), f) == records.size();
+  }
+  fclose(f);
+  if (!ok) {
+    printf("Could not write callback log %s\n", path.c_str());
+  }
+  return ok;
+}
+
+static inline bool read_callback_log(const std::string & path, uint32_t & n_threads,
+                                     std::vector<callback_record_t> & records)
+{
+  FILE * f = fopen(path.c_str(), "rb");
+  if (f == NULL) {
+    return false;
+  }
+  callback_log_header_t header;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            memcmp(header.magic, CALLBACK_LOG_MAGIC, 8) == 0 &&
+            header.version == CALLBACK_LOG_VERSION;
+  if (ok) {
+    n_threads = header.n_threads;
+    records.resize(header.n_records);
+    ok = header.n_records == 0 ||
+         fread(records.data(), sizeof(callback_record_t), header.n_records, f) == header.n_records;
+  }
+  fclose(f);
+  return ok;
+}
+
+#endif // CALLBACK_RECORD_H
@@ -0,0 +1,246 @@
+#ifndef COMPRESSED_TREE_H
+#define COMPRESSED_TREE_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SubtreeHash.hpp"
+
+/******************************************************************************\
+ * Hash-consed task tree.
+ *
+ * Recursive codes produce huge numbers of identical subtrees. The compressed
+ * tree stores each distinct subtree shape once, keyed by its structural hash
+ * (SubtreeHash.hpp): a shape is a vertex type and call site plus a list of
+ * child shapes, each with a repetition count for the run of identical
+ * children. Instances of a shape are not stored, only counted. Two subtrees
+ * are assumed identical when their 64-bit hashes are.
+ *
+ * The tree is built bottom-up: each vertex is added once all of its children
+ * have been, given their shapes, and either maps to an existing shape or
+ * creates a new one. Callers only need to hold the shapes of the children of
+ * vertices not yet added, so the full tree never has to exist in memory, and
+ * the compressed tree and its output grow with the number of distinct shapes
+ * rather than with the number of tasks.
+ *
+ * Queries (vertex counts, counts per type or call site, height) and the DOT
+ * export all work on the shapes.
+\******************************************************************************/
+
+typedef struct tree_shape {
+  uint64_t hash;
+  uint32_t type;
+  uint32_t module;
+  uint64_t offset;
+  // Vertices in one instance of the shape, and its height (a leaf has 0)
+  uint64_t size;
+  uint32_t height;
+  // Child runs are children[first_child, first_child + n_child_runs)
+  uint32_t n_child_runs;
+  uint64_t first_child;
+  // Number of times the shape occurs in the whole tree
+  uint64_t instances;
+} tree_shape_t;
+
+/* count consecutive children, or roots, of the same shape */
+typedef struct shape_run {
+  uint32_t shape;
+  uint64_t count;
+} shape_run_t;
+
+
+class CompressedTree
+{
+  private:
+    std::vector<tree_shape_t> shapes;
+    std::vector<shape_run_t> children;
+    std::vector<shape_run_t> roots;
+    std::vector<std::string> modules;
+    // Shape of each subtree hash, while building
+    std::unordered_map<uint64_t, uint32_t> shape_index;
+
+    // Runs of equal shapes in a list of shapes sorted by hash
+    void add_runs(const std::vector<uint32_t> & list, std::vector<shape_run_t> & runs) {
+      for (uint64_t i = 0; i < list.size(); ) {
+        uint64_t j = i + 1;
+        while (j < list.size() && list[j] == list[i]) {
+          j++;
+        }
+        runs.push_back( {list[i], j - i} );
+        i = j;
+      }
+    }
+
+    void sort_by_hash(std::vector<uint32_t> & list) const {
+      std::sort(list.begin(), list.end(), [&](uint32_t a, uint32_t b) {
+        return shapes[a].hash < shapes[b].hash;
+      });
+    }
+
+  public:
+    /* Add a vertex whose children have all been added, given its type, call
+     * site and site_hash (see site_hash in SubtreeHash.hpp) and the shapes of
+     * its children, which are sorted in place. Returns the vertex's shape,
+     * whose hash is the vertex's subtree hash as compute_subtree_hashes would
+     * give it.
+     */
+    uint32_t add_vertex(uint32_t type, uint32_t module, uint64_t offset, uint64_t site_hash,
+                        std::vector<uint32_t> & child_shapes) {
+      sort_by_hash(child_shapes);
+      uint64_t h = subtree_hash_combine(site_hash, child_shapes.size());
+      for (uint32_t c : child_shapes) {
+        h = subtree_hash_combine(h, shapes[c].hash);
+      }
+      auto search = shape_index.find(h);
+      if (search != shape_index.end()) {
+        return search->second;
+      }
+      tree_shape_t shape;
+      shape.hash = h;
+      shape.type = type;
+      shape.module = module;
+      shape.offset = offset;
+      shape.size = 1;
+      shape.height = 0;
+      shape.first_child = children.size();
+      shape.instances = 0;
+      for (uint32_t c : child_shapes) {
+        shape.size += shapes[c].size;
+        shape.height = shapes[c].height + 1 > shape.height ? shapes[c].height + 1 : shape.height;
+      }
+      add_runs(child_shapes, children);
+      shape.n_child_runs = children.size() - shape.first_child;
+      shape_index.insert( {h, (uint32_t) shapes.size()} );
+      shapes.push_back(shape);
+      return shapes.size() - 1;
+    }
+
+    /* Finish building, given the shapes of the roots (sorted in place) and
+     * the module names the vertices' module indices refer to. Counts the
+     * instances of every shape.
+     */
+    void finish(std::vector<uint32_t> & root_shapes, const std::vector<std::string> & module_names) {
+      modules = module_names;
+      sort_by_hash(root_shapes);
+      roots.clear();
+      add_runs(root_shapes, roots);
+      shape_index.clear();
+
+      // Shapes were created children first, so walking them backwards visits
+      // every parent before its children
+      for (tree_shape_t & shape : shapes) {
+        shape.instances = 0;
+      }
+      for (const shape_run_t & root : roots) {
+        shapes[root.shape].instances += root.count;
+      }
+      for (uint64_t s = shapes.size(); s-- > 0; ) {
+        const tree_shape_t & shape = shapes[s];
+        for (uint64_t c = shape.first_child; c < shape.first_child + shape.n_child_runs; c++) {
+          shapes[children[c].shape].instances += shape.instances * children[c].count;
+        }
+      }
+    }
+
+    uint64_t get_num_shapes() const {
+      return shapes.size();
+    }
+
+    const tree_shape_t & get_shape(uint32_t s) const {
+      return shapes[s];
+    }
+
+    const std::vector<shape_run_t> & get_roots() const {
+      return roots;
+    }
+
+    const shape_run_t * get_children(uint32_t s) const {
+      return children.data() + shapes[s].first_child;
+    }
+
+    const std::string & get_module(uint32_t s) const {
+      return modules[shapes[s].module];
+    }
+
+    // Vertices in the uncompressed tree
+    uint64_t get_num_vertices() const {
+      uint64_t n = 0;
+      for (const shape_run_t & root : roots) {
+        n += root.count * shapes[root.shape].size;
+      }
+      return n;
+    }
+
+    // Length of the longest root-to-leaf path, in edges
+    uint32_t get_height() const {
+      uint32_t height = 0;
+      for (const shape_run_t & root : roots) {
+        height = shapes[root.shape].height > height ? shapes[root.shape].height : height;
+      }
+      return height;
+    }
+
+    // Vertices of the given type in the uncompressed tree
+    uint64_t count_type(uint32_t type) const {
+      uint64_t n = 0;
+      for (const tree_shape_t & shape : shapes) {
+        n += shape.type == type ? shape.instances : 0;
+      }
+      return n;
+    }
+
+    // Vertices created at the given call site in the uncompressed tree
+    uint64_t count_call_site(const std::string & module, uint64_t offset) const {
+      uint64_t n = 0;
+      for (const tree_shape_t & shape : shapes) {
+        if (shape.offset == offset && modules[shape.module] == module) {
+          n += shape.instances;
+        }
+      }
+      return n;
+    }
+
+    // Bytes held by the compressed form
+    size_t get_memory_usage() const {
+      size_t bytes = shapes.capacity() * sizeof(tree_shape_t) +
+                     (children.capacity() + roots.capacity()) * sizeof(shape_run_t);
+      for (const std::string & module : modules) {
+        bytes += module.capacity();
+      }
+      return bytes;
+    }
+
+    /* Graphviz rendering with one node per shape. Edges carry the number of
+     * identical children when there is more than one, and nodes the number of
+     * times the shape occurs in the tree.
+     */
+    void write_dot(std::ostream & out, const char * const * type_names,
+                   uint32_t n_type_names) const {
+      out << "digraph G {\n";
+      for (uint64_t s = 0; s < shapes.size(); s++) {
+        const tree_shape_t & shape = shapes[s];
+        out << "s" << s << "[label=\""
+            << (shape.type < n_type_names ? type_names[shape.type] : "?") << "\n"
+            << modules[shape.module] << "+0x" << std::hex << shape.offset << std::dec << "\n"
+            << "x " << shape.instances << ", " << shape.size << " vertices\"];\n";
+      }
+      for (uint64_t s = 0; s < shapes.size(); s++) {
+        const tree_shape_t & shape = shapes[s];
+        for (uint64_t c = shape.first_child; c < shape.first_child + shape.n_child_runs; c++) {
+          out << "s" << s << "->s" << children[c].shape;
+          if (children[c].count > 1) {
+            out << "[label=\"x " << children[c].count << "\"]";
+          }
+          out << ";\n";
+        }
+      }
+      out << "}\n";
+    }
+};
+
+#endif // COMPRESSED_TREE_H
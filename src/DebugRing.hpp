@@ -0,0 +1,182 @@
+#ifndef DEBUG_RING_H
+#define DEBUG_RING_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/locks.hpp"
+
+#include "OMPT_helpers.hpp"
+#include "Timing.hpp"
+
+/******************************************************************************\
+ * Binary debug tracing.
+ *
+ * With DEBUG defined, DEBUG_EVENT(code, a0, a1, a2, a3) appends a fixed-size
+ * record (timestamp, event code, four integer arguments) to the calling
+ * thread's ring buffer. Nothing is formatted and no lock is taken on the
+ * recording path; when a ring is full its oldest records are overwritten.
+ * The rings are merged by timestamp and decoded to text only when they are
+ * dumped, at finalize or from the signal handler. Without DEBUG the macro
+ * expands to nothing.
+\******************************************************************************/
+
+#ifndef DEBUG_RING_SIZE
+#define DEBUG_RING_SIZE (1 << 16)
+#endif
+
+enum class DebugEvent : uint16_t {
+  TaskCreate,
+  TaskDataNotNull,
+  ParallelDataNotNull,
+  ImplicitTaskBegin,
+  ImplicitTaskEnd,
+  ImplicitTaskBadEndpoint,
+  ParallelBegin,
+  ParallelEnd,
+  SyncRegion,
+  TaskSchedule,
+  TaskDependences,
+  DependencesWithoutParent,
+  RegisterTask,
+  RegisterRegion,
+  TaskNotFound,
+  Signal,
+  Count
+};
+
+/* Name and argument format of each event. Arguments are always passed as
+ * four uint64_t; unused trailing ones are ignored.
+ */
+static const struct debug_event_format {
+  const char * name;
+  const char * format;
+} debug_event_formats[] = {
+  {"task_create", "task=%" PRIu64 " parent=%" PRIu64 " type=%" PRIu64 " codeptr_ra=0x%" PRIx64},
+  {"task_data_not_null", "task=%" PRIu64},
+  {"parallel_data_not_null", "region=%" PRIu64},
+  {"implicit_task_begin", "task=%" PRIu64 " region=%" PRIu64 " thread_num=%" PRIu64 " team_size=%" PRIu64},
+  {"implicit_task_end", "task=%" PRIu64},
+  {"implicit_task_bad_endpoint", "endpoint=%" PRIu64},
+  {"parallel_begin", "region=%" PRIu64 " parent=%" PRIu64 " requested_team_size=%" PRIu64 " codeptr_ra=0x%" PRIx64},
+  {"parallel_end", "region=%" PRIu64},
+  {"sync_region", "kind=%" PRIu64 " endpoint=%" PRIu64 " task=%" PRIu64 " codeptr_ra=0x%" PRIx64},
+  {"task_schedule", "prior=%" PRIu64 " status=%" PRIu64 " next=%" PRIu64},
+  {"task_dependences", "task=%" PRIu64 " ndeps=%" PRIu64 " edges=%" PRIu64},
+  {"dependences_without_parent", "task=%" PRIu64},
+  {"register_task", "task=%" PRIu64 " inserted=%" PRIu64},
+  {"register_region", "region=%" PRIu64 " inserted=%" PRIu64},
+  {"task_not_found", "task=%" PRIu64},
+  {"signal", "signum=%" PRIu64}
+};
+
+typedef struct debug_record {
+  uint64_t time;
+  DebugEvent code;
+  uint16_t reserved;
+  uint32_t thread;
+  uint64_t args[4];
+} debug_record_t;
+
+typedef struct debug_ring {
+  uint32_t thread;
+  // Records written so far; the ring holds the last DEBUG_RING_SIZE of them
+  uint64_t head;
+  debug_record_t records[DEBUG_RING_SIZE];
+} debug_ring_t;
+
+static std::vector<debug_ring_t *> debug_rings;
+static boost::mutex debug_rings_mtx;
+static thread_local debug_ring_t * current_debug_ring = NULL;
+
+static inline debug_ring_t * get_debug_ring()
+{
+  if (current_debug_ring == NULL) {
+    debug_ring_t * ring = (debug_ring_t *) malloc(sizeof(debug_ring_t));
+    ring->head = 0;
+    boost::lock_guard<boost::mutex> lock(debug_rings_mtx);
+    ring->thread = debug_rings.size();
+    debug_rings.push_back(ring);
+    current_debug_ring = ring;
+  }
+  return current_debug_ring;
+}
+
+static inline void debug_event(DebugEvent code, uint64_t a0, uint64_t a1,
+                               uint64_t a2, uint64_t a3)
+{
+  debug_ring_t * ring = get_debug_ring();
+  debug_record_t & record = ring->records[ring->head % DEBUG_RING_SIZE];
+  record.time = get_timestamp();
+  record.code = code;
+  record.thread = ring->thread;
+  record.args[0] = a0;
+  record.args[1] = a1;
+  record.args[2] = a2;
+  record.args[3] = a3;
+  ring->head++;
+}
+
+#ifdef DEBUG
+#define DEBUG_EVENT(code, a0, a1, a2, a3) \
+  debug_event(DebugEvent::code, (uint64_t) (a0), (uint64_t) (a1), (uint64_t) (a2), (uint64_t) (a3))
+#else
+// Arguments are still referenced, but never evaluated
+#define DEBUG_EVENT(code, a0, a1, a2, a3) \
+  do { if (0) { (void) (a0); (void) (a1); (void) (a2); (void) (a3); } } while (0)
+#endif
+
+
+/* Merge all threads' rings in time order and write them out as text */
+static inline void dump_debug_rings(const std::string & path)
+{
+  FILE * f = fopen(path.c_str(), "w");
+  if (f == NULL) {
+    printf("Could not open debug trace %s\n", path.c_str());
+    return;
+  }
+  std::vector<const debug_record_t *> records;
+  uint64_t dropped = 0;
+  {
+    boost::lock_guard<boost::mutex> lock(debug_rings_mtx);
+    for (debug_ring_t * ring : debug_rings) {
+      uint64_t first = ring->head > DEBUG_RING_SIZE ? ring->head - DEBUG_RING_SIZE : 0;
+      dropped += first;
+      for (uint64_t i = first; i < ring->head; i++) {
+        records.push_back(&ring->records[i % DEBUG_RING_SIZE]);
+      }
+    }
+  }
+  std::stable_sort(records.begin(), records.end(),
+                   [](const debug_record_t * a, const debug_record_t * b) {
+                     return a->time < b->time;
+                   });
+  if (dropped > 0) {
+    fprintf(f, "# %" PRIu64 " older records were overwritten\n", dropped);
+  }
+  const uint64_t start = records.empty() ? 0 : records.front()->time;
+  char type[256];
+  for (const debug_record_t * r : records) {
+    if (r->code >= DebugEvent::Count) {
+      continue;
+    }
+    const debug_event_format & event = debug_event_formats[(int) r->code];
+    fprintf(f, "%12" PRIu64 " %3u %-28s ", r->time - start, r->thread, event.name);
+    fprintf(f, event.format, r->args[0], r->args[1], r->args[2], r->args[3]);
+    if (r->code == DebugEvent::TaskCreate) {
+      type[0] = '\0';
+      format_task_type((int) r->args[2], type);
+      fprintf(f, " (%s)", type);
+    }
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+#endif // DEBUG_RING_H
@@ -0,0 +1,85 @@
+#ifndef DEPENDENCE_TABLE_H
+#define DEPENDENCE_TABLE_H
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "ompt.h"
+
+class Task;
+
+/******************************************************************************\
+ * Resolution of task dependences from the dependence lists the runtime
+ * reports for each new task.
+ *
+ * Dependences only order sibling tasks, and the siblings are created one at a
+ * time by their parent, so every parent task owns its own table and only the
+ * thread executing the parent ever touches it: resolving needs no lock. For
+ * each dependence address the table keeps the last task that wrote it and the
+ * tasks that have read it since:
+ *   in          depends on the last writer
+ *   out, inout  depends on the last writer and every reader since, then
+ *               becomes the last writer
+\******************************************************************************/
+
+class DependenceTable
+{
+  private:
+    typedef struct dependence_entry {
+      Task * last_writer;
+      std::vector<Task *> readers;
+    } dependence_entry_t;
+
+    std::unordered_map<const void *, dependence_entry_t> entries;
+    // Producers found for the task being resolved, reused between calls
+    std::vector<Task *> producers;
+
+  public:
+    size_t size() const {
+      return entries.size();
+    }
+
+    // Bytes owned by the table
+    size_t get_memory_usage() const {
+      size_t bytes = sizeof(DependenceTable) + producers.capacity() * sizeof(Task *);
+      bytes += entries.bucket_count() * sizeof(void *);
+      for (auto & e : entries) {
+        bytes += sizeof(void *) + sizeof(e) + e.second.readers.capacity() * sizeof(Task *);
+      }
+      return bytes;
+    }
+
+    // Find the tasks that consumer depends on and record its own accesses.
+    // add_edge(producer, consumer) is called once per distinct producer.
+    template <class F>
+    size_t resolve(Task * consumer, const ompt_task_dependence_t * deps, int ndeps, F add_edge) {
+      producers.clear();
+      for (int i = 0; i < ndeps; i++) {
+        dependence_entry_t & entry = entries[deps[i].variable_addr];
+        if (entry.last_writer != NULL && entry.last_writer != consumer) {
+          producers.push_back(entry.last_writer);
+        }
+        if (deps[i].dependence_flags & ompt_task_dependence_type_out) {
+          for (Task * reader : entry.readers) {
+            if (reader != consumer) {
+              producers.push_back(reader);
+            }
+          }
+          entry.readers.clear();
+          entry.last_writer = consumer;
+        } else if (entry.readers.empty() || entry.readers.back() != consumer) {
+          entry.readers.push_back(consumer);
+        }
+      }
+      // A producer reached through several addresses is still one edge
+      std::sort(producers.begin(), producers.end());
+      auto last = std::unique(producers.begin(), producers.end());
+      for (auto it = producers.begin(); it != last; ++it) {
+        add_edge(*it, consumer);
+      }
+      return last - producers.begin();
+    }
+};
+
+#endif // DEPENDENCE_TABLE_H
@@ -0,0 +1,253 @@
+#ifndef FILTERED_EXPORT_H
+#define FILTERED_EXPORT_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ToolData.hpp"
+#include "Tree.hpp"
+
+/******************************************************************************\
+ * Bounded-size DOT export of the task ancestry tree.
+ *
+ * Settings, from the environment:
+ *   TASK_TREE_MAX_DEPTH  only show this many levels below the root
+ *   TASK_TREE_ROOT       only show the subtree of this task or region ID
+ *   TASK_TREE_COLLAPSE   when 1, siblings of the same kind created at the
+ *                        same codeptr_ra become one node with a count, and
+ *                        their children are merged the same way, level by
+ *                        level
+ * When any of these is set the DOT file is streamed straight from the tool's
+ * task and region records with a depth-first walk; no graph of the output is
+ * built. Only the child lists of the records (two arrays) and the walk's
+ * stack are held in memory.
+\******************************************************************************/
+
+typedef struct export_filter {
+  // Levels below the root to show, 0 for no limit
+  uint32_t max_depth;
+  // Root of the exported subtree, 0 for the whole tree
+  uint64_t root_id;
+  bool collapse;
+} export_filter_t;
+
+static export_filter_t get_export_filter()
+{
+  export_filter_t filter = {0, 0, false};
+  char * env_var = getenv("TASK_TREE_MAX_DEPTH");
+  if (env_var != NULL) {
+    filter.max_depth = strtoul(env_var, NULL, 10);
+  }
+  env_var = getenv("TASK_TREE_ROOT");
+  if (env_var != NULL) {
+    filter.root_id = strtoull(env_var, NULL, 10);
+  }
+  env_var = getenv("TASK_TREE_COLLAPSE");
+  if (env_var != NULL && strcmp(env_var, "1") == 0) {
+    filter.collapse = true;
+  }
+  return filter;
+}
+
+static bool export_filter_active(const export_filter_t & filter)
+{
+  return filter.max_depth > 0 || filter.root_id != 0 || filter.collapse;
+}
+
+
+/* Tasks and regions flattened into arrays, with children in CSR form */
+typedef struct export_nodes {
+  std::vector<uint64_t> ids;
+  std::vector<VertexType> types;
+  std::vector<const void *> codeptrs;
+  std::vector<uint32_t> parents;
+  std::vector<uint32_t> child_begin;
+  std::vector<uint32_t> children;
+} export_nodes_t;
+
+static const uint32_t EXPORT_NONE = UINT32_MAX;
+
+static void collect_export_nodes(tool_data_t * tool_data, export_nodes_t & nodes)
+{
+  const size_t n = tool_data->id_to_task.size() + tool_data->id_to_parallel_region.size();
+  std::vector<uint64_t> parent_ids;
+  nodes.ids.reserve(n);
+  nodes.types.reserve(n);
+  nodes.codeptrs.reserve(n);
+  parent_ids.reserve(n);
+  for (auto e : tool_data->id_to_parallel_region) {
+    ParallelRegion * pr = e.second;
+    nodes.ids.push_back(pr->get_id());
+    nodes.types.push_back(VertexType::ParallelRegion);
+    nodes.codeptrs.push_back(pr->get_codeptr_ra());
+    parent_ids.push_back(pr->get_parent_id());
+  }
+  for (auto e : tool_data->id_to_task) {
+    Task * t = e.second;
+    nodes.ids.push_back(t->get_id());
+    nodes.types.push_back(t->get_type() == TaskType::Explicit ?
+                          VertexType::ExplicitTask : VertexType::ImplicitTask);
+    nodes.codeptrs.push_back(t->get_codeptr_ra());
+    parent_ids.push_back(t->is_initial() ? 0 : t->get_parent_id());
+  }
+
+  std::unordered_map<uint64_t, uint32_t> id_to_index;
+  id_to_index.reserve(n);
+  for (uint32_t i = 0; i < n; i++) {
+    id_to_index.insert( {nodes.ids[i], i} );
+  }
+  nodes.parents.assign(n, EXPORT_NONE);
+  nodes.child_begin.assign(n + 1, 0);
+  for (uint32_t i = 0; i < n; i++) {
+    auto search = id_to_index.find(parent_ids[i]);
+    if (parent_ids[i] != 0 && search != id_to_index.end()) {
+      nodes.parents[i] = search->second;
+      nodes.child_begin[search->second + 1]++;
+    }
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    nodes.child_begin[i + 1] += nodes.child_begin[i];
+  }
+  // Children in creation order, which for tasks and regions is ID order
+  nodes.children.resize(nodes.child_begin[n]);
+  std::vector<uint32_t> fill(nodes.child_begin.begin(), nodes.child_begin.end() - 1);
+  std::vector<uint32_t> order(n);
+  for (uint32_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return nodes.ids[a] < nodes.ids[b];
+  });
+  for (uint32_t i : order) {
+    if (nodes.parents[i] != EXPORT_NONE) {
+      nodes.children[fill[nodes.parents[i]]++] = i;
+    }
+  }
+}
+
+
+/* A node of the exported graph: one record, or a group of collapsed siblings */
+typedef struct export_group {
+  std::vector<uint32_t> members;
+  uint32_t depth;
+  // DOT node of the parent group, or -1 for a root
+  int64_t parent_node;
+} export_group_t;
+
+static void write_export_node(std::ostream & out, int64_t node,
+                              const export_nodes_t & nodes,
+                              const std::vector<uint32_t> & members)
+{
+  uint32_t first = members.front();
+  vprops_t vp = construct_vprops(nodes.types[first], nodes.ids[first], nodes.codeptrs[first]);
+  out << "n" << node << "[label=\"" << vp.vertex_type << "\n";
+  if (members.size() == 1) {
+    out << vp.vertex_id << "\nStatus: " << vp.status << "\n";
+  } else {
+    out << "x " << members.size() << "\n";
+  }
+  out << "codeptr_ra: " << vp.codeptr_ra << "\n\""
+      << ", shape=" << vp.shape
+      << ", style=filled, fillcolor=" << vp.color << "];\n";
+}
+
+/* Split the children of members into groups, in order of first appearance */
+static void group_children(const export_nodes_t & nodes,
+                           const std::vector<uint32_t> & members, bool collapse,
+                           uint32_t depth, int64_t parent_node,
+                           std::vector<export_group_t> & groups)
+{
+  typedef std::pair<int, const void *> key_t;
+  std::map<key_t, size_t> key_to_group;
+  for (uint32_t m : members) {
+    for (uint32_t c = nodes.child_begin[m]; c < nodes.child_begin[m + 1]; c++) {
+      uint32_t child = nodes.children[c];
+      if (collapse) {
+        key_t key((int) nodes.types[child], nodes.codeptrs[child]);
+        auto search = key_to_group.find(key);
+        if (search != key_to_group.end()) {
+          groups[search->second].members.push_back(child);
+          continue;
+        }
+        key_to_group.insert( {key, groups.size()} );
+      }
+      export_group_t group;
+      group.members.push_back(child);
+      group.depth = depth;
+      group.parent_node = parent_node;
+      groups.push_back(std::move(group));
+    }
+  }
+}
+
+/* Stream the filtered tree to out as DOT. Returns the number of nodes written. */
+static uint64_t write_filtered_tree(tool_data_t * tool_data, const export_filter_t & filter,
+                                    std::ostream & out)
+{
+  export_nodes_t nodes;
+  collect_export_nodes(tool_data, nodes);
+  const uint32_t n = nodes.ids.size();
+
+  std::vector<export_group_t> roots;
+  for (uint32_t i = 0; i < n; i++) {
+    bool is_root = filter.root_id != 0 ? nodes.ids[i] == filter.root_id
+                                       : nodes.parents[i] == EXPORT_NONE;
+    if (is_root) {
+      export_group_t group;
+      group.members.push_back(i);
+      group.depth = 0;
+      group.parent_node = -1;
+      roots.push_back(std::move(group));
+    }
+  }
+  if (filter.root_id != 0 && roots.empty()) {
+    printf("TASK_TREE_ROOT %" PRIu64 " is not a task or parallel region\n", filter.root_id);
+  }
+
+  out << "digraph G {\n";
+  int64_t next_node = 0;
+  std::vector<export_group_t> stack(roots.rbegin(), roots.rend());
+  std::vector<export_group_t> children;
+  while (!stack.empty()) {
+    export_group_t group = std::move(stack.back());
+    stack.pop_back();
+    const int64_t node = next_node++;
+    write_export_node(out, node, nodes, group.members);
+    if (group.parent_node >= 0) {
+      out << "n" << group.parent_node << "->n" << node << " ;\n";
+    }
+
+    if (filter.max_depth > 0 && group.depth >= filter.max_depth) {
+      // Summarize what lies below the cut
+      uint64_t hidden = 0;
+      for (uint32_t m : group.members) {
+        hidden += nodes.child_begin[m + 1] - nodes.child_begin[m];
+      }
+      if (hidden > 0) {
+        const int64_t more = next_node++;
+        out << "n" << more << "[label=\"" << hidden
+            << " more children\", shape=plaintext];\n"
+            << "n" << node << "->n" << more << " [style=dotted];\n";
+      }
+      continue;
+    }
+
+    children.clear();
+    group_children(nodes, group.members, filter.collapse, group.depth + 1, node, children);
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      stack.push_back(std::move(*it));
+    }
+  }
+  out << "}\n";
+  return next_node;
+}
+
+#endif // FILTERED_EXPORT_H
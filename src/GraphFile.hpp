@@ -0,0 +1,380 @@
+#ifndef GRAPH_FILE_H
+#define GRAPH_FILE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+/******************************************************************************\
+ * Compressed sparse row export of the task graph (ancestry tree, join edges
+ * and dependence DAG) for graph analytics tools.
+ *
+ * Layout, all integers little-endian, every section starting at a multiple of
+ * 8 bytes from the start of the file:
+ *
+ *   header          graph_file_header_t
+ *   offsets         uint64_t[n_vertices + 1]; vertex v's out-edges are
+ *                   targets[offsets[v], offsets[v + 1])
+ *   targets         uint32_t[n_edges], vertex indices
+ *   edge_types      uint8_t[n_edges], GraphEdgeType
+ *   ids             uint64_t[n_vertices], task or region ID
+ *   codeptrs        uint64_t[n_vertices], codeptr_ra
+ *   subtree_hashes  uint64_t[n_vertices], see SubtreeHash.hpp
+ *   vertex_types    uint8_t[n_vertices], GraphVertexType
+ *
+ * Each section is written with a single write from the array that holds it,
+ * and GraphFile maps the file and hands out pointers to the sections in
+ * place. write_graphml_file writes the same graph as GraphML for tools that
+ * only read text formats.
+ *
+ * Like AncestryIndex.hpp, this header does not depend on OMPT or Boost so
+ * that analysis tools can include it on its own.
+\******************************************************************************/
+
+#define GRAPH_FILE_MAGIC "OMPTCSR1"
+#define GRAPH_FILE_VERSION 1
+
+// Same order as VertexType and EdgeType in Tree.hpp
+enum class GraphVertexType : uint8_t {ExplicitTask, ImplicitTask, ParallelRegion,
+                                      Barrier, Taskwait, Taskgroup, Worksharing};
+enum class GraphEdgeType : uint8_t {Ancestry, Join, Dependence};
+
+typedef struct graph_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t n_vertices;
+  uint64_t n_edges;
+  // Byte offsets of each section from the start of the file
+  uint64_t offsets_offset;
+  uint64_t targets_offset;
+  uint64_t edge_types_offset;
+  uint64_t ids_offset;
+  uint64_t codeptrs_offset;
+  uint64_t subtree_hashes_offset;
+  uint64_t vertex_types_offset;
+  uint64_t file_size;
+} graph_file_header_t;
+
+/* The graph as the writers take it: CSR arrays plus one column per vertex
+ * attribute
+ */
+typedef struct graph_columns {
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> targets;
+  std::vector<uint8_t> edge_types;
+  std::vector<uint64_t> ids;
+  std::vector<uint64_t> codeptrs;
+  std::vector<uint64_t> subtree_hashes;
+  std::vector<uint8_t> vertex_types;
+} graph_columns_t;
+
+static inline uint64_t graph_file_align(uint64_t offset) {
+  return (offset + 7) & ~((uint64_t)7);
+}
+
+static inline const char * graph_vertex_type_name(uint8_t type) {
+  static const char * names[] = {"explicit_task", "implicit_task", "parallel_region",
+                                 "barrier", "taskwait", "taskgroup", "worksharing"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+static inline const char * graph_edge_type_name(uint8_t type) {
+  static const char * names[] = {"ancestry", "join", "dependence"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+/* Write the whole buffer, retrying short writes */
+static inline bool graph_file_write(int fd, const void * data, uint64_t size) {
+  const char * p = (const char *) data;
+  while (size > 0) {
+    ssize_t written = write(fd, p, size);
+    if (written <= 0) {
+      return false;
+    }
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
+/* Write a section at its offset, padding from the end of the previous one */
+static inline bool graph_file_write_section(int fd, uint64_t & position, uint64_t offset,
+                                            const void * data, uint64_t size) {
+  static const char zeros[8] = {0};
+  if (!graph_file_write(fd, zeros, offset - position)) {
+    return false;
+  }
+  position = offset + size;
+  return graph_file_write(fd, data, size);
+}
+
+/* Write the CSR file. Returns false if the file could not be written. */
+static inline bool write_graph_file(const std::string & path, const graph_columns_t & graph)
+{
+  graph_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic));
+  header.version = GRAPH_FILE_VERSION;
+  header.n_vertices = graph.ids.size();
+  header.n_edges = graph.targets.size();
+  uint64_t offset = graph_file_align(sizeof(header));
+  header.offsets_offset = offset;
+  offset = graph_file_align(offset + graph.offsets.size() * sizeof(uint64_t));
+  header.targets_offset = offset;
+  offset = graph_file_align(offset + header.n_edges * sizeof(uint32_t));
+  header.edge_types_offset = offset;
+  offset = graph_file_align(offset + header.n_edges);
+  header.ids_offset = offset;
+  offset = graph_file_align(offset + header.n_vertices * sizeof(uint64_t));
+  header.codeptrs_offset = offset;
+  offset = graph_file_align(offset + header.n_vertices * sizeof(uint64_t));
+  header.subtree_hashes_offset = offset;
+  offset = graph_file_align(offset + header.n_vertices * sizeof(uint64_t));
+  header.vertex_types_offset = offset;
+  offset = graph_file_align(offset + header.n_vertices);
+  header.file_size = offset;
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Could not open graph file %s\n", path.c_str());
+    return false;
+  }
+  uint64_t position = 0;
+  bool ok =
+    graph_file_write_section(fd, position, 0, &header, sizeof(header)) &&
+    graph_file_write_section(fd, position, header.offsets_offset, graph.offsets.data(),
+                             graph.offsets.size() * sizeof(uint64_t)) &&
+    graph_file_write_section(fd, position, header.targets_offset, graph.targets.data(),
+                             header.n_edges * sizeof(uint32_t)) &&
+    graph_file_write_section(fd, position, header.edge_types_offset, graph.edge_types.data(),
+                             header.n_edges) &&
+    graph_file_write_section(fd, position, header.ids_offset, graph.ids.data(),
+                             header.n_vertices * sizeof(uint64_t)) &&
+    graph_file_write_section(fd, position, header.codeptrs_offset, graph.codeptrs.data(),
+                             header.n_vertices * sizeof(uint64_t)) &&
+    graph_file_write_section(fd, position, header.subtree_hashes_offset,
+                             graph.subtree_hashes.data(), header.n_vertices * sizeof(uint64_t)) &&
+    graph_file_write_section(fd, position, header.vertex_types_offset, graph.vertex_types.data(),
+                             header.n_vertices) &&
+    graph_file_write_section(fd, position, header.file_size, NULL, 0);
+  close(fd);
+  if (!ok) {
+    printf("Could not write graph file %s\n", path.c_str());
+  }
+  return ok;
+}
+
+/* Write the graph as GraphML. The text is formatted into a large buffer that
+ * is written out whenever it fills up.
+ */
+static inline bool write_graphml_file(const std::string & path, const graph_columns_t & graph)
+{
+  const size_t chunk = 1 << 20;
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Could not open GraphML file %s\n", path.c_str());
+    return false;
+  }
+  std::vector<char> buffer(chunk + 512);
+  size_t length = 0;
+  bool ok = true;
+  auto flush = [&](size_t limit) {
+    if (length > limit) {
+      ok = ok && graph_file_write(fd, buffer.data(), length);
+      length = 0;
+    }
+  };
+  auto append = [&](const char * format, auto... args) {
+    length += snprintf(buffer.data() + length, buffer.size() - length, format, args...);
+    flush(chunk);
+  };
+
+  append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+         "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+         "<key id=\"id\" for=\"node\" attr.name=\"id\" attr.type=\"long\"/>\n"
+         "<key id=\"type\" for=\"node\" attr.name=\"type\" attr.type=\"string\"/>\n");
+  append("<key id=\"codeptr_ra\" for=\"node\" attr.name=\"codeptr_ra\" attr.type=\"string\"/>\n"
+         "<key id=\"subtree_hash\" for=\"node\" attr.name=\"subtree_hash\" attr.type=\"string\"/>\n"
+         "<key id=\"edge_type\" for=\"edge\" attr.name=\"edge_type\" attr.type=\"string\"/>\n"
+         "<graph edgedefault=\"directed\">\n");
+  for (uint64_t v = 0; v < graph.ids.size(); v++) {
+    append("<node id=\"n%" PRIu64 "\"><data key=\"id\">%" PRIu64 "</data>"
+           "<data key=\"type\">%s</data><data key=\"codeptr_ra\">0x%" PRIx64 "</data>"
+           "<data key=\"subtree_hash\">%016" PRIx64 "</data></node>\n",
+           v, graph.ids[v], graph_vertex_type_name(graph.vertex_types[v]),
+           graph.codeptrs[v], graph.subtree_hashes[v]);
+  }
+  for (uint64_t v = 0; v < graph.ids.size(); v++) {
+    for (uint64_t e = graph.offsets[v]; e < graph.offsets[v + 1]; e++) {
+      append("<edge source=\"n%" PRIu64 "\" target=\"n%u\"><data key=\"edge_type\">%s</data></edge>\n",
+             v, graph.targets[e], graph_edge_type_name(graph.edge_types[e]));
+    }
+  }
+  append("</graph>\n</graphml>\n");
+  flush(0);
+  close(fd);
+  if (!ok) {
+    printf("Could not write GraphML file %s\n", path.c_str());
+  }
+  return ok;
+}
+
+
+/* Read-only, memory-mapped view of a CSR graph file. All accessors return
+ * pointers into the mapping, which stay valid until the file is closed.
+ */
+class GraphFile
+{
+  private:
+    void * map;
+    uint64_t map_size;
+    const graph_file_header_t * header;
+
+    template <typename T>
+    const T * section(uint64_t offset) const {
+      return (const T *) ((const char *) map + offset);
+    }
+
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t entry_size) const {
+      return offset % 8 == 0 && offset <= map_size &&
+             count <= (map_size - offset) / entry_size;
+    }
+
+    // Whether every section lies inside the mapping and the CSR arrays are
+    // consistent: offsets start at 0, never decrease and end at n_edges, and
+    // every target is a vertex
+    bool header_is_valid() const {
+      const uint64_t n = header->n_vertices;
+      const uint64_t m = header->n_edges;
+      if (n > UINT32_MAX ||
+          !section_fits(header->offsets_offset, n + 1, sizeof(uint64_t)) ||
+          !section_fits(header->targets_offset, m, sizeof(uint32_t)) ||
+          !section_fits(header->edge_types_offset, m, sizeof(uint8_t)) ||
+          !section_fits(header->ids_offset, n, sizeof(uint64_t)) ||
+          !section_fits(header->codeptrs_offset, n, sizeof(uint64_t)) ||
+          !section_fits(header->subtree_hashes_offset, n, sizeof(uint64_t)) ||
+          !section_fits(header->vertex_types_offset, n, sizeof(uint8_t))) {
+        return false;
+      }
+      const uint64_t * row = section<uint64_t>(header->offsets_offset);
+      if (row[0] != 0 || row[n] != m) {
+        return false;
+      }
+      for (uint64_t v = 0; v < n; v++) {
+        if (row[v] > row[v + 1]) {
+          return false;
+        }
+      }
+      const uint32_t * target = section<uint32_t>(header->targets_offset);
+      for (uint64_t e = 0; e < m; e++) {
+        if (target[e] >= n) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  public:
+    GraphFile() : map(NULL), map_size(0), header(NULL) {}
+
+    explicit GraphFile(const std::string & path) : map(NULL), map_size(0), header(NULL) {
+      open(path);
+    }
+
+    ~GraphFile() {
+      close();
+    }
+
+    GraphFile(const GraphFile &) = delete;
+    GraphFile & operator=(const GraphFile &) = delete;
+
+    bool open(const std::string & path) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(graph_file_header_t)) {
+        ::close(fd);
+        return false;
+      }
+      map_size = st.st_size;
+      map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        map = NULL;
+        return false;
+      }
+      header = (const graph_file_header_t *) map;
+      if (memcmp(header->magic, GRAPH_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+          header->version != GRAPH_FILE_VERSION || header->file_size > map_size ||
+          !header_is_valid()) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    void close() {
+      if (map != NULL) {
+        munmap(map, map_size);
+      }
+      map = NULL;
+      map_size = 0;
+      header = NULL;
+    }
+
+    bool is_open() const {
+      return header != NULL;
+    }
+
+    uint64_t num_vertices() const {
+      return header->n_vertices;
+    }
+
+    uint64_t num_edges() const {
+      return header->n_edges;
+    }
+
+    const uint64_t * offsets() const {
+      return section<uint64_t>(header->offsets_offset);
+    }
+
+    const uint32_t * targets() const {
+      return section<uint32_t>(header->targets_offset);
+    }
+
+    const uint8_t * edge_types() const {
+      return section<uint8_t>(header->edge_types_offset);
+    }
+
+    const uint64_t * ids() const {
+      return section<uint64_t>(header->ids_offset);
+    }
+
+    const uint64_t * codeptrs() const {
+      return section<uint64_t>(header->codeptrs_offset);
+    }
+
+    const uint64_t * subtree_hashes() const {
+      return section<uint64_t>(header->subtree_hashes_offset);
+    }
+
+    const uint8_t * vertex_types() const {
+      return section<uint8_t>(header->vertex_types_offset);
+    }
+
+    uint64_t out_degree(uint32_t v) const {
+      return offsets()[v + 1] - offsets()[v];
+    }
+};
+
+#endif // GRAPH_FILE_H
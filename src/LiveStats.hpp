@@ -0,0 +1,192 @@
+#ifndef LIVE_STATS_H
+#define LIVE_STATS_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+
+/******************************************************************************\
+ * Live statistics in POSIX shared memory, for watching a running job.
+ *
+ * The tool sums its threads' counters into a small segment at a fixed
+ * interval from a background thread; tools/live_monitor attaches to the
+ * segment and prints rates. The segment is guarded by a sequence lock: the
+ * writer makes the sequence odd, updates the values and makes it even again,
+ * and a reader retries its copy until it saw the same even sequence before
+ * and after. Readers never write to the segment, so a monitor can neither
+ * block nor slow down the application.
+ *
+ * Like AncestryIndex.hpp, this header does not depend on OMPT or Boost so
+ * that analysis tools can include it on its own.
+\******************************************************************************/
+
+#define LIVE_STATS_MAGIC "OMPTLIV1"
+#define LIVE_STATS_VERSION 1
+
+typedef struct live_stats_values {
+  // CLOCK_MONOTONIC time of the update, in nanoseconds
+  uint64_t time;
+  // Number of updates published so far
+  uint64_t updates;
+  uint64_t threads;
+  // Implicit and explicit tasks
+  uint64_t tasks_created;
+  uint64_t tasks_completed;
+  uint64_t parallel_regions;
+  // Deepest task or region seen, the initial task being at depth 0
+  uint64_t max_depth;
+} live_stats_values_t;
+
+typedef struct live_stats_segment {
+  char magic[8];
+  uint32_t version;
+  uint32_t pid;
+  // Odd while the values are being updated
+  std::atomic<uint64_t> sequence;
+  live_stats_values_t values;
+} live_stats_segment_t;
+
+static inline uint64_t live_stats_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The shared memory segment, created by the tool or attached to by a monitor */
+class LiveStats
+{
+  private:
+    live_stats_segment_t * segment;
+    std::string name;
+    bool owner;
+
+  public:
+    LiveStats() : segment(NULL), owner(false) {}
+
+    ~LiveStats() {
+      close();
+    }
+
+    LiveStats(const LiveStats &) = delete;
+    LiveStats & operator=(const LiveStats &) = delete;
+
+    /* Create the segment for writing. The name is a shm_open name such as
+     * "/ompt_tree.1234".
+     */
+    bool create(const std::string & segment_name) {
+      close();
+      int fd = shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        printf("Could not create shared memory segment %s\n", segment_name.c_str());
+        return false;
+      }
+      if (ftruncate(fd, sizeof(live_stats_segment_t)) != 0) {
+        ::close(fd);
+        shm_unlink(segment_name.c_str());
+        return false;
+      }
+      void * map = mmap(NULL, sizeof(live_stats_segment_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        shm_unlink(segment_name.c_str());
+        return false;
+      }
+      segment = (live_stats_segment_t *) map;
+      name = segment_name;
+      owner = true;
+      memset(&segment->values, 0, sizeof(segment->values));
+      segment->version = LIVE_STATS_VERSION;
+      segment->pid = getpid();
+      segment->sequence.store(0, std::memory_order_relaxed);
+      // The magic goes last so that a monitor never sees a half-initialized
+      // segment
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(segment->magic, LIVE_STATS_MAGIC, sizeof(segment->magic));
+      return true;
+    }
+
+    /* Attach to an existing segment for reading */
+    bool attach(const std::string & segment_name) {
+      close();
+      int fd = shm_open(segment_name.c_str(), O_RDONLY, 0);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(live_stats_segment_t)) {
+        ::close(fd);
+        return false;
+      }
+      void * map = mmap(NULL, sizeof(live_stats_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        return false;
+      }
+      segment = (live_stats_segment_t *) map;
+      name = segment_name;
+      owner = false;
+      if (memcmp(segment->magic, LIVE_STATS_MAGIC, sizeof(segment->magic)) != 0 ||
+          segment->version != LIVE_STATS_VERSION) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    /* Unmap the segment, and remove it if this process created it */
+    void close() {
+      if (segment != NULL) {
+        munmap(segment, sizeof(live_stats_segment_t));
+        if (owner) {
+          shm_unlink(name.c_str());
+        }
+      }
+      segment = NULL;
+      owner = false;
+    }
+
+    bool is_open() const {
+      return segment != NULL;
+    }
+
+    uint32_t get_pid() const {
+      return segment->pid;
+    }
+
+    /* Publish new values. Only one thread may write. */
+    void publish(const live_stats_values_t & values) {
+      uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+      segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(&segment->values, &values, sizeof(values));
+      segment->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /* Copy a consistent snapshot of the values, retrying while the writer is
+     * in the middle of an update
+     */
+    void read(live_stats_values_t & values) const {
+      while (true) {
+        uint64_t before = segment->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+          continue;
+        }
+        memcpy(&values, (const void *) &segment->values, sizeof(values));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->sequence.load(std::memory_order_relaxed) == before) {
+          return;
+        }
+      }
+    }
+};
+
+#endif // LIVE_STATS_H
@@ -0,0 +1,221 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/******************************************************************************\
+ * Accounting of the memory owned by the tool.
+ *
+ * Byte counts are what the tool asks the allocator for: the objects
+ * themselves, the heap buffers they own (labels, vectors) and the nodes and
+ * bucket arrays of the hash maps, computed from the containers' layouts.
+ * Allocator headers and fragmentation are not included.
+ *
+ * The live counters are updated as records are registered and spilled, so
+ * they are cheap to read at any time and are what the memory limit is checked
+ * against. Tasks are counted in a per-thread memory_batch_t first, which
+ * reaches the shared counters MEMORY_BATCH_BYTES at a time, so the counters
+ * may trail by that much per thread. A full report walks the data structures
+ * at finalize.
+\******************************************************************************/
+
+enum class MemoryCategory {Tasks, Labels, TaskMap, Regions, RegionMap, Locks, Loops, Count};
+
+static const char * memory_category_names[] = {
+  "tasks",
+  "task labels",
+  "id_to_task",
+  "parallel regions",
+  "id_to_parallel_region",
+  "lock records",
+  "loop records"
+};
+
+typedef struct memory_accounting {
+  std::atomic<int64_t> bytes[(int) MemoryCategory::Count];
+  std::atomic<int64_t> total;
+  std::atomic<int64_t> peak;
+  // Total at which completed tasks start being spilled to disk, 0 for none
+  int64_t limit;
+
+  memory_accounting() : total(0), peak(0), limit(0) {
+    for (int i = 0; i < (int) MemoryCategory::Count; i++) {
+      bytes[i] = 0;
+    }
+  }
+} memory_accounting_t;
+
+
+/* Add (or with a negative size, remove) bytes in category. Returns the new
+ * total.
+ */
+static inline int64_t account_memory(memory_accounting_t & memory,
+                                     MemoryCategory category, int64_t size)
+{
+  memory.bytes[(int) category].fetch_add(size, std::memory_order_relaxed);
+  int64_t total = memory.total.fetch_add(size, std::memory_order_relaxed) + size;
+  int64_t peak = memory.peak.load(std::memory_order_relaxed);
+  while (total > peak &&
+         !memory.peak.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+  }
+  return total;
+}
+
+#ifndef MEMORY_BATCH_BYTES
+#define MEMORY_BATCH_BYTES (64 * 1024)
+#endif
+
+/* Bytes a thread has registered but not yet added to the shared counters */
+typedef struct memory_batch {
+  int64_t bytes[(int) MemoryCategory::Count];
+  int64_t total;
+} memory_batch_t;
+
+/* Add the batch to the shared counters and empty it. Returns the new total. */
+static inline int64_t flush_memory_batch(memory_accounting_t & memory, memory_batch_t & batch)
+{
+  for (int i = 0; i < (int) MemoryCategory::Count; i++) {
+    if (batch.bytes[i] != 0) {
+      account_memory(memory, (MemoryCategory) i, batch.bytes[i]);
+      batch.bytes[i] = 0;
+    }
+  }
+  batch.total = 0;
+  return memory.total.load(std::memory_order_relaxed);
+}
+
+/* Add bytes in category to the batch; flush it once it holds
+ * MEMORY_BATCH_BYTES
+ */
+static inline void batch_memory(memory_batch_t & batch, MemoryCategory category, int64_t size)
+{
+  batch.bytes[(int) category] += size;
+  batch.total += size;
+}
+
+/* Bytes of one node of a node-based hash map holding value_type */
+template <class map_t>
+static inline size_t hash_map_node_bytes()
+{
+  // libstdc++ nodes hold the next pointer and the value; the hash is only
+  // cached for keys whose hash function is not trivially cheap
+  return sizeof(void *) + sizeof(typename map_t::value_type);
+}
+
+/* Bytes of a node-based hash map: the buckets plus one node per element */
+template <class map_t>
+static inline size_t hash_map_bytes(const map_t & map)
+{
+  return map.bucket_count() * sizeof(void *) + map.size() * hash_map_node_bytes<map_t>();
+}
+
+template <class T>
+static inline size_t vector_bytes(const std::vector<T> & v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+/* Heap bytes of a string. libstdc++ keeps up to 15 characters inside the
+ * std::string itself.
+ */
+static inline size_t string_heap_bytes(const std::string & s)
+{
+  return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+/* Bytes of a vector of strings, with the strings' heap buffers */
+static inline size_t string_vector_bytes(const std::vector<std::string> & v)
+{
+  size_t bytes = vector_bytes(v);
+  for (const std::string & s : v) {
+    bytes += string_heap_bytes(s);
+  }
+  return bytes;
+}
+
+/* Parse a size such as 512M, 2G or 1048576 */
+static int64_t parse_memory_size(const char * text)
+{
+  char * end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'k': case 'K':
+      value *= 1024.0;
+      break;
+    case 'm': case 'M':
+      value *= 1024.0 * 1024.0;
+      break;
+    case 'g': case 'G':
+      value *= 1024.0 * 1024.0 * 1024.0;
+      break;
+  }
+  return value > 0 ? (int64_t) value : 0;
+}
+
+/* Append text to buffer, padded with spaces to width, without going past
+ * size. Signal-safe, unlike snprintf.
+ */
+static inline size_t append_text(char * buffer, size_t len, size_t size,
+                                 const char * text, size_t width = 0)
+{
+  size_t start = len;
+  for (; *text != '\0' && len < size; text++) {
+    buffer[len++] = *text;
+  }
+  while (len - start < width && len < size) {
+    buffer[len++] = ' ';
+  }
+  return len;
+}
+
+/* Append the decimal form of value to buffer. Signal-safe. */
+static inline size_t append_int64(char * buffer, size_t len, size_t size, int64_t value)
+{
+  char digits[24];
+  int n = 0;
+  uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    digits[n++] = '-';
+  }
+  while (n > 0 && len < size) {
+    buffer[len++] = digits[--n];
+  }
+  return len;
+}
+
+/* Print the live counters. Formats by hand and only calls write(2), so it
+ * may be called from a signal handler while the tool is running.
+ */
+static void print_memory_snapshot(const memory_accounting_t & memory)
+{
+  char buffer[1024];
+  const size_t size = sizeof(buffer);
+  size_t len = append_text(buffer, 0, size, "Tool memory: ");
+  len = append_int64(buffer, len, size, memory.total.load());
+  len = append_text(buffer, len, size, " bytes (peak ");
+  len = append_int64(buffer, len, size, memory.peak.load());
+  len = append_text(buffer, len, size, ")\n");
+  for (int i = 0; i < (int) MemoryCategory::Count; i++) {
+    len = append_text(buffer, len, size, "  ");
+    len = append_text(buffer, len, size, memory_category_names[i], 24);
+    len = append_text(buffer, len, size, " ");
+    len = append_int64(buffer, len, size, memory.bytes[i].load());
+    len = append_text(buffer, len, size, "\n");
+  }
+  ssize_t written = write(STDOUT_FILENO, buffer, len);
+  (void) written;
+}
+
+#endif // MEMORY_ACCOUNTING_H
@@ -0,0 +1,204 @@
+#ifndef MERGED_DATASET_H
+#define MERGED_DATASET_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+/******************************************************************************\
+ * A single file holding the outputs of every process of a multi-process run.
+ *
+ * Layout:
+ *   merged_header_t
+ *   entry payloads, each starting at an 8-byte aligned offset and stored
+ *   byte-for-byte as the process wrote it (so a compressed DOT file stays
+ *   block-compressed and an ancestry index stays mappable in place)
+ *   merged_entry_t[n_entries], at toc_offset
+ *
+ * Entries are found through the table of contents by rank and kind, so a
+ * reader never has to scan payloads.
+\******************************************************************************/
+
+#define MERGED_DATASET_MAGIC "OMPTSET1"
+#define MERGED_DATASET_VERSION 1
+#define MERGED_NAME_LEN 64
+
+// New kinds go at the end so that existing datasets keep their meaning
+enum class OutputKind : uint32_t {Unknown, Dot, BlockCompressed, AncestryIndex,
+                                  Trace, SubtreeHashes, Graph, GraphML, Timeline};
+
+typedef struct merged_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_entries;
+  uint64_t toc_offset;
+} merged_header_t;
+
+typedef struct merged_entry {
+  int64_t rank;
+  OutputKind kind;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+  // Base name of the file the entry was merged from
+  char name[MERGED_NAME_LEN];
+} merged_entry_t;
+
+static inline uint64_t merged_align(uint64_t offset)
+{
+  return (offset + 7) & ~(uint64_t) 7;
+}
+
+/* Kind of a tool output, detected from its first bytes */
+static inline OutputKind detect_output_kind(const char * head, size_t len)
+{
+  if (len >= 8 && memcmp(head, "OMPTBLK1", 8) == 0) {
+    return OutputKind::BlockCompressed;
+  }
+  if (len >= 7 && memcmp(head, "ANCIDX1", 7) == 0) {
+    return OutputKind::AncestryIndex;
+  }
+  if (len >= 8 && memcmp(head, "OMPTTRC1", 8) == 0) {
+    return OutputKind::Trace;
+  }
+  if (len >= 8 && memcmp(head, "OMPTHSH1", 8) == 0) {
+    return OutputKind::SubtreeHashes;
+  }
+  if (len >= 8 && memcmp(head, "OMPTCSR1", 8) == 0) {
+    return OutputKind::Graph;
+  }
+  if (len >= 5 && memcmp(head, "<?xml", 5) == 0) {
+    return OutputKind::GraphML;
+  }
+  // Chrome trace-event JSON, as written by TimelineWriter
+  if (len >= 2 && memcmp(head, "{\"", 2) == 0) {
+    return OutputKind::Timeline;
+  }
+  if (len >= 7 && (memcmp(head, "digraph", 7) == 0 || memcmp(head, "graph", 5) == 0)) {
+    return OutputKind::Dot;
+  }
+  return OutputKind::Unknown;
+}
+
+static inline const char * output_kind_name(OutputKind kind)
+{
+  switch (kind) {
+    case OutputKind::Dot:
+      return "dot";
+    case OutputKind::BlockCompressed:
+      return "blk";
+    case OutputKind::AncestryIndex:
+      return "idx";
+    case OutputKind::Trace:
+      return "trace";
+    case OutputKind::SubtreeHashes:
+      return "hash";
+    case OutputKind::Graph:
+      return "csr";
+    case OutputKind::GraphML:
+      return "graphml";
+    case OutputKind::Timeline:
+      return "json";
+    default:
+      return "unknown";
+  }
+}
+
+
+class MergedDatasetReader
+{
+  private:
+    int fd;
+    merged_header_t header;
+    std::vector<merged_entry_t> entries;
+
+    // Every payload must lie between the header and the table of contents
+    bool entries_are_valid() const {
+      for (const merged_entry_t & entry : entries) {
+        if (entry.offset < sizeof(header) || entry.offset > header.toc_offset ||
+            entry.size > header.toc_offset - entry.offset) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  public:
+    MergedDatasetReader() : fd(-1) {}
+
+    explicit MergedDatasetReader(const std::string & path) : fd(-1) {
+      open(path);
+    }
+
+    ~MergedDatasetReader() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+
+    MergedDatasetReader(const MergedDatasetReader &) = delete;
+    MergedDatasetReader & operator=(const MergedDatasetReader &) = delete;
+
+    bool open(const std::string & path) {
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 ||
+          pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(header.magic, MERGED_DATASET_MAGIC, 8) != 0 ||
+          header.version != MERGED_DATASET_VERSION ||
+          header.toc_offset < sizeof(header) || header.toc_offset > (uint64_t) st.st_size ||
+          header.n_entries > ((uint64_t) st.st_size - header.toc_offset) / sizeof(merged_entry_t)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+      entries.resize(header.n_entries);
+      ssize_t toc_bytes = header.n_entries * sizeof(merged_entry_t);
+      if (pread(fd, entries.data(), toc_bytes, header.toc_offset) != toc_bytes ||
+          !entries_are_valid()) {
+        entries.clear();
+        ::close(fd);
+        fd = -1;
+        return false;
+      }
+      return true;
+    }
+
+    bool is_open() const {
+      return fd >= 0;
+    }
+
+    size_t get_num_entries() const {
+      return entries.size();
+    }
+
+    const merged_entry_t & get_entry(size_t i) const {
+      return entries[i];
+    }
+
+    // Index of the entry for rank of the given kind, or -1 if there is none
+    long find(int64_t rank, OutputKind kind) const {
+      for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].rank == rank && entries[i].kind == kind) {
+          return i;
+        }
+      }
+      return -1;
+    }
+
+    bool read_entry(size_t i, std::vector<char> & out) const {
+      const merged_entry_t & entry = entries[i];
+      out.resize(entry.size);
+      return pread(fd, out.data(), entry.size, entry.offset) == (ssize_t) entry.size;
+    }
+};
+
+#endif // MERGED_DATASET_H
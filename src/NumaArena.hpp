@@ -0,0 +1,237 @@
+#ifndef NUMA_ARENA_H
+#define NUMA_ARENA_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <new>
+
+#ifdef TOOL_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+/******************************************************************************\
+ * Per-thread arenas for the tool's records, placed on the thread's NUMA node.
+ *
+ * Each thread carves small objects (tasks, regions, its own thread data) out
+ * of chunks it maps itself. A chunk is bound to the thread's node with mbind
+ * when the tool is built with TOOL_NUMA, and is always first touched by its
+ * owner, so without binding the kernel's first-touch policy still places it
+ * locally. Chunks are aligned to their size and start with a header naming
+ * their node and owning arena, so both are found from any object with a mask.
+ *
+ * Freed blocks always return to the arena that allocated them, so they are
+ * reused on the node they live on. The owner frees onto a plain free list per
+ * size class; other threads push onto a lock-free remote list of the same
+ * class, which the owner takes over in one exchange when its own list runs
+ * dry. Nothing is returned to the system before exit.
+\******************************************************************************/
+
+#define ARENA_CHUNK_SIZE (2UL << 20)
+#define ARENA_ALIGNMENT 16
+#define ARENA_SIZE_CLASSES 128
+#define ARENA_MAX_BLOCK (ARENA_ALIGNMENT * ARENA_SIZE_CLASSES)
+
+class NumaArena;
+
+typedef struct arena_chunk_header {
+  int32_t node;
+  uint32_t reserved;
+  // Arena the chunk's blocks are returned to
+  NumaArena * owner;
+} arena_chunk_header_t;
+
+/* NUMA node the calling thread should allocate on. The tool replaces this
+ * with one that asks the OpenMP runtime for the thread's place.
+ */
+static int arena_default_node()
+{
+#ifdef TOOL_NUMA
+  int cpu = sched_getcpu();
+  if (numa_available() >= 0 && cpu >= 0) {
+    int node = numa_node_of_cpu(cpu);
+    return node >= 0 ? node : 0;
+  }
+#endif
+  return 0;
+}
+
+static int (*arena_node_of_thread)() = arena_default_node;
+
+
+class NumaArena
+{
+  private:
+    int node;
+    char * current;
+    char * end;
+    void * free_lists[ARENA_SIZE_CLASSES];
+    // Blocks freed by other threads, pushed without locking
+    std::atomic<void *> remote_free_lists[ARENA_SIZE_CLASSES];
+    uint64_t chunks;
+
+    static size_t size_class_of(size_t size) {
+      size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+      return rounded / ARENA_ALIGNMENT - 1;
+    }
+
+    bool new_chunk() {
+      // Over-map so a chunk-aligned region of ARENA_CHUNK_SIZE fits
+      size_t length = 2 * ARENA_CHUNK_SIZE;
+      char * raw = (char *) mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) {
+        return false;
+      }
+      uintptr_t aligned = ((uintptr_t) raw + ARENA_CHUNK_SIZE - 1) & ~(ARENA_CHUNK_SIZE - 1);
+      char * chunk = (char *) aligned;
+      if (chunk > raw) {
+        munmap(raw, chunk - raw);
+      }
+      char * tail = chunk + ARENA_CHUNK_SIZE;
+      if (tail < raw + length) {
+        munmap(tail, raw + length - tail);
+      }
+#ifdef TOOL_NUMA
+      if (numa_available() >= 0) {
+        unsigned long mask[16];
+        memset(mask, 0, sizeof(mask));
+        if (node < (int) (sizeof(mask) * 8)) {
+          mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+          mbind(chunk, ARENA_CHUNK_SIZE, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+        }
+      }
+#endif
+      // First touch from the owning thread
+      memset(chunk, 0, ARENA_CHUNK_SIZE);
+      arena_chunk_header_t * header = (arena_chunk_header_t *) chunk;
+      header->node = node;
+      header->owner = this;
+      current = chunk + sizeof(arena_chunk_header_t);
+      end = chunk + ARENA_CHUNK_SIZE;
+      chunks++;
+      return true;
+    }
+
+  public:
+    explicit NumaArena(int node) : node(node), current(NULL), end(NULL), chunks(0) {
+      memset(free_lists, 0, sizeof(free_lists));
+      for (size_t i = 0; i < ARENA_SIZE_CLASSES; i++) {
+        remote_free_lists[i].store(NULL, std::memory_order_relaxed);
+      }
+    }
+
+    int get_node() const {
+      return node;
+    }
+
+    uint64_t get_num_chunks() const {
+      return chunks;
+    }
+
+    void * allocate(size_t size) {
+      size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+      if (rounded == 0 || rounded > ARENA_MAX_BLOCK) {
+        return NULL;
+      }
+      size_t size_class = rounded / ARENA_ALIGNMENT - 1;
+      if (free_lists[size_class] == NULL &&
+          remote_free_lists[size_class].load(std::memory_order_relaxed) != NULL) {
+        free_lists[size_class] = remote_free_lists[size_class].exchange(NULL, std::memory_order_acquire);
+      }
+      if (free_lists[size_class] != NULL) {
+        void * block = free_lists[size_class];
+        free_lists[size_class] = *(void **) block;
+        return block;
+      }
+      if (current == NULL || current + rounded > end) {
+        if (!new_chunk()) {
+          return NULL;
+        }
+      }
+      void * block = current;
+      current += rounded;
+      return block;
+    }
+
+    // Return a block to this arena. Only its owning thread may call this.
+    void free(void * block, size_t size) {
+      size_t size_class = size_class_of(size);
+      *(void **) block = free_lists[size_class];
+      free_lists[size_class] = block;
+    }
+
+    // Return a block to this arena from another thread
+    void free_remote(void * block, size_t size) {
+      std::atomic<void *> & list = remote_free_lists[size_class_of(size)];
+      void * head = list.load(std::memory_order_relaxed);
+      do {
+        *(void **) block = head;
+      } while (!list.compare_exchange_weak(head, block, std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+};
+
+
+static thread_local NumaArena * current_arena = NULL;
+
+/* The calling thread's arena, created on the thread's node on first use */
+static NumaArena * get_thread_arena()
+{
+  if (current_arena == NULL) {
+    int node = arena_node_of_thread();
+    void * memory = NULL;
+#ifdef TOOL_NUMA
+    if (numa_available() >= 0) {
+      memory = numa_alloc_onnode(sizeof(NumaArena), node);
+    }
+#endif
+    if (memory == NULL) {
+      memory = malloc(sizeof(NumaArena));
+    }
+    current_arena = new (memory) NumaArena(node);
+  }
+  return current_arena;
+}
+
+static inline void * arena_allocate(size_t size)
+{
+  void * block = get_thread_arena()->allocate(size);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+/* Header of the chunk holding an object allocated from an arena */
+static inline const arena_chunk_header_t * arena_chunk_of(const void * object)
+{
+  return (const arena_chunk_header_t *) ((uintptr_t) object & ~(ARENA_CHUNK_SIZE - 1));
+}
+
+/* Give a block back to the arena that allocated it */
+static inline void arena_free(void * block, size_t size)
+{
+  if (block == NULL) {
+    return;
+  }
+  NumaArena * owner = arena_chunk_of(block)->owner;
+  if (owner == current_arena) {
+    owner->free(block, size);
+  } else {
+    owner->free_remote(block, size);
+  }
+}
+
+/* NUMA node holding an object allocated from an arena */
+static inline int arena_node_of(const void * object)
+{
+  return arena_chunk_of(object)->node;
+}
+
+#endif // NUMA_ARENA_H
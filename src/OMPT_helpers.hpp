@@ -15,6 +15,15 @@ do{                                                           \
 
 #define register_callback(name) register_callback_t(name, name##_t)
 
+// Register on_<name><suffix> instead of on_<name>
+#define register_callback_variant(name, suffix)               \
+do{                                                           \
+  name##_t f_##name = &on_##name##suffix;                     \
+  if (ompt_set_callback(name, (ompt_callback_t)f_##name) ==   \
+      ompt_set_never)                                         \
+    printf("0: Could not register callback '" #name "'\n");   \
+}while(0)
+
 
 static const char* ompt_thread_type_t_values[] = {
   NULL,
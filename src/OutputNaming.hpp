@@ -0,0 +1,113 @@
+#ifndef OUTPUT_NAMING_H
+#define OUTPUT_NAMING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+/******************************************************************************\
+ * Per-process output file names.
+ *
+ * Output paths taken from the environment may contain
+ *   %p  the process ID
+ *   %h  the host name
+ *   %r  the MPI rank, from the first rank variable set by the launcher
+ * When a path has none of these and the process has a rank (it was started by
+ * an MPI launcher), ".r<rank>" is inserted before the file extension so that
+ * processes never write to the same file. Slurm sets SLURM_PROCID for every
+ * srun job, so it only counts as a rank when the job has several tasks.
+\******************************************************************************/
+
+static const char * rank_env_vars[] = {
+  "PMI_RANK",
+  "OMPI_COMM_WORLD_RANK",
+  "PMIX_RANK",
+  "MV2_COMM_WORLD_RANK",
+  NULL
+};
+
+/* The MPI rank of this process, or an empty string if it has none */
+static std::string get_process_rank()
+{
+  for (int i = 0; rank_env_vars[i] != NULL; i++) {
+    char * value = getenv(rank_env_vars[i]);
+    if (value != NULL && value[0] != '\0') {
+      return value;
+    }
+  }
+  char * slurm_rank = getenv("SLURM_PROCID");
+  char * slurm_tasks = getenv("SLURM_NTASKS");
+  if (slurm_rank != NULL && slurm_rank[0] != '\0' &&
+      slurm_tasks != NULL && atoi(slurm_tasks) > 1) {
+    return slurm_rank;
+  }
+  return "";
+}
+
+static std::string get_host_name()
+{
+  char host[256];
+  if (gethostname(host, sizeof(host)) != 0) {
+    return "unknown";
+  }
+  host[sizeof(host) - 1] = '\0';
+  return host;
+}
+
+/* Expand the per-process patterns in path */
+static std::string expand_output_path(const std::string & path)
+{
+  std::string result;
+  bool has_pattern = false;
+  for (size_t i = 0; i < path.size(); i++) {
+    if (path[i] == '%' && i + 1 < path.size()) {
+      char c = path[i + 1];
+      if (c == 'p') {
+        result += std::to_string(getpid());
+      } else if (c == 'h') {
+        result += get_host_name();
+      } else if (c == 'r') {
+        std::string rank = get_process_rank();
+        result += rank.empty() ? "0" : rank;
+      } else if (c == '%') {
+        result += '%';
+      } else {
+        result += path[i];
+        continue;
+      }
+      has_pattern = true;
+      i++;
+    } else {
+      result += path[i];
+    }
+  }
+
+  std::string rank = get_process_rank();
+  if (!has_pattern && !rank.empty()) {
+    size_t slash = result.find_last_of('/');
+    size_t dot = result.find_last_of('.');
+    std::string suffix = ".r" + rank;
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash) &&
+        dot != (slash == std::string::npos ? 0 : slash + 1)) {
+      result.insert(dot, suffix);
+    } else {
+      result += suffix;
+    }
+  }
+  return result;
+}
+
+/* Output path from the environment variable env_name, or default_path if it
+ * is not set, with per-process patterns expanded
+ */
+static std::string get_output_path(const char * env_name, const std::string & default_path)
+{
+  char * env_var = getenv(env_name);
+  if (env_var == NULL) {
+    return expand_output_path(default_path);
+  }
+  return expand_output_path(env_var);
+}
+
+#endif // OUTPUT_NAMING_H
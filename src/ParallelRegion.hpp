@@ -1,6 +1,10 @@
 #ifndef PARALLEL_REGION_H
 #define PARALLEL_REGION_H
 
+#include <atomic>
+
+#include "NumaArena.hpp"
+
 class ParallelRegion
 {
   private:
@@ -9,7 +13,46 @@ class ParallelRegion
     uint64_t parent_id;
     uint32_t n_threads;
     const void* codeptr_ra;
-    std::vector<Task*> children; 
+    // One slot per requested thread, indexed by thread_num, so the implicit
+    // tasks can register themselves without locking. Each slot fills a cache
+    // line so that the threads writing neighbouring slots do not contend for
+    // one. The vector is sized once at construction and never reallocated.
+    // Implicit tasks whose thread_num is beyond the requested team size go to
+    // overflow_children under mtx.
+    typedef struct child_slot {
+      Task * task;
+      char padding[64 - sizeof(Task *)];
+    } child_slot_t;
+    std::vector<child_slot_t> children;
+    std::vector<Task*> overflow_children;
+    // Index of this region among the children of the encountering task
+    uint32_t child_index;
+    // Number of enclosing parallel regions, including this one
+    uint32_t nesting_level;
+    // Distance from the initial task in the tree
+    uint32_t depth;
+    // Team size reported by the implicit tasks, which may be smaller than
+    // the requested n_threads
+    std::atomic<uint32_t> team_size;
+    uint64_t begin_time;
+    uint64_t end_time;
+    // Latest times at which an implicit task began, arrived at a barrier and
+    // ended. The implicit tasks update these concurrently.
+    std::atomic<uint64_t> last_implicit_begin;
+    std::atomic<uint64_t> last_barrier_arrival;
+    std::atomic<uint64_t> last_implicit_end;
+
+    static void atomic_max(std::atomic<uint64_t> & target, uint64_t value) {
+      uint64_t current = target.load(std::memory_order_relaxed);
+      while (current < value &&
+             !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+      }
+    }
+#ifdef TRACK_SP_LABELS
+    // Label of the region as a child of the encountering task; the implicit
+    // tasks extend it with a fork step
+    SPLabel label;
+#endif
 
   public:
     ParallelRegion(uint64_t region_id, 
@@ -19,7 +62,17 @@ class ParallelRegion
       id(region_id),
       parent_id(parent_id),
       n_threads(n_threads),
-      codeptr_ra(codeptr_ra)
+      codeptr_ra(codeptr_ra),
+      children(n_threads, child_slot_t()),
+      child_index(0),
+      nesting_level(1),
+      depth(1),
+      team_size(0),
+      begin_time(0),
+      end_time(0),
+      last_implicit_begin(0),
+      last_barrier_arrival(0),
+      last_implicit_end(0)
       {}
 
     uint64_t get_id() {
@@ -34,13 +87,142 @@ class ParallelRegion
       return codeptr_ra; 
     }   
 
-    void add_child(Task* child) {
+    // Regions live in the arena of the thread that encounters them
+    static void * operator new(size_t size) {
+      return arena_allocate(size);
+    }
+
+    static void operator delete(void * block, size_t size) {
+      arena_free(block, size);
+    }
+
+    // Bytes of memory owned by this region object, including its label
+    size_t get_memory_usage() {
+      size_t bytes = sizeof(ParallelRegion) +
+                     children.capacity() * sizeof(child_slot_t) +
+                     overflow_children.capacity() * sizeof(Task *);
+#ifdef TRACK_SP_LABELS
+      bytes += label.get_memory_usage();
+#endif
+      return bytes;
+    }
+
+    uint32_t get_child_index() {
+      return child_index;
+    }
+
+    void set_child_index(uint32_t index) {
+      this->child_index = index;
+    }
+
+    uint32_t get_requested_team_size() {
+      return n_threads;
+    }
+
+    uint32_t get_team_size() {
+      return team_size.load(std::memory_order_relaxed);
+    }
+
+    uint32_t get_nesting_level() {
+      return nesting_level;
+    }
+
+    void set_nesting_level(uint32_t level) {
+      this->nesting_level = level;
+    }
+
+    uint32_t get_depth() {
+      return depth;
+    }
+
+    void set_depth(uint32_t depth) {
+      this->depth = depth;
+    }
+
+    uint64_t get_begin_time() {
+      return begin_time;
+    }
+
+    void set_begin_time(uint64_t time) {
+      this->begin_time = time;
+    }
+
+    void set_end_time(uint64_t time) {
+      this->end_time = time;
+    }
+
+    uint64_t get_duration() {
+      return end_time > begin_time ? end_time - begin_time : 0;
+    }
+
+    // Time from the region's start until the last implicit task began
+    uint64_t get_fork_overhead() {
+      uint64_t last_begin = last_implicit_begin.load(std::memory_order_relaxed);
+      return last_begin > begin_time ? last_begin - begin_time : 0;
+    }
+
+    // Time from the last arrival at the region's final barrier (or the last
+    // implicit task end, if barriers were not reported) until the region ended
+    uint64_t get_join_overhead() {
+      uint64_t last_arrival = last_barrier_arrival.load(std::memory_order_relaxed);
+      if (last_arrival == 0) {
+        last_arrival = last_implicit_end.load(std::memory_order_relaxed);
+      }
+      return end_time > last_arrival && last_arrival != 0 ? end_time - last_arrival : 0;
+    }
+
+    void note_implicit_begin(uint64_t time, uint32_t actual_team_size) {
+      team_size.store(actual_team_size, std::memory_order_relaxed);
+      atomic_max(last_implicit_begin, time);
+    }
+
+    void note_barrier_arrival(uint64_t time) {
+      atomic_max(last_barrier_arrival, time);
+    }
+
+    void note_implicit_end(uint64_t time) {
+      atomic_max(last_implicit_end, time);
+    }
+
+#ifdef TRACK_SP_LABELS
+    const SPLabel & get_label() {
+      return label;
+    }
+
+    void set_label(SPLabel && new_label) {
+      this->label = std::move(new_label);
+    }
+#endif
+
+    /* Register the implicit task of thread thread_num. Each thread writes
+     * only its own slot, on its own cache line.
+     */
+    void add_child(Task* child, uint32_t thread_num) {
+      if (thread_num < this->children.size()) {
+        this->children[thread_num].task = child;
+        return;
+      }
       boost::lock_guard<boost::mutex> lock(this->mtx);
-      this->children.push_back(child);
+      this->overflow_children.push_back(child);
+    }
+
+    /* Call f on every registered implicit task, in thread_num order. Only
+     * safe once the implicit tasks have all begun, e.g. after the region.
+     */
+    template <typename F>
+    void for_each_child(F f) {
+      for (const child_slot_t & slot : this->children) {
+        if (slot.task != NULL) {
+          f(slot.task);
+        }
+      }
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      for (Task * child : this->overflow_children) {
+        f(child);
+      }
     }
 
     void print(int verbosity = 0) {
-      boost::lock_guard<boost::mutex> lock(this->mtx); 
       if (verbosity == 0) {
         std::cout << "Parallel Region: " << id << std::endl;
       } 
@@ -49,11 +231,14 @@ class ParallelRegion
         std::cout << "\t- ID: " << id << std::endl;
         std::cout << "\t- Parent ID: " << parent_id << std::endl;
         std::cout << "\t- Number of threads: " << n_threads << std::endl; 
+        std::cout << "\t- Actual team size: " << get_team_size() << std::endl; 
+        std::cout << "\t- Nesting level: " << nesting_level << std::endl; 
+        std::cout << "\t- Duration (ns): " << get_duration() << std::endl; 
+        std::cout << "\t- Fork overhead (ns): " << get_fork_overhead() << std::endl; 
+        std::cout << "\t- Join overhead (ns): " << get_join_overhead() << std::endl; 
         if (verbosity > 1) {
           std::cout << "Child Tasks: " << std::endl; 
-          for (auto e : this->children) {
-            e->print(1); 
-          }
+          for_each_child([](Task * e) { e->print(1); });
         }
       }
     }
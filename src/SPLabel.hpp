@@ -0,0 +1,295 @@
+#ifndef SP_LABEL_H
+#define SP_LABEL_H
+
+#include <inttypes.h>
+#include <string.h>
+
+/******************************************************************************\
+ * Online series-parallel labels for tasks, in the spirit of offset-span
+ * labeling (Mellor-Crummey, SC'91), extended for OpenMP tasks.
+ *
+ * A label is the path from the initial task down to a task. Each step on the
+ * path is either
+ *   - a spawn: a task creating its k-th child (an explicit task or a parallel
+ *     region), recorded as (k, span = 0), or
+ *   - a fork: a parallel region starting implicit task i of a team of n,
+ *     recorded as (i, span = n).
+ * Every step also records the state of the node it leaves at the moment the
+ * step was taken (how many of its children had been waited for or deeply
+ * joined, and for implicit tasks how many barriers it had passed). Labels are
+ * built once, when the task is created, by copying the creator's label, and
+ * are never modified afterwards.
+ *
+ * The mutable part of a task's position is its sp_state_t, which only the
+ * thread executing the task writes, under the task's lock. A strand is a
+ * snapshot of a task's label and state, taken under the same lock, and
+ * comparing two strands answers whether one logically precedes the other or
+ * whether they may run concurrently. Queries only read the two strands: no
+ * locks, maps or other tasks are touched, and the cost is bounded by the
+ * nesting depth rather than by the number of tasks.
+\******************************************************************************/
+
+typedef struct sp_pair {
+  // Child index for spawns, thread number for forks
+  uint32_t index;
+  // Team size for forks, 0 for spawns
+  uint32_t span;
+  // State of the node this step leaves, at the time of the step
+  uint32_t phase;
+  uint32_t waited;
+  uint32_t joined;
+} sp_pair_t;
+
+typedef struct sp_state {
+  // Number of barriers the (implicit) task has completed
+  uint32_t phase;
+  // Number of children (explicit tasks and parallel regions) created so far
+  uint32_t spawned;
+  // Children with an index below this have completed (taskwait)
+  uint32_t waited;
+  // Children with an index below this have completed along with all of their
+  // descendants (taskgroup, end of a nested parallel region, barrier)
+  uint32_t joined;
+} sp_state_t;
+
+enum class SPRelation {Same, Precedes, Follows, Concurrent};
+
+
+class SPLabel
+{
+  private:
+    sp_pair_t * pairs;
+    uint32_t length;
+
+  public:
+    SPLabel() : pairs(NULL), length(0) {}
+
+    // Label of the initial task
+    static SPLabel initial() {
+      SPLabel label;
+      label.pairs = new sp_pair_t[1];
+      memset(label.pairs, 0, sizeof(sp_pair_t));
+      label.length = 1;
+      return label;
+    }
+
+    // Label of a node reached from parent (currently in parent_state) by the
+    // step (index, span)
+    SPLabel(const SPLabel & parent, const sp_state_t & parent_state,
+            uint32_t index, uint32_t span) : length(parent.length + 1) {
+      pairs = new sp_pair_t[length];
+      if (parent.length > 0) {
+        memcpy(pairs, parent.pairs, parent.length * sizeof(sp_pair_t));
+        sp_pair_t & last = pairs[parent.length - 1];
+        last.phase = parent_state.phase;
+        last.waited = parent_state.waited;
+        last.joined = parent_state.joined;
+      }
+      sp_pair_t & step = pairs[length - 1];
+      step.index = index;
+      step.span = span;
+      step.phase = 0;
+      step.waited = 0;
+      step.joined = 0;
+    }
+
+    SPLabel(SPLabel && other) : pairs(other.pairs), length(other.length) {
+      other.pairs = NULL;
+      other.length = 0;
+    }
+
+    SPLabel & operator=(SPLabel && other) {
+      if (this != &other) {
+        delete[] pairs;
+        pairs = other.pairs;
+        length = other.length;
+        other.pairs = NULL;
+        other.length = 0;
+      }
+      return *this;
+    }
+
+    SPLabel(const SPLabel &) = delete;
+    SPLabel & operator=(const SPLabel &) = delete;
+
+    ~SPLabel() {
+      delete[] pairs;
+    }
+
+    uint32_t get_length() const {
+      return length;
+    }
+
+    // Label restored from its pairs, e.g. when reading a spilled task back
+    static SPLabel from_pairs(const sp_pair_t * pairs, uint32_t length) {
+      SPLabel label;
+      if (length > 0) {
+        label.pairs = new sp_pair_t[length];
+        memcpy(label.pairs, pairs, length * sizeof(sp_pair_t));
+        label.length = length;
+      }
+      return label;
+    }
+
+    const sp_pair_t * get_pairs() const {
+      return pairs;
+    }
+
+    // Bytes of heap memory owned by the label
+    size_t get_memory_usage() const {
+      return length * sizeof(sp_pair_t);
+    }
+
+    const sp_pair_t & operator[](uint32_t i) const {
+      return pairs[i];
+    }
+
+    // Index of this node among its creator's children (spawns) or its thread
+    // number within the team (forks)
+    uint32_t get_index() const {
+      return pairs[length - 1].index;
+    }
+
+    // Both labels describe the same step if index and span agree; the
+    // recorded states may differ since they depend on when the path was taken
+    static bool same_step(const sp_pair_t & a, const sp_pair_t & b) {
+      return a.index == b.index && a.span == b.span;
+    }
+};
+
+
+/* A snapshot of a position in a task's execution */
+typedef struct sp_strand {
+  const SPLabel * label;
+  sp_state_t state;
+} sp_strand_t;
+
+
+/* True if the task labeled a is an ancestor of (or the same as) the task
+ * labeled b
+ */
+static inline bool sp_is_ancestor(const SPLabel & a, const SPLabel & b)
+{
+  const uint32_t m = a.get_length();
+  if (m == 0 || m > b.get_length()) {
+    return false;
+  }
+  // Compare from the bottom up since the paths of related tasks share their
+  // upper levels
+  for (uint32_t t = m; t-- > 0; ) {
+    if (!SPLabel::same_step(a[t], b[t])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static inline SPRelation sp_invert(SPRelation r)
+{
+  if (r == SPRelation::Precedes) {
+    return SPRelation::Follows;
+  } else if (r == SPRelation::Follows) {
+    return SPRelation::Precedes;
+  }
+  return r;
+}
+
+
+static inline int sp_compare_states(const sp_state_t & a, const sp_state_t & b)
+{
+  if (a.phase != b.phase) {
+    return a.phase < b.phase ? -1 : 1;
+  }
+  if (a.spawned != b.spawned) {
+    return a.spawned < b.spawned ? -1 : 1;
+  }
+  if (a.waited != b.waited) {
+    return a.waited < b.waited ? -1 : 1;
+  }
+  if (a.joined != b.joined) {
+    return a.joined < b.joined ? -1 : 1;
+  }
+  return 0;
+}
+
+
+/* Relation of strand a to strand b: whether a logically precedes b, follows
+ * it, or may execute concurrently with it
+ */
+static inline SPRelation sp_relation(const sp_strand_t & a, const sp_strand_t & b)
+{
+  const SPLabel & la = *a.label;
+  const SPLabel & lb = *b.label;
+  const uint32_t m = la.get_length();
+  const uint32_t n = lb.get_length();
+  const uint32_t common = m < n ? m : n;
+
+  // Find the first step where the two paths diverge
+  uint32_t t = 0;
+  while (t < common && SPLabel::same_step(la[t], lb[t])) {
+    t++;
+  }
+
+  if (t == common) {
+    if (m == n) {
+      // Two positions within the same task are always in series
+      int c = sp_compare_states(a.state, b.state);
+      if (c == 0) {
+        return SPRelation::Same;
+      }
+      return c < 0 ? SPRelation::Precedes : SPRelation::Follows;
+    }
+    if (m > n) {
+      return sp_invert(sp_relation(b, a));
+    }
+    // a's task is an ancestor of b's task; lb[m] is the child a created on
+    // the way to b
+    const uint32_t k = lb[m].index;
+    if (a.state.spawned <= k) {
+      return SPRelation::Precedes;
+    }
+    if ((n == m + 1 && k < a.state.waited) || k < a.state.joined) {
+      return SPRelation::Follows;
+    }
+    return SPRelation::Concurrent;
+  }
+
+  if (t == 0) {
+    // Different initial tasks
+    return SPRelation::Concurrent;
+  }
+
+  const sp_pair_t & step_a = la[t];
+  const sp_pair_t & step_b = lb[t];
+  if (step_a.span == 0 && step_b.span == 0) {
+    // Siblings spawned by the same task: the earlier one precedes the later
+    // one only if it had been waited for before the later one was created
+    if (step_a.index > step_b.index) {
+      return sp_invert(sp_relation(b, a));
+    }
+    const sp_pair_t & creator = lb[t - 1];
+    if ((m == t + 1 && step_a.index < creator.waited) ||
+        step_a.index < creator.joined) {
+      return SPRelation::Precedes;
+    }
+    return SPRelation::Concurrent;
+  }
+
+  // Implicit tasks of the same team are ordered by the barriers between them
+  const uint32_t phase_a = m == t + 1 ? a.state.phase : step_a.phase;
+  const uint32_t phase_b = n == t + 1 ? b.state.phase : step_b.phase;
+  if (phase_a < phase_b) {
+    return SPRelation::Precedes;
+  } else if (phase_a > phase_b) {
+    return SPRelation::Follows;
+  }
+  return SPRelation::Concurrent;
+}
+
+static inline bool sp_concurrent(const sp_strand_t & a, const sp_strand_t & b)
+{
+  return sp_relation(a, b) == SPRelation::Concurrent;
+}
+
+#endif // SP_LABEL_H
@@ -0,0 +1,573 @@
+#ifndef SUBTREE_HASH_H
+#define SUBTREE_HASH_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/******************************************************************************\
+ * Structural hashes of task trees, for comparing two runs.
+ *
+ * Every vertex gets a site hash over its type and its call site, and every
+ * subtree a Merkle-style hash over its root's site hash and its children's
+ * subtree hashes. Call sites are taken as (module, offset in module) via
+ * dladdr, so they do not change with the load address of the program.
+ * Children are combined in order of their hashes rather than creation order:
+ * which implicit task ends up creating a task, or the order in which threads
+ * create their children, varies from run to run without the structure
+ * changing.
+ *
+ * The hashes are written to a file together with the children of every
+ * vertex, sorted by hash. Comparing two such files walks both trees from the
+ * roots, skips every pair of subtrees with equal hashes, and only descends
+ * where they differ, so the cost is proportional to the differences.
+\******************************************************************************/
+
+#define SUBTREE_HASH_MAGIC "OMPTHSH1"
+#define SUBTREE_HASH_VERSION 1
+#define SUBTREE_HASH_NONE UINT32_MAX
+
+static inline uint64_t subtree_hash_mix(uint64_t x) {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline uint64_t subtree_hash_combine(uint64_t seed, uint64_t value) {
+  return subtree_hash_mix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+static inline uint64_t subtree_hash_string(const char * s) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s; s++) {
+    h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+
+/* A code address as the module containing it and the offset into it */
+typedef struct call_site {
+  std::string module;
+  uint64_t offset;
+} call_site_t;
+
+static inline call_site_t resolve_call_site(const void * codeptr_ra)
+{
+  call_site_t site;
+  site.offset = (uint64_t) codeptr_ra;
+  Dl_info info;
+  if (codeptr_ra != NULL && dladdr(codeptr_ra, &info) != 0 && info.dli_fname != NULL) {
+    const char * name = strrchr(info.dli_fname, '/');
+    site.module = name ? name + 1 : info.dli_fname;
+    site.offset = (uint64_t) codeptr_ra - (uint64_t) info.dli_fbase;
+  }
+  return site;
+}
+
+/* Interns the modules of call sites and caches the resolution of each code
+ * address, since dladdr is far too slow to call once per vertex
+ */
+class CallSiteTable
+{
+  private:
+    std::mutex mtx;
+    std::unordered_map<const void *, std::pair<uint32_t, uint64_t> > resolved;
+    std::unordered_map<std::string, uint32_t> module_index;
+    std::vector<std::string> modules;
+
+  public:
+    // Module index and offset of a code address
+    std::pair<uint32_t, uint64_t> lookup(const void * codeptr_ra) {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto search = resolved.find(codeptr_ra);
+      if (search != resolved.end()) {
+        return search->second;
+      }
+      call_site_t site = resolve_call_site(codeptr_ra);
+      auto insert_result = module_index.insert( {site.module, modules.size()} );
+      if (insert_result.second) {
+        modules.push_back(site.module);
+      }
+      std::pair<uint32_t, uint64_t> entry(insert_result.first->second, site.offset);
+      resolved.insert( {codeptr_ra, entry} );
+      return entry;
+    }
+
+    const std::vector<std::string> & get_modules() const {
+      return modules;
+    }
+};
+
+static inline uint64_t site_hash(uint32_t type, const std::string & module, uint64_t offset)
+{
+  uint64_t h = subtree_hash_mix(type + 1);
+  h = subtree_hash_combine(h, subtree_hash_string(module.c_str()));
+  return subtree_hash_combine(h, offset);
+}
+
+
+typedef struct subtree_hash_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_modules;
+  uint64_t n_vertices;
+  uint64_t n_roots;
+  uint64_t n_children;
+  uint64_t strings_size;
+  // Byte offsets of each section from the start of the file
+  uint64_t vertices_offset;
+  uint64_t roots_offset;
+  uint64_t children_offset;
+  uint64_t modules_offset;
+  uint64_t strings_offset;
+  uint64_t file_size;
+} subtree_hash_header_t;
+
+typedef struct subtree_hash_vertex {
+  uint64_t id;
+  uint64_t site_hash;
+  uint64_t subtree_hash;
+  uint64_t offset;
+  uint64_t subtree_size;
+  uint32_t type;
+  uint32_t module;
+  // Children are children[first_child, first_child + n_children), by hash
+  uint64_t first_child;
+  uint64_t n_children;
+} subtree_hash_vertex_t;
+
+static inline uint64_t subtree_hash_align(uint64_t offset) {
+  return (offset + 7) & ~((uint64_t)7);
+}
+
+
+/* Compute the subtree hashes of a forest given as one subtree_hash_vertex_t
+ * per vertex (id, site_hash, offset, type and module filled in) and a parent
+ * index per vertex (SUBTREE_HASH_NONE for roots). Fills in subtree_hash,
+ * subtree_size and the children ranges, and returns the children array
+ * and the roots, both sorted by subtree hash.
+ */
+static inline void compute_subtree_hashes(std::vector<subtree_hash_vertex_t> & vertices,
+                                          const std::vector<uint32_t> & parents,
+                                          std::vector<uint32_t> & children,
+                                          std::vector<uint32_t> & roots)
+{
+  const uint32_t n = vertices.size();
+  std::vector<uint64_t> child_begin(n + 1, 0);
+  roots.clear();
+  for (uint32_t v = 0; v < n; v++) {
+    if (parents[v] == SUBTREE_HASH_NONE) {
+      roots.push_back(v);
+    } else {
+      child_begin[parents[v] + 1]++;
+    }
+  }
+  for (uint32_t v = 0; v < n; v++) {
+    child_begin[v + 1] += child_begin[v];
+  }
+  children.assign(child_begin[n], 0);
+  std::vector<uint64_t> fill(child_begin.begin(), child_begin.end() - 1);
+  for (uint32_t v = 0; v < n; v++) {
+    if (parents[v] != SUBTREE_HASH_NONE) {
+      children[fill[parents[v]]++] = v;
+    }
+  }
+  for (uint32_t v = 0; v < n; v++) {
+    vertices[v].first_child = child_begin[v];
+    vertices[v].n_children = child_begin[v + 1] - child_begin[v];
+  }
+
+  // Post-order without recursion, since task trees can be very deep
+  auto by_hash = [&](uint32_t a, uint32_t b) {
+    return vertices[a].subtree_hash < vertices[b].subtree_hash;
+  };
+  std::vector<std::pair<uint32_t, bool> > stack;
+  for (uint32_t root : roots) {
+    stack.push_back( {root, false} );
+    while (!stack.empty()) {
+      std::pair<uint32_t, bool> top = stack.back();
+      stack.pop_back();
+      subtree_hash_vertex_t & vertex = vertices[top.first];
+      if (!top.second) {
+        stack.push_back( {top.first, true} );
+        for (uint64_t c = vertex.first_child; c < vertex.first_child + vertex.n_children; c++) {
+          stack.push_back( {children[c], false} );
+        }
+        continue;
+      }
+      uint32_t * first = children.data() + vertex.first_child;
+      std::sort(first, first + vertex.n_children, by_hash);
+      uint64_t h = subtree_hash_combine(vertex.site_hash, vertex.n_children);
+      uint64_t size = 1;
+      for (uint64_t c = 0; c < vertex.n_children; c++) {
+        h = subtree_hash_combine(h, vertices[first[c]].subtree_hash);
+        size += vertices[first[c]].subtree_size;
+      }
+      vertex.subtree_hash = h;
+      vertex.subtree_size = size;
+    }
+  }
+  std::sort(roots.begin(), roots.end(), by_hash);
+}
+
+
+/* Hash of a whole forest, from its roots sorted by subtree hash */
+static inline uint64_t forest_hash(const subtree_hash_vertex_t * vertices,
+                                   const uint32_t * roots, uint64_t n_roots)
+{
+  uint64_t h = subtree_hash_mix(n_roots);
+  for (uint64_t r = 0; r < n_roots; r++) {
+    h = subtree_hash_combine(h, vertices[roots[r]].subtree_hash);
+  }
+  return h;
+}
+
+
+/* Write hashed vertices, as filled in by compute_subtree_hashes, to path.
+ * Returns false if the file could not be written.
+ */
+static inline bool write_subtree_hash_file(const std::string & path,
+                                           const std::vector<subtree_hash_vertex_t> & vertices,
+                                           const std::vector<uint32_t> & children,
+                                           const std::vector<uint32_t> & roots,
+                                           const std::vector<std::string> & modules)
+{
+  std::vector<uint64_t> module_offsets;
+  std::string strings;
+  for (const std::string & module : modules) {
+    module_offsets.push_back(strings.size());
+    strings += module;
+    strings.push_back('\0');
+  }
+
+  subtree_hash_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SUBTREE_HASH_MAGIC, sizeof(header.magic));
+  header.version = SUBTREE_HASH_VERSION;
+  header.n_modules = modules.size();
+  header.n_vertices = vertices.size();
+  header.n_roots = roots.size();
+  header.n_children = children.size();
+  header.strings_size = strings.size();
+  uint64_t offset = subtree_hash_align(sizeof(header));
+  header.vertices_offset = offset;
+  offset = subtree_hash_align(offset + vertices.size() * sizeof(subtree_hash_vertex_t));
+  header.roots_offset = offset;
+  offset = subtree_hash_align(offset + roots.size() * sizeof(uint32_t));
+  header.children_offset = offset;
+  offset = subtree_hash_align(offset + children.size() * sizeof(uint32_t));
+  header.modules_offset = offset;
+  offset = subtree_hash_align(offset + module_offsets.size() * sizeof(uint64_t));
+  header.strings_offset = offset;
+  offset = subtree_hash_align(offset + strings.size());
+  header.file_size = offset;
+
+  FILE * f = fopen(path.c_str(), "wb");
+  if (f == NULL) {
+    printf("Could not open subtree hash file %s\n", path.c_str());
+    return false;
+  }
+  std::vector<char> file(header.file_size, 0);
+  memcpy(file.data(), &header, sizeof(header));
+  memcpy(file.data() + header.vertices_offset, vertices.data(),
+         vertices.size() * sizeof(subtree_hash_vertex_t));
+  memcpy(file.data() + header.roots_offset, roots.data(), roots.size() * sizeof(uint32_t));
+  memcpy(file.data() + header.children_offset, children.data(), children.size() * sizeof(uint32_t));
+  memcpy(file.data() + header.modules_offset, module_offsets.data(),
+         module_offsets.size() * sizeof(uint64_t));
+  memcpy(file.data() + header.strings_offset, strings.data(), strings.size());
+  bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+  fclose(f);
+  if (!ok) {
+    printf("Could not write subtree hash file %s\n", path.c_str());
+  }
+  return ok;
+}
+
+
+/* Read-only, memory-mapped view of a subtree hash file */
+class SubtreeHashFile
+{
+  private:
+    void * map;
+    uint64_t map_size;
+    const subtree_hash_header_t * header;
+    const subtree_hash_vertex_t * vertices;
+    const uint32_t * roots;
+    const uint32_t * children;
+    const uint64_t * module_offsets;
+    const char * strings;
+
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t entry_size) const {
+      return offset % 8 == 0 && offset <= map_size &&
+             count <= (map_size - offset) / entry_size;
+    }
+
+    // Whether every section lies inside the mapping and the roots and
+    // children ranges describe a forest: each vertex is a root or the child
+    // of exactly one vertex, so walking down from the roots terminates
+    bool header_is_valid() const {
+      const uint64_t n = header->n_vertices;
+      if (n >= SUBTREE_HASH_NONE || header->n_roots + header->n_children != n ||
+          !section_fits(header->vertices_offset, n, sizeof(subtree_hash_vertex_t)) ||
+          !section_fits(header->roots_offset, header->n_roots, sizeof(uint32_t)) ||
+          !section_fits(header->children_offset, header->n_children, sizeof(uint32_t)) ||
+          !section_fits(header->modules_offset, header->n_modules, sizeof(uint64_t)) ||
+          header->strings_offset > map_size ||
+          header->strings_size > map_size - header->strings_offset) {
+        return false;
+      }
+      const char * base = (const char *) map;
+      const subtree_hash_vertex_t * v = (const subtree_hash_vertex_t *)(base + header->vertices_offset);
+      const uint32_t * r = (const uint32_t *)(base + header->roots_offset);
+      const uint32_t * c = (const uint32_t *)(base + header->children_offset);
+      const uint64_t * m = (const uint64_t *)(base + header->modules_offset);
+      const char * s = base + header->strings_offset;
+      if (header->n_modules > 0 &&
+          (header->strings_size == 0 || s[header->strings_size - 1] != '\0')) {
+        return false;
+      }
+      for (uint64_t i = 0; i < header->n_modules; i++) {
+        if (m[i] >= header->strings_size) {
+          return false;
+        }
+      }
+      std::vector<bool> seen(n, false);
+      auto claim = [&](uint32_t u) {
+        if (u >= n || seen[u]) {
+          return false;
+        }
+        seen[u] = true;
+        return true;
+      };
+      for (uint64_t i = 0; i < header->n_roots; i++) {
+        if (!claim(r[i])) {
+          return false;
+        }
+      }
+      // Children ranges follow each other in vertex order
+      uint64_t next_child = 0;
+      for (uint64_t u = 0; u < n; u++) {
+        if (v[u].first_child != next_child ||
+            v[u].n_children > header->n_children - next_child) {
+          return false;
+        }
+        next_child += v[u].n_children;
+      }
+      if (next_child != header->n_children) {
+        return false;
+      }
+      for (uint64_t i = 0; i < header->n_children; i++) {
+        if (!claim(c[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  public:
+    SubtreeHashFile() : map(NULL), map_size(0), header(NULL) {}
+
+    explicit SubtreeHashFile(const std::string & path) : map(NULL), map_size(0), header(NULL) {
+      open(path);
+    }
+
+    ~SubtreeHashFile() {
+      close();
+    }
+
+    SubtreeHashFile(const SubtreeHashFile &) = delete;
+    SubtreeHashFile & operator=(const SubtreeHashFile &) = delete;
+
+    bool open(const std::string & path) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(subtree_hash_header_t)) {
+        ::close(fd);
+        return false;
+      }
+      map_size = st.st_size;
+      map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        map = NULL;
+        return false;
+      }
+      header = (const subtree_hash_header_t *) map;
+      if (memcmp(header->magic, SUBTREE_HASH_MAGIC, sizeof(header->magic)) != 0 ||
+          header->version != SUBTREE_HASH_VERSION ||
+          header->file_size > map_size || !header_is_valid()) {
+        close();
+        return false;
+      }
+      const char * base = (const char *) map;
+      vertices = (const subtree_hash_vertex_t *)(base + header->vertices_offset);
+      roots = (const uint32_t *)(base + header->roots_offset);
+      children = (const uint32_t *)(base + header->children_offset);
+      module_offsets = (const uint64_t *)(base + header->modules_offset);
+      strings = base + header->strings_offset;
+      return true;
+    }
+
+    void close() {
+      if (map != NULL) {
+        munmap(map, map_size);
+      }
+      map = NULL;
+      map_size = 0;
+      header = NULL;
+    }
+
+    bool is_open() const {
+      return header != NULL;
+    }
+
+    uint64_t size() const {
+      return header->n_vertices;
+    }
+
+    uint64_t get_num_roots() const {
+      return header->n_roots;
+    }
+
+    // Roots sorted by subtree hash
+    const uint32_t * get_roots() const {
+      return roots;
+    }
+
+    const subtree_hash_vertex_t & operator[](uint32_t v) const {
+      return vertices[v];
+    }
+
+    // Children of v sorted by subtree hash
+    const uint32_t * get_children(uint32_t v) const {
+      return children + vertices[v].first_child;
+    }
+
+    const char * get_module(uint32_t v) const {
+      uint32_t module = vertices[v].module;
+      return module < header->n_modules ? strings + module_offsets[module] : "";
+    }
+
+    // Hash of the whole forest
+    uint64_t get_forest_hash() const {
+      return forest_hash(vertices, roots, header->n_roots);
+    }
+};
+
+
+enum class SubtreeDiff {Changed, OnlyInA, OnlyInB};
+
+/* Compare two hashed trees top-down. Subtrees with equal hashes are skipped.
+ * Under a pair of vertices that differ, children are matched by hash first;
+ * the remaining ones are paired by site hash (type and call site), and each
+ * pair is compared in turn. report(kind, a, b, depth) is called for every
+ * divergence found: a pair of vertices whose own type or call site differ
+ * (Changed), or a child with no counterpart in the other tree (OnlyInA,
+ * OnlyInB, with the missing side SUBTREE_HASH_NONE). Children left over on
+ * both sides after pairing are reported as Changed in hash order. Stops after
+ * max_reports
+ * (0 for no limit) and returns the number of divergences reported.
+ */
+template <typename F>
+static inline uint64_t compare_subtree_hashes(const SubtreeHashFile & a, const SubtreeHashFile & b,
+                                              uint64_t max_reports, F report)
+{
+  struct frame {
+    const uint32_t * a_children;
+    uint64_t a_count;
+    const uint32_t * b_children;
+    uint64_t b_count;
+    uint32_t depth;
+  };
+  std::vector<frame> stack;
+  stack.push_back( {a.get_roots(), a.get_num_roots(), b.get_roots(), b.get_num_roots(), 0} );
+  uint64_t reports = 0;
+  std::vector<uint32_t> a_left, b_left, a_unpaired, b_unpaired;
+  std::vector<std::pair<uint32_t, uint32_t> > pairs;
+  while (!stack.empty() && (max_reports == 0 || reports < max_reports)) {
+    frame f = stack.back();
+    stack.pop_back();
+
+    // Both lists are sorted by hash, so equal subtrees pair up in a merge
+    a_left.clear();
+    b_left.clear();
+    uint64_t i = 0, j = 0;
+    while (i < f.a_count || j < f.b_count) {
+      if (j == f.b_count ||
+          (i < f.a_count && a[f.a_children[i]].subtree_hash < b[f.b_children[j]].subtree_hash)) {
+        a_left.push_back(f.a_children[i++]);
+      } else if (i == f.a_count ||
+                 b[f.b_children[j]].subtree_hash < a[f.a_children[i]].subtree_hash) {
+        b_left.push_back(f.b_children[j++]);
+      } else {
+        i++;
+        j++;
+      }
+    }
+
+    // Pair what is left by site hash, again with a merge
+    std::stable_sort(a_left.begin(), a_left.end(), [&](uint32_t x, uint32_t y) {
+      return a[x].site_hash < a[y].site_hash;
+    });
+    std::stable_sort(b_left.begin(), b_left.end(), [&](uint32_t x, uint32_t y) {
+      return b[x].site_hash < b[y].site_hash;
+    });
+    pairs.clear();
+    a_unpaired.clear();
+    b_unpaired.clear();
+    i = 0;
+    j = 0;
+    while (i < a_left.size() || j < b_left.size()) {
+      if (j == b_left.size() ||
+          (i < a_left.size() && a[a_left[i]].site_hash < b[b_left[j]].site_hash)) {
+        a_unpaired.push_back(a_left[i++]);
+      } else if (i == a_left.size() || b[b_left[j]].site_hash < a[a_left[i]].site_hash) {
+        b_unpaired.push_back(b_left[j++]);
+      } else {
+        pairs.push_back( {a_left[i++], b_left[j++]} );
+      }
+    }
+    for (uint64_t k = 0; k < a_unpaired.size() || k < b_unpaired.size(); k++) {
+      if (max_reports != 0 && reports >= max_reports) {
+        break;
+      }
+      if (k >= b_unpaired.size()) {
+        report(SubtreeDiff::OnlyInA, a_unpaired[k], SUBTREE_HASH_NONE, f.depth);
+      } else if (k >= a_unpaired.size()) {
+        report(SubtreeDiff::OnlyInB, SUBTREE_HASH_NONE, b_unpaired[k], f.depth);
+      } else {
+        report(SubtreeDiff::Changed, a_unpaired[k], b_unpaired[k], f.depth);
+      }
+      reports++;
+    }
+    // Push in reverse so pairs are visited in hash order
+    for (auto p = pairs.rbegin(); p != pairs.rend(); ++p) {
+      stack.push_back( {a.get_children(p->first), a[p->first].n_children,
+                        b.get_children(p->second), b[p->second].n_children, f.depth + 1} );
+    }
+  }
+  return reports;
+}
+
+#endif // SUBTREE_HASH_H
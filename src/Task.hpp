@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include "boost/thread/mutex.hpp"
 #include "boost/thread/locks.hpp"
+#include "SPLabel.hpp"
+#include "NumaArena.hpp"
+#include "DependenceTable.hpp"
 
 
 #define CHECK_INSERTIONS
@@ -26,6 +29,28 @@ enum class TSP {task_create,
                 omp_target_memcpy,
                 omp_target_memcpy_rect}; 
 
+/* The fields of a completed task that outlive it, as written to the spill
+ * file. Its label's pairs follow the record.
+ */
+typedef struct spilled_task {
+  uint64_t id;
+  uint64_t parent_id;
+  uint64_t codeptr_ra;
+  uint64_t region_id;
+  uint64_t exec_time;
+  TaskType type;
+  TaskState state;
+  uint32_t initial;
+  uint32_t creating_thread;
+  uint32_t executing_thread;
+  uint32_t thread_num;
+  uint32_t child_index;
+  uint32_t label_length;
+  uint32_t depth;
+  uint32_t dependences;
+  sp_state_t sp_state;
+} spilled_task_t;
+
 class Task
 {
   private:
@@ -42,8 +67,35 @@ class Task
     std::vector<Task *> dependency_children;
     // A list of tasks that this task depends on 
     std::vector<Task *> dependency_parents;
+    // Whether the task was created with a depend clause
+    bool dependences;
+    // Dependence addresses of this task's children, while it can create them
+    DependenceTable * dependence_table;
     // A series of task scheduling points experienced by this task
     std::vector<int> tsps;
+    // Parallel region the task is bound to (0 outside of any region)
+    uint64_t region_id;
+    // Tool thread numbers of the thread that created the task and of the
+    // thread that first executed it
+    uint32_t creating_thread;
+    uint32_t executing_thread;
+    // Thread number within the team, for implicit tasks
+    uint32_t thread_num;
+    // Time spent executing this task, excluding tasks it was suspended for
+    uint64_t exec_time;
+    // Index of this task among the children of the task that created it
+    uint32_t child_index;
+    // Distance from the initial task, counting parallel regions
+    uint32_t depth;
+    // Tracing window (TracingControl.hpp) the task was created in
+    uint32_t trace_window;
+    // Children created, waited for and joined so far, plus barriers passed.
+    // Written only by the thread executing this task.
+    sp_state_t sp_state;
+#ifdef TRACK_SP_LABELS
+    // Series-parallel label, fixed at creation
+    SPLabel label;
+#endif
 
   public:
     Task(uint64_t task_id, uint64_t parent_id, TaskType task_type, const void* codeptr_ra) : 
@@ -52,9 +104,56 @@ class Task
       type(task_type), 
       state(TaskState::Created), 
       initial(false),
-      codeptr_ra(codeptr_ra)
+      codeptr_ra(codeptr_ra),
+      dependences(false),
+      dependence_table(NULL),
+      region_id(0),
+      creating_thread(0),
+      executing_thread(UINT32_MAX),
+      thread_num(0),
+      exec_time(0),
+      child_index(0),
+      depth(0),
+      trace_window(0)
+      {
+        memset(&sp_state, 0, sizeof(sp_state));
+      }
+
+    // Restore a task from its spill record
+    Task(const spilled_task_t & record) :
+      id(record.id),
+      parent_id(record.parent_id),
+      type(record.type),
+      state(record.state),
+      initial(record.initial != 0),
+      codeptr_ra((const void *) record.codeptr_ra),
+      dependences(record.dependences != 0),
+      dependence_table(NULL),
+      region_id(record.region_id),
+      creating_thread(record.creating_thread),
+      executing_thread(record.executing_thread),
+      thread_num(record.thread_num),
+      exec_time(record.exec_time),
+      child_index(record.child_index),
+      depth(record.depth),
+      trace_window(0),
+      sp_state(record.sp_state)
       {}
 
+    // Tasks live in the arena of the thread that creates them, on its NUMA
+    // node
+    static void * operator new(size_t size) {
+      return arena_allocate(size);
+    }
+
+    static void operator delete(void * block, size_t size) {
+      arena_free(block, size);
+    }
+
+    ~Task() {
+      delete dependence_table;
+    }
+
     // Accessors
     TaskType get_type() {
       return this->type;
@@ -80,6 +179,147 @@ class Task
       return initial; 
     }
 
+    bool has_dependences() {
+      return this->dependences;
+    }
+
+    const std::vector<Task *> & get_dependency_parents() {
+      return this->dependency_parents;
+    }
+
+    const std::vector<Task *> & get_dependency_children() {
+      return this->dependency_children;
+    }
+
+    // Table for resolving the dependences of this task's children. Only the
+    // thread executing this task uses it.
+    DependenceTable * get_dependence_table() {
+      if (this->dependence_table == NULL) {
+        this->dependence_table = new DependenceTable();
+      }
+      return this->dependence_table;
+    }
+
+    // The table is not needed once the task can no longer create children
+    void release_dependence_table() {
+      delete this->dependence_table;
+      this->dependence_table = NULL;
+    }
+
+    uint64_t get_region_id() {
+      return this->region_id;
+    }
+
+    uint32_t get_creating_thread() {
+      return this->creating_thread;
+    }
+
+    uint32_t get_executing_thread() {
+      return this->executing_thread;
+    }
+
+    bool has_executed() {
+      return this->executing_thread != UINT32_MAX;
+    }
+
+    uint32_t get_thread_num() {
+      return this->thread_num;
+    }
+
+    uint64_t get_exec_time() {
+      return this->exec_time;
+    }
+
+    uint32_t get_child_index() {
+      return this->child_index;
+    }
+
+    uint32_t get_depth() {
+      return this->depth;
+    }
+
+    // Only the thread executing the task changes its state, so that thread
+    // may read it directly; other threads go through get_strand
+    const sp_state_t & get_sp_state() {
+      return this->sp_state;
+    }
+
+    // Called by the thread executing the task. The lock keeps get_strand on
+    // other threads from seeing a partial update.
+    void set_sp_state(const sp_state_t & new_state) {
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      this->sp_state = new_state;
+    }
+
+    // Bytes of memory owned by this task object
+    size_t get_memory_usage() {
+      size_t bytes = sizeof(Task);
+      bytes += ancestry_children.capacity() * sizeof(Task *);
+      bytes += dependency_children.capacity() * sizeof(Task *);
+      bytes += dependency_parents.capacity() * sizeof(Task *);
+      bytes += tsps.capacity() * sizeof(int);
+      if (dependence_table) {
+        bytes += dependence_table->get_memory_usage();
+      }
+      return bytes;
+    }
+
+    // Fill in the spill record for this task
+    void get_spill_record(spilled_task_t & record) {
+      memset(&record, 0, sizeof(record));
+      record.id = this->id;
+      record.parent_id = this->parent_id;
+      record.codeptr_ra = (uint64_t) this->codeptr_ra;
+      record.region_id = this->region_id;
+      record.exec_time = this->exec_time;
+      record.type = this->type;
+      record.state = this->state;
+      record.initial = this->initial;
+      record.creating_thread = this->creating_thread;
+      record.executing_thread = this->executing_thread;
+      record.thread_num = this->thread_num;
+      record.child_index = this->child_index;
+      record.depth = this->depth;
+      record.dependences = this->dependences;
+      record.sp_state = this->sp_state;
+#ifdef TRACK_SP_LABELS
+      record.label_length = this->label.get_length();
+#endif
+    }
+
+    // Claim the index of the next child created by this task
+    uint32_t spawn_child() {
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      return this->sp_state.spawned++;
+    }
+
+#ifdef TRACK_SP_LABELS
+    const SPLabel & get_label() {
+      return this->label;
+    }
+
+    // Snapshot of the current position in this task, for concurrency queries
+    sp_strand_t get_strand() {
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      sp_strand_t strand = {&this->label, this->sp_state};
+      return strand;
+    }
+
+    // Is this task an ancestor of (or the same as) other?
+    bool is_ancestor_of(Task * other) {
+      return sp_is_ancestor(this->label, other->label);
+    }
+
+    // Could the current positions of this task and other run concurrently?
+    bool is_concurrent_with(Task * other) {
+      return sp_concurrent(this->get_strand(), other->get_strand());
+    }
+
+    void set_label(SPLabel && new_label) {
+      this->label = std::move(new_label);
+    }
+#endif
+
     // Mutators 
     void add_tsp(ompt_task_status_t tsp) {
       boost::lock_guard<boost::mutex> lock(this->mtx);
@@ -91,11 +331,64 @@ class Task
       this->ancestry_children.push_back(child); 
     }
 
+    void set_has_dependences(bool has_dependences) {
+      this->dependences = has_dependences;
+    }
+
+    // Edges are added by the thread creating the consumer while the producer
+    // may be running elsewhere, so both sides take the task's own lock
+    void add_dependency_parent(Task * producer) {
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      this->dependency_parents.push_back(producer);
+    }
+
+    void add_dependency_child(Task * consumer) {
+      boost::lock_guard<boost::mutex> lock(this->mtx);
+      this->dependency_children.push_back(consumer);
+    }
+
     void change_state(TaskState new_state) {
       boost::lock_guard<boost::mutex> lock(this->mtx);
       this->state = new_state;         
     }                                  
                                        
+    void set_region_id(uint64_t region_id) {
+      this->region_id = region_id;
+    }
+
+    void set_creating_thread(uint32_t thread) {
+      this->creating_thread = thread;
+    }
+
+    void set_executing_thread(uint32_t thread) {
+      this->executing_thread = thread;
+    }
+
+    void set_thread_num(uint32_t thread_num) {
+      this->thread_num = thread_num;
+    }
+
+    // Only called by the thread executing the task
+    void add_exec_time(uint64_t time) {
+      this->exec_time += time;
+    }
+
+    void set_child_index(uint32_t index) {
+      this->child_index = index;
+    }
+
+    void set_depth(uint32_t depth) {
+      this->depth = depth;
+    }
+
+    uint32_t get_trace_window() {
+      return this->trace_window;
+    }
+
+    void set_trace_window(uint32_t window) {
+      this->trace_window = window;
+    }
+
     void set_as_initial_task() {       
       boost::lock_guard<boost::mutex> lock(this->mtx);
       this->initial = true;         
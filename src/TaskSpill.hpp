@@ -0,0 +1,108 @@
+#ifndef TASK_SPILL_H
+#define TASK_SPILL_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/locks.hpp"
+
+#include "Task.hpp"
+
+/******************************************************************************\
+ * A file that completed tasks are moved to when the tool reaches its memory
+ * limit. Records are appended as spilled_task_t followed by the task's label
+ * pairs, and are only read back when the tree is built.
+\******************************************************************************/
+
+class TaskSpill
+{
+  private:
+    boost::mutex mtx;
+    std::string path;
+    FILE * file;
+    // Totals over the run, kept after the tasks are reloaded
+    uint64_t n_spilled;
+    uint64_t bytes_spilled;
+
+  public:
+    TaskSpill() : file(NULL), n_spilled(0), bytes_spilled(0) {}
+
+    ~TaskSpill() {
+      if (file) {
+        fclose(file);
+        remove(path.c_str());
+      }
+    }
+
+    void set_path(const std::string & spill_path) {
+      path = spill_path;
+    }
+
+    uint64_t get_num_spilled() {
+      return n_spilled;
+    }
+
+    uint64_t get_bytes_spilled() {
+      return bytes_spilled;
+    }
+
+    // Append a task to the spill file. Returns false if it could not be
+    // written, in which case the caller keeps the task in memory.
+    bool spill(Task * t) {
+      boost::lock_guard<boost::mutex> lock(mtx);
+      if (file == NULL) {
+        file = fopen(path.c_str(), "w+b");
+        if (file == NULL) {
+          printf("Could not open spill file %s\n", path.c_str());
+          return false;
+        }
+      }
+      spilled_task_t record;
+      t->get_spill_record(record);
+      bool ok = fwrite(&record, sizeof(record), 1, file) == 1;
+#ifdef TRACK_SP_LABELS
+      if (ok && record.label_length > 0) {
+        ok = fwrite(t->get_label().get_pairs(), sizeof(sp_pair_t),
+                    record.label_length, file) == record.label_length;
+      }
+#endif
+      if (ok) {
+        n_spilled++;
+        bytes_spilled += sizeof(record) + record.label_length * sizeof(sp_pair_t);
+      }
+      return ok;
+    }
+
+    // Read every spilled task back, passing each to add, and empty the file
+    template <class F>
+    void reload(F add) {
+      boost::lock_guard<boost::mutex> lock(mtx);
+      if (file == NULL) {
+        return;
+      }
+      rewind(file);
+      spilled_task_t record;
+      std::vector<sp_pair_t> pairs;
+      while (fread(&record, sizeof(record), 1, file) == 1) {
+        pairs.resize(record.label_length);
+        if (record.label_length > 0 &&
+            fread(pairs.data(), sizeof(sp_pair_t), record.label_length, file) != record.label_length) {
+          printf("Spill file %s is truncated\n", path.c_str());
+          break;
+        }
+        Task * t = new Task(record);
+#ifdef TRACK_SP_LABELS
+        t->set_label(SPLabel::from_pairs(pairs.data(), record.label_length));
+#endif
+        add(t);
+      }
+      fclose(file);
+      remove(path.c_str());
+      file = NULL;
+    }
+};
+
+#endif // TASK_SPILL_H
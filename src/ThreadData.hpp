@@ -0,0 +1,353 @@
+#ifndef THREAD_DATA_H
+#define THREAD_DATA_H
+
+#include <inttypes.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#include <unordered_map>
+
+#include "ompt.h"
+#include "MemoryAccounting.hpp"
+#include "TimelineExport.hpp"
+
+#ifdef RECORD_CALLBACKS
+#include "CallbackRecord.hpp"
+#endif
+
+class Task;
+class ParallelRegion;
+class NumaArena;
+
+/******************************************************************************\
+ * Data the tool keeps per OpenMP thread. Each thread only ever appends to its
+ * own thread_data_t, so recording events needs no synchronization; the
+ * buffers are read at finalize (or from the signal handler) once the threads
+ * are quiescent.
+\******************************************************************************/
+
+/* A taskwait, taskgroup or barrier encountered by a task */
+typedef struct sync_event {
+  // ID of the join vertex for this sync point
+  uint64_t id;
+  // Task that encountered the sync region
+  uint64_t task_id;
+  // Parallel region the barrier belongs to (barriers only)
+  uint64_t parallel_id;
+  const void * codeptr_ra;
+  ompt_sync_region_kind_t kind;
+  // Children of the encountering task with an index in [join_begin, join_end)
+  // are joined by this sync point
+  uint32_t join_begin;
+  uint32_t join_end;
+  // Number of barriers the encountering implicit task had passed before this
+  // one, which identifies the barrier instance within its region
+  uint32_t instance;
+  uint64_t begin_time;
+  uint64_t end_time;
+  uint64_t wait_begin_time;
+  // Total time spent in sync_region_wait for this sync region
+  uint64_t wait_time;
+} sync_event_t;
+
+/* One thread's share of a worksharing construct (loop, sections, single,
+ * ...). Every thread of the team reports its own begin and end.
+ */
+typedef struct loop_event {
+  // ID of the construct's vertex for this thread
+  uint64_t id;
+  // Implicit task that encountered the construct, and its region
+  uint64_t task_id;
+  uint64_t region_id;
+  // Index of the construct among the worksharing constructs of the implicit
+  // task. Every thread of a team encounters them in the same order, so
+  // (region_id, instance) identifies the construct across the team. Outside
+  // an implicit task this is the ID.
+  uint64_t instance;
+  const void * codeptr_ra;
+  ompt_work_type_t wstype;
+  // count from the work callback: the iterations of a loop
+  uint64_t count;
+  uint64_t begin_time;
+  uint64_t end_time;
+  // Number of chunks dispatched to this thread, and the index of the last one
+  // in loop_chunks
+  uint64_t chunks;
+  uint64_t last_chunk;
+} loop_event_t;
+
+/* A chunk of loop iterations dispatched to a thread */
+typedef struct loop_chunk {
+  // Index of the construct in loop_events
+  uint64_t event;
+  uint64_t first_iteration;
+  uint64_t begin_time;
+  // Set when the next chunk is dispatched or the loop ends
+  uint64_t end_time;
+} loop_chunk_t;
+
+/* Acquisitions of one lock (a critical section, an OpenMP lock, an ordered
+ * region, ...) from one call site by one task. Each thread keeps one record
+ * per task, lock and call site (see mutex_key_t), so a loop around one or
+ * several critical sections adds one record per lock rather than one per
+ * iteration.
+ */
+typedef struct mutex_record {
+  uint64_t task_id;
+  uint64_t region_id;
+  uint64_t wait_id;
+  const void * codeptr_ra;
+  ompt_mutex_kind_t kind;
+  uint64_t acquisitions;
+  // Time from requesting the lock to getting it, in total and at most
+  uint64_t wait_time;
+  uint64_t max_wait;
+  // Time from getting the lock to releasing it
+  uint64_t hold_time;
+} mutex_record_t;
+
+/* Key of a thread's mutex records: the task, lock and call site */
+typedef struct mutex_key {
+  uint64_t task_id;
+  uint64_t wait_id;
+  const void * codeptr_ra;
+
+  bool operator==(const mutex_key & other) const {
+    return task_id == other.task_id && wait_id == other.wait_id &&
+           codeptr_ra == other.codeptr_ra;
+  }
+} mutex_key_t;
+
+struct mutex_key_hash {
+  // noexcept, so that the map does not cache hashes in its nodes (see
+  // hash_map_node_bytes)
+  size_t operator()(const mutex_key_t & key) const noexcept {
+    uint64_t h = key.task_id * 0x9e3779b97f4a7c15ULL;
+    h ^= key.wait_id + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= (uint64_t) key.codeptr_ra + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return (size_t) h;
+  }
+};
+
+/* A lock this thread has requested or holds */
+typedef struct held_mutex {
+  uint64_t wait_id;
+  // Index into mutex_records
+  size_t record;
+  uint64_t acquire_time;
+  // 0 until the lock is acquired
+  uint64_t acquired_time;
+} held_mutex_t;
+
+/* What one thread did on behalf of one parallel region */
+typedef struct thread_region_stats {
+  // Thread number within the region's team, if the thread was a member
+  int32_t thread_num;
+  uint64_t tasks_created;
+  uint64_t tasks_executed;
+  // Tasks executed by this thread that another thread created
+  uint64_t tasks_stolen;
+  // Time in the region's implicit task that was not spent idle in a sync
+  // region
+  uint64_t busy_time;
+} thread_region_stats_t;
+
+/* An implicit task running on this thread. Nested parallel regions stack. */
+typedef struct implicit_frame {
+  Task * task;
+  ParallelRegion * region;
+  uint64_t region_id;
+  uint64_t begin_time;
+  // Time spent waiting in sync regions without executing tasks
+  uint64_t idle_time;
+  // Task that was executing on this thread when the implicit task began
+  Task * encountering_task;
+  // Worksharing constructs the implicit task has encountered so far
+  uint64_t worksharing;
+} implicit_frame_t;
+
+#define COUNTER_BUCKETS 33
+
+/* Histogram bucket of a count: 0 for 0, then one bucket per power of two
+ * (1, 2-3, 4-7, ...)
+ */
+static inline uint32_t counter_bucket(uint64_t count)
+{
+  uint32_t bucket = 0;
+  while (count > 0 && bucket < COUNTER_BUCKETS - 1) {
+    count >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/* Aggregate counts kept in counters mode, where no per-task records exist */
+typedef struct tree_counters {
+  uint64_t initial_tasks;
+  uint64_t implicit_tasks;
+  uint64_t explicit_tasks;
+  uint64_t parallel_regions;
+  // Tasks and regions by depth below the initial task
+  std::vector<uint64_t> depth_histogram;
+  // Tasks by number of children (tasks and regions) they created
+  uint64_t fanout_histogram[COUNTER_BUCKETS];
+  // Parallel regions by number of explicit tasks created in them
+  uint64_t region_tasks_histogram[COUNTER_BUCKETS];
+} tree_counters_t;
+
+/* A parallel region in counters mode, pointed to by its parallel_data */
+typedef struct region_counters {
+  uint32_t depth;
+  std::atomic<uint64_t> tasks;
+} region_counters_t;
+
+/* A task in granularity mode, pointed to by its task_data */
+typedef struct grain_task {
+  // Call site of the task and of the task that created it
+  const void * codeptr_ra;
+  const void * parent_codeptr_ra;
+  uint32_t depth;
+  // When the task first ran, and the time it spent running itself (not
+  // counting other tasks executed while it was suspended)
+  uint64_t start_time;
+  uint64_t exec_time;
+  // Estimated cost of creating the task, 0 if it could not be measured
+  uint64_t create_cost;
+  // When this task last created a child, 0 once it has been suspended since
+  uint64_t last_create_time;
+} grain_task_t;
+
+/* Tasks of one call site at one depth */
+typedef struct grain_level {
+  uint64_t tasks;
+  // First start to completion, including everything run in between
+  uint64_t inclusive_time;
+} grain_level_t;
+
+/* Granularity statistics of one call site (codeptr_ra) */
+typedef struct grain_site {
+  uint64_t tasks;
+  // Tasks created by a task of the same call site
+  uint64_t recursive_tasks;
+  uint64_t exec_time;
+  uint64_t create_cost;
+  uint64_t create_samples;
+  std::vector<grain_level_t> levels;
+} grain_site_t;
+
+/* Counts a thread publishes for live monitoring (LiveStats.hpp). Only the
+ * owning thread writes them, with a plain load and store rather than a
+ * read-modify-write, so counting costs no more than a non-atomic increment;
+ * the publisher thread reads them at any time.
+ */
+typedef struct live_counters {
+  std::atomic<uint64_t> tasks_created;
+  std::atomic<uint64_t> tasks_completed;
+  std::atomic<uint64_t> parallel_regions;
+  std::atomic<uint64_t> max_depth;
+} live_counters_t;
+
+static inline void live_count(std::atomic<uint64_t> & counter)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static inline void live_depth(live_counters_t & live, uint64_t depth)
+{
+  if (depth > live.max_depth.load(std::memory_order_relaxed)) {
+    live.max_depth.store(depth, std::memory_order_relaxed);
+  }
+}
+
+typedef struct thread_data {
+  // Tool-assigned thread number, in order of first appearance
+  uint32_t index;
+  // NUMA node of the thread's arena, and how many of the task and region
+  // objects the callbacks touched on this thread lived on that node or on
+  // another one
+  NumaArena * arena;
+  int32_t numa_node;
+  uint64_t local_accesses;
+  uint64_t remote_accesses;
+  // Dependences reported for tasks created on this thread, and the
+  // producer-consumer edges they resolved to
+  uint64_t dependences_resolved;
+  uint64_t dependence_edges;
+  // Counters mode: the counts, and the regions whose implicit tasks are
+  // running on this thread
+  tree_counters_t counters;
+  std::vector<region_counters_t *> counter_regions;
+  // Granularity mode: the call sites of tasks completed on this thread, the
+  // task running now and since when, and the tasks its implicit tasks
+  // interrupted
+  std::unordered_map<const void *, grain_site_t> grain_sites;
+  grain_task_t * grain_current;
+  uint64_t grain_current_start;
+  std::vector<grain_task_t *> grain_frames;
+  std::vector<sync_event_t> sync_events;
+  // Indices into sync_events of the sync regions this thread is inside of
+  std::vector<size_t> open_sync_events;
+  // Worksharing constructs, the chunks dispatched in them, and the indices
+  // into loop_events of the constructs this thread is inside of
+  std::vector<loop_event_t> loop_events;
+  std::vector<loop_chunk_t> loop_chunks;
+  std::vector<size_t> open_loops;
+  // Lock acquisitions, their index by task, lock and call site with a cache
+  // of the last one used, and the locks requested or held right now
+  std::vector<mutex_record_t> mutex_records;
+  std::unordered_map<mutex_key_t, size_t, mutex_key_hash> mutex_record_index;
+  size_t cached_mutex_record;
+  std::vector<held_mutex_t> held_mutexes;
+
+  // Per-region execution statistics, plus a cache of the last one used
+  std::unordered_map<uint64_t, thread_region_stats_t> region_stats;
+  uint64_t cached_region_id;
+  thread_region_stats_t * cached_region_stats;
+
+  std::vector<implicit_frame_t> implicit_frames;
+  // Task currently executing on this thread, and when it last started
+  // running user code (0 while it is waiting in a sync region)
+  Task * current_task;
+  uint64_t current_task_start;
+  // Nesting depth of sync_region_wait, the start of the outermost wait, the
+  // task that is waiting, and the time spent executing other tasks during it
+  uint32_t wait_depth;
+  uint64_t wait_begin_time;
+  Task * wait_task;
+  uint64_t task_time_in_wait;
+  // Tracing window (TracingControl.hpp) the state above belongs to
+  uint32_t window;
+  live_counters_t live;
+  // Bytes of the tasks this thread registered, not yet in the tool's counters
+  memory_batch_t memory_batch;
+  // Timeline export, when enabled: the writer and the events not yet written.
+  // The lock guards both against close_timeline, which may run from a signal
+  // handler while the thread is still recording
+  TimelineWriter * timeline;
+  std::vector<timeline_event_t> timeline_events;
+  boost::mutex timeline_mtx;
+#ifdef RECORD_CALLBACKS
+  std::vector<callback_record_t> recorded_callbacks;
+#endif
+} thread_data_t;
+
+
+/* Execution statistics of a thread for one parallel region */
+static thread_region_stats_t & get_region_stats(thread_data_t * td, uint64_t region_id)
+{
+  if (td->cached_region_stats == NULL || td->cached_region_id != region_id) {
+    auto search = td->region_stats.find(region_id);
+    if (search == td->region_stats.end()) {
+      thread_region_stats_t stats;
+      memset(&stats, 0, sizeof(stats));
+      stats.thread_num = -1;
+      search = td->region_stats.insert( {region_id, stats} ).first;
+    }
+    td->cached_region_id = region_id;
+    td->cached_region_stats = &(search->second);
+  }
+  return *(td->cached_region_stats);
+}
+
+#endif // THREAD_DATA_H
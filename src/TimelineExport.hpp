@@ -0,0 +1,184 @@
+#ifndef TIMELINE_EXPORT_H
+#define TIMELINE_EXPORT_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/locks.hpp"
+
+/******************************************************************************\
+ * Timeline export in the Chrome trace-event JSON format, which chrome://tracing
+ * and the Perfetto UI both load.
+ *
+ * Each thread appends fixed-size events to its own buffer, under a lock that
+ * only close_timeline ever contends. When the buffer fills up, the thread
+ * formats it and appends the text to the output file under the writer's
+ * lock, so memory stays bounded however long the program runs. The format does not require events in time order; the
+ * viewers sort them.
+ *
+ * Events written:
+ *   - a complete ("X") event for every interval a task ran on a thread,
+ *   - an async ("b"/"e") span for every parallel region, since regions on
+ *     different threads and nesting levels overlap,
+ *   - a flow ("s"/"f") arrow from the point a task was created, on the
+ *     creating thread, to the point it first started running.
+\******************************************************************************/
+
+#ifndef TIMELINE_BUFFER_EVENTS
+#define TIMELINE_BUFFER_EVENTS 4096
+#endif
+
+enum class TimelineEventKind : uint8_t {ExplicitTask, ImplicitTask, Region,
+                                        FlowStart, FlowEnd};
+
+typedef struct timeline_event {
+  uint64_t time;
+  uint64_t duration;
+  uint64_t id;
+  uint64_t codeptr_ra;
+  uint32_t thread;
+  TimelineEventKind kind;
+} timeline_event_t;
+
+class TimelineWriter
+{
+  private:
+    boost::mutex mtx;
+    FILE * file;
+    // Timestamps are written relative to this, in microseconds
+    uint64_t base_time;
+    uint64_t events;
+    std::string path;
+
+    // Print one event as JSON, returning its length
+    int format_event(char * out, size_t size, const timeline_event_t & e) {
+      double ts = (e.time - base_time) / 1000.0;
+      switch (e.kind) {
+        case TimelineEventKind::ExplicitTask:
+        case TimelineEventKind::ImplicitTask:
+          return snprintf(out, size,
+            ",\n{\"name\":\"%s task\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%" PRIu64 ",\"codeptr_ra\":\"0x%" PRIx64 "\"}}",
+            e.kind == TimelineEventKind::ExplicitTask ? "explicit" : "implicit",
+            e.thread, ts, e.duration / 1000.0, e.id, e.codeptr_ra);
+        case TimelineEventKind::Region:
+          return snprintf(out, size,
+            ",\n{\"name\":\"parallel region\",\"cat\":\"region\",\"ph\":\"b\",\"pid\":0,\"tid\":%u,"
+            "\"id\":%" PRIu64 ",\"ts\":%.3f,\"args\":{\"codeptr_ra\":\"0x%" PRIx64 "\"}}"
+            ",\n{\"name\":\"parallel region\",\"cat\":\"region\",\"ph\":\"e\",\"pid\":0,\"tid\":%u,"
+            "\"id\":%" PRIu64 ",\"ts\":%.3f}",
+            e.thread, e.id, ts, e.codeptr_ra, e.thread, e.id, ts + e.duration / 1000.0);
+        case TimelineEventKind::FlowStart:
+          return snprintf(out, size,
+            ",\n{\"name\":\"create\",\"cat\":\"create\",\"ph\":\"s\",\"pid\":0,\"tid\":%u,"
+            "\"id\":%" PRIu64 ",\"ts\":%.3f}", e.thread, e.id, ts);
+        case TimelineEventKind::FlowEnd:
+          return snprintf(out, size,
+            ",\n{\"name\":\"create\",\"cat\":\"create\",\"ph\":\"f\",\"bp\":\"e\",\"pid\":0,\"tid\":%u,"
+            "\"id\":%" PRIu64 ",\"ts\":%.3f}", e.thread, e.id, ts);
+      }
+      return 0;
+    }
+
+  public:
+    TimelineWriter() : file(NULL), base_time(0), events(0) {}
+
+    ~TimelineWriter() {
+      close(0);
+    }
+
+    bool open(const std::string & output_path, uint64_t time) {
+      path = output_path;
+      file = fopen(path.c_str(), "w");
+      if (file == NULL) {
+        printf("Could not open timeline %s\n", path.c_str());
+        return false;
+      }
+      base_time = time;
+      // Every event starts with a comma, so the array opens with metadata
+      fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"OpenMP\"}}");
+      return true;
+    }
+
+    bool is_open() const {
+      return file != NULL;
+    }
+
+    const std::string & get_path() const {
+      return path;
+    }
+
+    /* Format a batch of events and append it to the file. Unless wait is
+     * set, gives up and returns false if another write holds the file.
+     */
+    bool write(const timeline_event_t * batch, size_t n, bool wait = true) {
+      if (n == 0) {
+        return true;
+      }
+      // Formatted outside the lock; an event is at most a few hundred bytes
+      std::vector<char> text(n * 512);
+      size_t length = 0;
+      for (size_t i = 0; i < n; i++) {
+        int len = format_event(text.data() + length, text.size() - length, batch[i]);
+        if (len > 0 && length + len < text.size()) {
+          length += len;
+        }
+      }
+      boost::unique_lock<boost::mutex> lock(mtx, boost::defer_lock);
+      if (wait) {
+        lock.lock();
+      } else if (!lock.try_lock()) {
+        return false;
+      }
+      if (file != NULL) {
+        fwrite(text.data(), 1, length, file);
+        events += n;
+      }
+      return true;
+    }
+
+    /* Name the threads and terminate the JSON. Unless wait is set, gives up
+     * and returns false if a write holds the file.
+     */
+    bool close(uint32_t n_threads, bool wait = true) {
+      boost::unique_lock<boost::mutex> lock(mtx, boost::defer_lock);
+      if (wait) {
+        lock.lock();
+      } else if (!lock.try_lock()) {
+        return false;
+      }
+      if (file == NULL) {
+        return true;
+      }
+      for (uint32_t t = 0; t < n_threads; t++) {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                      "\"args\":{\"name\":\"thread %u\"}}", t, t);
+      }
+      fprintf(file, "\n]}\n");
+      fclose(file);
+      file = NULL;
+      printf("Timeline: %" PRIu64 " events written to %s\n", events, path.c_str());
+      return true;
+    }
+};
+
+/* Append an event to a thread's buffer, writing the buffer out when full */
+static inline void timeline_emit(TimelineWriter * writer, std::vector<timeline_event_t> & buffer,
+                                 const timeline_event_t & event)
+{
+  if (buffer.capacity() < TIMELINE_BUFFER_EVENTS) {
+    buffer.reserve(TIMELINE_BUFFER_EVENTS);
+  }
+  buffer.push_back(event);
+  if (buffer.size() >= TIMELINE_BUFFER_EVENTS) {
+    writer->write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+}
+
+#endif // TIMELINE_EXPORT_H
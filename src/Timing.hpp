@@ -0,0 +1,13 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <inttypes.h>
+#include <chrono>
+
+/* Monotonic timestamp in nanoseconds, used for all durations the tool records */
+static inline uint64_t get_timestamp() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // TIMING_H
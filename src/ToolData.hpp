@@ -5,6 +5,9 @@
 #include "boost/thread/locks.hpp" 
 #include <unordered_map> 
 #include <inttypes.h> 
+#include <atomic>
+#include <deque>
+#include <thread>
 
 #include "tbb/tbb.h" 
 #include "tbb/concurrent_unordered_map.h"
@@ -12,6 +15,35 @@
 #include "Task.hpp" 
 #include "ParallelRegion.hpp"
 #include "Tree.hpp" 
+#include "ThreadData.hpp"
+#include "MemoryAccounting.hpp"
+#include "TaskSpill.hpp"
+#include "DebugRing.hpp"
+#include "SubtreeHash.hpp"
+#include "TracingControl.hpp"
+#include "LiveStats.hpp"
+
+/* While the program runs, tasks are registered in TASK_MAP_SHARDS maps picked
+ * by a hash of the task ID, each with its own lock, so that threads creating
+ * tasks at the same time (such as the implicit tasks of a team entering a
+ * region) rarely take the same lock. The padding keeps neighbouring shards'
+ * locks off each other's cache lines. The shards are merged into id_to_task
+ * at finalize.
+ */
+#define TASK_MAP_SHARD_BITS 6
+#define TASK_MAP_SHARDS (1 << TASK_MAP_SHARD_BITS)
+
+typedef struct task_map_shard {
+  boost::mutex mtx;
+  std::unordered_map<uint64_t, Task*> tasks;
+  char padding[64];
+} task_map_shard_t;
+
+/* Counters mode only keeps aggregate counts per thread; granularity mode
+ * aggregates task durations per call site; tree mode records every task and
+ * region and builds the ancestry tree at finalize
+ */
+enum class ToolMode {Counters, Granularity, Tree};
 
 /******************************************************************************\
  * The tool_data_t defines the data the tool needs to determine parent-child
@@ -19,15 +51,19 @@
  * parent-child tree and dependence DAG. 
 \******************************************************************************/
 typedef struct tool_data {
+  ToolMode mode;
+  // Granularity mode: tasks shorter than this many nanoseconds are flagged
+  uint64_t grain_cutoff;
   boost::mutex mtx; 
   uint64_t initial_task_id;
   boost::mutex print_mtx; 
 
   // We will always need to be able to look up task objects by their numerical
   // IDs in order to check things like whether the task has been schedule, which
-  // thread worked on it last etc. 
+  // thread worked on it last etc. Tasks are registered in the shards and
+  // moved to id_to_task by merge_task_maps at finalize.
+  task_map_shard_t task_shards[TASK_MAP_SHARDS];
   std::unordered_map<uint64_t, Task*> id_to_task; 
-  boost::mutex id_to_task_mtx; 
 
   // We will also want to be able to look up parallel region objects 
   std::unordered_map<uint64_t, ParallelRegion*> id_to_parallel_region;
@@ -39,6 +75,36 @@ typedef struct tool_data {
   boost::mutex id_to_vertex_mtx;
   tree_t tree;
   boost::mutex tree_mtx; 
+  // Structural hashes of the tree's vertices (by vertex index) and their
+  // children and the roots sorted by hash, filled in when the tree is built
+  std::vector<subtree_hash_vertex_t> tree_hashes;
+  std::vector<uint32_t> tree_hash_children;
+  std::vector<uint32_t> tree_hash_roots;
+  CallSiteTable call_sites;
+  // Timeline export (TASK_TREE_TIMELINE), NULL when disabled
+  TimelineWriter * timeline;
+  // Live statistics segment (TASK_TREE_LIVE_STATS), NULL when disabled, and
+  // the thread that publishes to it
+  LiveStats * live_stats;
+  std::thread live_stats_thread;
+  std::atomic<bool> live_stats_stop;
+
+  // Per-thread data, registered the first time each thread needs it
+  std::vector<thread_data_t*> threads;
+  boost::mutex threads_mtx;
+
+  // Memory owned by the tool. Above memory.limit, completed explicit tasks
+  // are moved to the spill file, oldest first, until the tree is built.
+  memory_accounting_t memory;
+  TaskSpill spill;
+  std::deque<Task*> spill_candidates;
+  boost::mutex spill_candidates_mtx;
+  boost::mutex spilling_mtx;
+
+#ifdef RECORD_CALLBACKS
+  // Next position in the global callback invocation order
+  std::atomic<uint64_t> callback_seq{0};
+#endif
 
 
 #ifdef TRACK_ANCESTRY
@@ -66,18 +132,104 @@ typedef struct tool_data {
 } tool_data_t; 
 
 
-void register_task_as_child_of_parallel_region(uint64_t region_id, 
-                                               uint64_t task_id, 
-                                               tool_data_t * tool_data) {
-  auto id_to_region = &(tool_data->id_to_parallel_region);
-  auto id_to_task = &(tool_data->id_to_task);
-  auto region_search = id_to_region->find(region_id);
-  auto task_search = id_to_task->find(task_id);
-  if (region_search != id_to_region->end() && task_search != id_to_task->end()) {
-    region_search->second->add_child(task_search->second);    
+/* Get the calling thread's data, creating and registering it on first use */
+static thread_local thread_data_t * current_thread_data = NULL;
+
+thread_data_t * get_thread_data(tool_data_t * tool_data)
+{
+  static_assert(sizeof(thread_data_t) <= ARENA_MAX_BLOCK,
+                "thread_data_t is allocated as a single arena block");
+  if (current_thread_data == NULL) {
+    // Allocated from the thread's own arena so it sits on the thread's node
+    thread_data_t * td = new (arena_allocate(sizeof(thread_data_t))) thread_data_t();
+    td->arena = get_thread_arena();
+    td->numa_node = td->arena->get_node();
+    boost::lock_guard<boost::mutex> lock(tool_data->threads_mtx);
+    // Under threads_mtx, so that close_timeline either sees the thread or
+    // the thread never sees the timeline
+    td->timeline = tool_data->timeline;
+    td->index = tool_data->threads.size();
+    tool_data->threads.push_back(td);
+    current_thread_data = td;
+  }
+  thread_data_t * td = current_thread_data;
+  if (td->window != current_tracing_window()) {
+    // Collection was paused since this thread's last callback, so the task
+    // it was running, its waits and its open sync regions are out of date
+    td->window = current_tracing_window();
+    td->current_task = NULL;
+    td->current_task_start = 0;
+    td->wait_depth = 0;
+    td->wait_task = NULL;
+    td->open_sync_events.clear();
+    td->open_loops.clear();
   }
+  return td;
 }
 
+void free_thread_data(thread_data_t * td)
+{
+  td->~thread_data_t();
+  arena_free(td, sizeof(thread_data_t));
+}
+
+/* Count an access to an arena object from this thread as NUMA-local or
+ * remote
+ */
+static inline void note_numa_access(thread_data_t * td, const void * object)
+{
+  if (object == NULL) {
+    return;
+  }
+  if (arena_node_of(object) == td->numa_node) {
+    td->local_accesses++;
+  } else {
+    td->remote_accesses++;
+  }
+}
+
+/* Add an event to the thread's timeline buffer, if the timeline is enabled.
+ * The buffer's lock is only contended when close_timeline drains it.
+ */
+static inline void timeline_record(thread_data_t * td, TimelineEventKind kind, uint64_t time,
+                                   uint64_t duration, uint64_t id, const void * codeptr_ra)
+{
+  if (td->timeline != NULL) {
+    boost::lock_guard<boost::mutex> lock(td->timeline_mtx);
+    if (td->timeline != NULL) {
+      timeline_event_t event = {time, duration, id, (uint64_t) codeptr_ra, td->index, kind};
+      timeline_emit(td->timeline, td->timeline_events, event);
+    }
+  }
+}
+
+/* Charge the time since the current task last started running to it, and
+ * make next the task currently executing on this thread
+ */
+void switch_current_task(thread_data_t * td, Task * next, uint64_t now)
+{
+  Task * prior = td->current_task;
+  if (prior && td->current_task_start != 0) {
+    uint64_t interval = now - td->current_task_start;
+    prior->add_exec_time(interval);
+    timeline_record(td, prior->get_type() == TaskType::Explicit ? TimelineEventKind::ExplicitTask
+                                                                : TimelineEventKind::ImplicitTask,
+                    td->current_task_start, interval, prior->get_id(), prior->get_codeptr_ra());
+    if (td->wait_depth > 0) {
+      td->task_time_in_wait += interval;
+    }
+  }
+  td->current_task = next;
+  // A task that is waiting in a sync region is not running user code
+  if (next && !(td->wait_depth > 0 && next == td->wait_task)) {
+    td->current_task_start = now;
+  } else {
+    td->current_task_start = 0;
+  }
+}
+
+void spill_tasks(tool_data_t * tool_data);
+
 /* 
  *
  */
@@ -87,57 +239,168 @@ void register_parallel_region(ParallelRegion * new_region, tool_data_t * tool_da
   auto id_to_region = &(tool_data->id_to_parallel_region);
   uint64_t region_id = new_region->get_id();
   auto insert_result = id_to_region->insert({region_id, new_region});
-#ifdef DEBUG
-  if (insert_result.second == false) {
-    printf("\t- Region %lu already has a ParallelRegion object associated with it\n",
-           region_id);
-  } else {
-    printf("\t- Associating region %lu with ParallelRegion object:\n", region_id);
-  }
-#endif 
+  account_memory(tool_data->memory, MemoryCategory::Regions,
+                 new_region->get_memory_usage());
+  account_memory(tool_data->memory, MemoryCategory::RegionMap,
+                 hash_map_node_bytes<decltype(tool_data->id_to_parallel_region)>() + sizeof(void *));
+  DEBUG_EVENT(RegisterRegion, region_id, insert_result.second, 0, 0);
 }
 
 
+/* Shard of the task map that holds the task with this ID */
+static inline task_map_shard_t & task_shard(tool_data_t * tool_data, uint64_t id)
+{
+  // Fibonacci hashing: runtimes hand out IDs in per-thread blocks, so the
+  // high bits matter as much as the low ones
+  return tool_data->task_shards[(id * 0x9e3779b97f4a7c15ULL) >> (64 - TASK_MAP_SHARD_BITS)];
+}
+
 /* Associate a task ID to a pointer to the corresponding task object.
- * This is the only function that writes to the id_to_task map. 
+ * This is the only function that adds to the task map. 
  */
 void register_task(Task * new_task, tool_data_t * tool_data) 
 {
-  //// Acquire exclusive access to the id_to_task map
-  //boost::lock_guard<boost::mutex> lock(tool_data->id_to_task_mtx);
-  //// Insert the new task into the id_to_task map
-  //std::unordered_map<uint64_t, Task*> * id_to_task = &(tool_data->id_to_task);
-  //std::pair<std::unordered_map<uint64_t, Task*>::iterator, bool> insert_result;
-  //uint64_t task_id = new_task->get_id();
-  //std::pair<uint64_t, Task*> kvp = {task_id, new_task}; 
-  //insert_result = id_to_task->insert(kvp);
-
-  // Get a pointer to the Task ID --> Task Object map
-  auto id_to_task = &(tool_data->id_to_task);
-  auto insert_result = id_to_task->insert( {new_task->get_id(), new_task} );
-
-
-#ifdef DEBUG
-  if (insert_result.second == false) {
-    printf("\t- Task %lu already has a task object associated with it.\n",
-           new_task->get_id());
-  } else {
-    printf("\t- Task %lu successfully registered.\n", new_task->get_id());
-    new_task->print();
+  // Spilling erases from the shard too
+  task_map_shard_t & shard = task_shard(tool_data, new_task->get_id());
+  boost::unique_lock<boost::mutex> lock(shard.mtx);
+  auto insert_result = shard.tasks.insert( {new_task->get_id(), new_task} );
+  lock.unlock();
+
+  // Counted in this thread's batch, which only reaches the shared counters
+  // once it is full
+  memory_batch_t & batch = get_thread_data(tool_data)->memory_batch;
+  batch_memory(batch, MemoryCategory::Tasks, new_task->get_memory_usage());
+#ifdef TRACK_SP_LABELS
+  batch_memory(batch, MemoryCategory::Labels, new_task->get_label().get_memory_usage());
+#endif
+  batch_memory(batch, MemoryCategory::TaskMap,
+               hash_map_node_bytes<decltype(shard.tasks)>() + sizeof(void *));
+  if (batch.total >= MEMORY_BATCH_BYTES) {
+    int64_t total = flush_memory_batch(tool_data->memory, batch);
+    if (tool_data->memory.limit > 0 && total > tool_data->memory.limit) {
+      spill_tasks(tool_data);
+    }
   }
-#endif 
+  DEBUG_EVENT(RegisterTask, new_task->get_id(), insert_result.second, 0, 0);
+}
+
+/* Move the tasks registered in the shards to id_to_task, and every thread's
+ * memory batch to the shared counters. Called at finalize, and again once
+ * spilled tasks are reloaded.
+ */
+void merge_task_maps(tool_data_t * tool_data)
+{
+  size_t n = tool_data->id_to_task.size();
+  for (task_map_shard_t & shard : tool_data->task_shards) {
+    n += shard.tasks.size();
+  }
+  tool_data->id_to_task.reserve(n);
+  for (task_map_shard_t & shard : tool_data->task_shards) {
+    boost::lock_guard<boost::mutex> lock(shard.mtx);
+    tool_data->id_to_task.insert(shard.tasks.begin(), shard.tasks.end());
+    std::unordered_map<uint64_t, Task*>().swap(shard.tasks);
+  }
+  boost::lock_guard<boost::mutex> lock(tool_data->threads_mtx);
+  for (thread_data_t * td : tool_data->threads) {
+    flush_memory_batch(tool_data->memory, td->memory_batch);
+  }
+}
+
+/* Completed explicit tasks are the ones that can be spilled: nothing the
+ * runtime passes to a later callback refers to them any more. Called once the
+ * task's last callback is done with it.
+ */
+void note_task_completed(Task * t, tool_data_t * tool_data)
+{
+  // Tasks with dependences may still be referenced by their siblings' edges
+  // and their parent's dependence table
+  if (tool_data->memory.limit == 0 || t->get_type() != TaskType::Explicit ||
+      t->is_initial() || t->has_dependences()) {
+    return;
+  }
+  // If collection was paused while the task ran, it may have descendants
+  // that were not recorded, and find_traced_ancestor can still reach it
+  // through their task_data. It must stay in memory.
+  if (t->get_trace_window() != current_tracing_window()) {
+    return;
+  }
+  boost::lock_guard<boost::mutex> lock(tool_data->spill_candidates_mtx);
+  tool_data->spill_candidates.push_back(t);
+}
+
+/* Move the oldest completed tasks to the spill file until the tool is back
+ * under 90% of its memory limit, so spills happen in batches. Only one thread
+ * spills at a time; the others carry on.
+ */
+void spill_tasks(tool_data_t * tool_data)
+{
+  boost::unique_lock<boost::mutex> spilling(tool_data->spilling_mtx, boost::try_to_lock);
+  if (!spilling.owns_lock()) {
+    return;
+  }
+  memory_accounting_t & memory = tool_data->memory;
+  const int64_t target = memory.limit - memory.limit / 10;
+  const int64_t node_bytes = hash_map_node_bytes<decltype(tool_data->id_to_task)>() + sizeof(void *);
+  while (memory.limit > 0 && memory.total.load(std::memory_order_relaxed) > target) {
+    Task * t;
+    {
+      boost::lock_guard<boost::mutex> lock(tool_data->spill_candidates_mtx);
+      if (tool_data->spill_candidates.empty()) {
+        return;
+      }
+      t = tool_data->spill_candidates.front();
+      tool_data->spill_candidates.pop_front();
+    }
+    if (!tool_data->spill.spill(t)) {
+      // Keep everything in memory from now on
+      memory.limit = 0;
+      return;
+    }
+    {
+      task_map_shard_t & shard = task_shard(tool_data, t->get_id());
+      boost::lock_guard<boost::mutex> lock(shard.mtx);
+      shard.tasks.erase(t->get_id());
+    }
+    account_memory(memory, MemoryCategory::Tasks, -(int64_t) t->get_memory_usage());
+#ifdef TRACK_SP_LABELS
+    account_memory(memory, MemoryCategory::Labels, -(int64_t) t->get_label().get_memory_usage());
+#endif
+    account_memory(memory, MemoryCategory::TaskMap, -node_bytes);
+    delete t;
+  }
+}
+
+/* Bring spilled tasks back into id_to_task. Spilling stops for good. */
+void reload_spilled_tasks(tool_data_t * tool_data)
+{
+  tool_data->memory.limit = 0;
+  {
+    boost::lock_guard<boost::mutex> lock(tool_data->spill_candidates_mtx);
+    tool_data->spill_candidates.clear();
+  }
+  tool_data->spill.reload([tool_data](Task * t) {
+    register_task(t, tool_data);
+  });
+  merge_task_maps(tool_data);
+}
+
+/* Look up a task object by ID while the program runs, or NULL if there is
+ * none (or it was spilled)
+ */
+Task * find_task(uint64_t id, tool_data_t * tool_data) {
+  task_map_shard_t & shard = task_shard(tool_data, id);
+  boost::lock_guard<boost::mutex> lock(shard.mtx);
+  auto search = shard.tasks.find(id);
+  return search != shard.tasks.end() ? search->second : NULL;
 }
 
 /* Mark a task as complete */
 void complete_task(uint64_t id, tool_data_t * tool_data) {
-  std::unordered_map<uint64_t, Task*> * id_to_task = &(tool_data->id_to_task);
-  auto search = id_to_task->find(id);
-  if (search != id_to_task->end()) {
-    search->second->change_state(TaskState::Completed); 
+  Task * t = find_task(id, tool_data);
+  if (t != NULL) {
+    t->change_state(TaskState::Completed); 
   } else {
-#ifdef DEBUG
-    printf("\t- ID %lu does not have a task object associated with it\n", id);
-#endif
+    DEBUG_EVENT(TaskNotFound, id, 0, 0, 0);
   }
 }
 #endif // TOOL_DATA_H
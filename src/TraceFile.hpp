@@ -0,0 +1,510 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+/******************************************************************************\
+ * Binary trace of the tool's records.
+ *
+ * The trace holds every task and parallel region as a fixed-size record and
+ * every edge between them, laid out so that a reader can mmap the file and
+ * use it in place: tasks and regions are sorted by ID, each one points to its
+ * out-edges, which are stored contiguously, and an open-addressing hash table
+ * in the file maps an ID to its record. Opening a trace costs one mmap no
+ * matter how many tasks it holds, and nothing is parsed or copied.
+ *
+ * Like AncestryIndex.hpp, this header does not depend on OMPT or Boost so
+ * that analysis tools can include it on its own.
+\******************************************************************************/
+
+#define TRACE_FILE_MAGIC "OMPTTRC1"
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_NONE UINT32_MAX
+// Set in a hash slot that refers to a region rather than a task
+#define TRACE_FILE_REGION_BIT 0x80000000u
+
+// Task flags
+#define TRACE_TASK_IMPLICIT 0x1
+#define TRACE_TASK_INITIAL 0x2
+#define TRACE_TASK_DEPENDENCES 0x4
+
+enum class TraceEdgeType : uint32_t {Ancestry, Dependence};
+
+typedef struct trace_task {
+  uint64_t id;
+  uint64_t parent_id;
+  uint64_t region_id;
+  uint64_t codeptr_ra;
+  uint64_t exec_time;
+  uint32_t flags;
+  // TaskState of the tool at the time the trace was written
+  uint32_t state;
+  uint32_t creating_thread;
+  uint32_t executing_thread;
+  uint32_t thread_num;
+  uint32_t child_index;
+  // Out-edges are edges[first_edge, first_edge + n_edges)
+  uint64_t first_edge;
+  uint64_t n_edges;
+} trace_task_t;
+
+typedef struct trace_region {
+  uint64_t id;
+  uint64_t parent_id;
+  uint64_t codeptr_ra;
+  uint64_t duration;
+  uint64_t fork_overhead;
+  uint64_t join_overhead;
+  uint32_t requested_team_size;
+  uint32_t team_size;
+  uint32_t nesting_level;
+  uint32_t child_index;
+  uint64_t first_edge;
+  uint64_t n_edges;
+} trace_region_t;
+
+typedef struct trace_edge {
+  uint64_t source;
+  uint64_t target;
+  TraceEdgeType type;
+  uint32_t reserved;
+} trace_edge_t;
+
+typedef struct trace_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t n_tasks;
+  uint64_t n_regions;
+  uint64_t n_edges;
+  uint64_t hash_capacity;
+  // Byte offsets of each section from the start of the file
+  uint64_t tasks_offset;
+  uint64_t regions_offset;
+  uint64_t edges_offset;
+  uint64_t hash_offset;
+  uint64_t file_size;
+} trace_file_header_t;
+
+
+static inline uint64_t trace_file_hash(uint64_t id) {
+  // splitmix64 finalizer
+  id ^= id >> 30;
+  id *= 0xbf58476d1ce4e5b9ULL;
+  id ^= id >> 27;
+  id *= 0x94d049bb133111ebULL;
+  id ^= id >> 31;
+  return id;
+}
+
+static inline uint64_t trace_file_align(uint64_t offset) {
+  return (offset + 7) & ~((uint64_t)7);
+}
+
+
+/* Write a trace. Tasks and regions are sorted by ID and edges by source, and
+ * the records' edge ranges are filled in here. Edges whose source is not in
+ * the trace are dropped. Returns false if the file could not be written.
+ */
+static inline bool write_trace_file(const std::string & path,
+                                    std::vector<trace_task_t> & tasks,
+                                    std::vector<trace_region_t> & regions,
+                                    std::vector<trace_edge_t> & edges)
+{
+  std::sort(tasks.begin(), tasks.end(),
+            [](const trace_task_t & a, const trace_task_t & b) { return a.id < b.id; });
+  std::sort(regions.begin(), regions.end(),
+            [](const trace_region_t & a, const trace_region_t & b) { return a.id < b.id; });
+  std::stable_sort(edges.begin(), edges.end(),
+                   [](const trace_edge_t & a, const trace_edge_t & b) { return a.source < b.source; });
+
+  const uint64_t n = tasks.size() + regions.size();
+  uint64_t hash_capacity = 16;
+  while (hash_capacity < 2 * n) {
+    hash_capacity <<= 1;
+  }
+  const uint64_t mask = hash_capacity - 1;
+  std::vector<uint32_t> hash(hash_capacity, TRACE_FILE_NONE);
+  auto insert = [&](uint64_t id, uint32_t entry) {
+    uint64_t slot = trace_file_hash(id) & mask;
+    while (hash[slot] != TRACE_FILE_NONE) {
+      slot = (slot + 1) & mask;
+    }
+    hash[slot] = entry;
+  };
+  auto lookup = [&](uint64_t id) -> uint32_t {
+    uint64_t slot = trace_file_hash(id) & mask;
+    while (hash[slot] != TRACE_FILE_NONE) {
+      uint32_t entry = hash[slot];
+      uint64_t entry_id = (entry & TRACE_FILE_REGION_BIT) ?
+        regions[entry & ~TRACE_FILE_REGION_BIT].id : tasks[entry].id;
+      if (entry_id == id) {
+        return entry;
+      }
+      slot = (slot + 1) & mask;
+    }
+    return TRACE_FILE_NONE;
+  };
+  for (uint32_t i = 0; i < tasks.size(); i++) {
+    tasks[i].first_edge = 0;
+    tasks[i].n_edges = 0;
+    insert(tasks[i].id, i);
+  }
+  for (uint32_t i = 0; i < regions.size(); i++) {
+    regions[i].first_edge = 0;
+    regions[i].n_edges = 0;
+    insert(regions[i].id, i | TRACE_FILE_REGION_BIT);
+  }
+
+  // Edges are grouped by source, so each source's range is contiguous
+  uint64_t kept = 0;
+  for (uint64_t i = 0; i < edges.size(); ) {
+    uint64_t j = i;
+    while (j < edges.size() && edges[j].source == edges[i].source) {
+      j++;
+    }
+    uint32_t entry = lookup(edges[i].source);
+    if (entry != TRACE_FILE_NONE) {
+      uint64_t & first = (entry & TRACE_FILE_REGION_BIT) ?
+        regions[entry & ~TRACE_FILE_REGION_BIT].first_edge : tasks[entry].first_edge;
+      uint64_t & count = (entry & TRACE_FILE_REGION_BIT) ?
+        regions[entry & ~TRACE_FILE_REGION_BIT].n_edges : tasks[entry].n_edges;
+      first = kept;
+      count = j - i;
+      for (uint64_t k = i; k < j; k++) {
+        edges[kept++] = edges[k];
+      }
+    }
+    i = j;
+  }
+  edges.resize(kept);
+
+  trace_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_FILE_VERSION;
+  header.n_tasks = tasks.size();
+  header.n_regions = regions.size();
+  header.n_edges = edges.size();
+  header.hash_capacity = hash_capacity;
+  uint64_t offset = trace_file_align(sizeof(header));
+  header.tasks_offset = offset;
+  offset = trace_file_align(offset + tasks.size() * sizeof(trace_task_t));
+  header.regions_offset = offset;
+  offset = trace_file_align(offset + regions.size() * sizeof(trace_region_t));
+  header.edges_offset = offset;
+  offset = trace_file_align(offset + edges.size() * sizeof(trace_edge_t));
+  header.hash_offset = offset;
+  offset = trace_file_align(offset + hash_capacity * sizeof(uint32_t));
+  header.file_size = offset;
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Could not open trace file %s\n", path.c_str());
+    return false;
+  }
+  if (ftruncate(fd, header.file_size) != 0) {
+    printf("Could not resize trace file %s\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  void * map = mmap(NULL, header.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Could not map trace file %s\n", path.c_str());
+    return false;
+  }
+  char * base = (char *) map;
+  memcpy(base, &header, sizeof(header));
+  memcpy(base + header.tasks_offset, tasks.data(), tasks.size() * sizeof(trace_task_t));
+  memcpy(base + header.regions_offset, regions.data(), regions.size() * sizeof(trace_region_t));
+  memcpy(base + header.edges_offset, edges.data(), edges.size() * sizeof(trace_edge_t));
+  memcpy(base + header.hash_offset, hash.data(), hash_capacity * sizeof(uint32_t));
+  munmap(map, header.file_size);
+  return true;
+}
+
+
+/* A contiguous run of records inside the mapped file */
+template <typename T>
+class TraceRange
+{
+  private:
+    const T * first;
+    const T * last;
+
+  public:
+    TraceRange() : first(NULL), last(NULL) {}
+    TraceRange(const T * first, uint64_t count) : first(first), last(first + count) {}
+
+    const T * begin() const {
+      return first;
+    }
+
+    const T * end() const {
+      return last;
+    }
+
+    uint64_t size() const {
+      return last - first;
+    }
+
+    bool empty() const {
+      return first == last;
+    }
+
+    const T & operator[](uint64_t i) const {
+      return first[i];
+    }
+
+    // Records [from, to) of this range
+    TraceRange slice(uint64_t from, uint64_t to) const {
+      return TraceRange(first + from, to - from);
+    }
+};
+
+
+/* Read-only, memory-mapped view of a trace file. All accessors return
+ * pointers into the mapping, which stay valid until the reader is closed.
+ */
+class TraceReader
+{
+  private:
+    void * map;
+    uint64_t map_size;
+    const trace_file_header_t * header;
+    const trace_task_t * task_records;
+    const trace_region_t * region_records;
+    const trace_edge_t * edge_records;
+    const uint32_t * hash;
+
+    // Whether count records of record_size bytes at offset lie inside the
+    // mapping
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t record_size) const {
+      return offset % 8 == 0 && offset <= map_size &&
+             count <= (map_size - offset) / record_size;
+    }
+
+    // Edges [first, first + n), or none if a corrupt record points outside
+    // the edge section
+    TraceRange<trace_edge_t> edge_range(uint64_t first, uint64_t n) const {
+      if (first > header->n_edges || n > header->n_edges - first) {
+        return TraceRange<trace_edge_t>(edge_records, 0);
+      }
+      return TraceRange<trace_edge_t>(edge_records + first, n);
+    }
+
+    uint32_t find_entry(uint64_t id) const {
+      const uint64_t mask = header->hash_capacity - 1;
+      uint64_t slot = trace_file_hash(id) & mask;
+      for (uint64_t probes = 0; probes < header->hash_capacity && hash[slot] != TRACE_FILE_NONE;
+           probes++) {
+        uint32_t entry = hash[slot];
+        uint64_t index = entry & ~TRACE_FILE_REGION_BIT;
+        if (index >= ((entry & TRACE_FILE_REGION_BIT) ? header->n_regions : header->n_tasks)) {
+          return TRACE_FILE_NONE;
+        }
+        uint64_t entry_id = (entry & TRACE_FILE_REGION_BIT) ?
+          region_records[index].id : task_records[index].id;
+        if (entry_id == id) {
+          return entry;
+        }
+        slot = (slot + 1) & mask;
+      }
+      return TRACE_FILE_NONE;
+    }
+
+  public:
+    TraceReader() : map(NULL), map_size(0), header(NULL) {}
+
+    explicit TraceReader(const std::string & path) : map(NULL), map_size(0), header(NULL) {
+      open(path);
+    }
+
+    ~TraceReader() {
+      close();
+    }
+
+    TraceReader(const TraceReader &) = delete;
+    TraceReader & operator=(const TraceReader &) = delete;
+
+    bool open(const std::string & path) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(trace_file_header_t)) {
+        ::close(fd);
+        return false;
+      }
+      map_size = st.st_size;
+      map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        map = NULL;
+        return false;
+      }
+      header = (const trace_file_header_t *) map;
+      // Check every section against the mapping, so that a truncated or
+      // corrupt trace is rejected here rather than read out of bounds
+      const uint64_t n_records = header->n_tasks + header->n_regions;
+      if (memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+          header->version != TRACE_FILE_VERSION ||
+          header->file_size > map_size ||
+          !section_fits(header->tasks_offset, header->n_tasks, sizeof(trace_task_t)) ||
+          !section_fits(header->regions_offset, header->n_regions, sizeof(trace_region_t)) ||
+          !section_fits(header->edges_offset, header->n_edges, sizeof(trace_edge_t)) ||
+          !section_fits(header->hash_offset, header->hash_capacity, sizeof(uint32_t)) ||
+          (header->hash_capacity & (header->hash_capacity - 1)) != 0 ||
+          n_records < header->n_tasks || header->hash_capacity <= n_records) {
+        close();
+        return false;
+      }
+      const char * base = (const char *) map;
+      task_records = (const trace_task_t *)(base + header->tasks_offset);
+      region_records = (const trace_region_t *)(base + header->regions_offset);
+      edge_records = (const trace_edge_t *)(base + header->edges_offset);
+      hash = (const uint32_t *)(base + header->hash_offset);
+      return true;
+    }
+
+    void close() {
+      if (map != NULL) {
+        munmap(map, map_size);
+      }
+      map = NULL;
+      map_size = 0;
+      header = NULL;
+    }
+
+    bool is_open() const {
+      return header != NULL;
+    }
+
+    // All tasks, in ID order
+    TraceRange<trace_task_t> tasks() const {
+      return TraceRange<trace_task_t>(task_records, header->n_tasks);
+    }
+
+    // All parallel regions, in ID order
+    TraceRange<trace_region_t> regions() const {
+      return TraceRange<trace_region_t>(region_records, header->n_regions);
+    }
+
+    // All edges, grouped by source
+    TraceRange<trace_edge_t> edges() const {
+      return TraceRange<trace_edge_t>(edge_records, header->n_edges);
+    }
+
+    TraceRange<trace_edge_t> out_edges(const trace_task_t & task) const {
+      return edge_range(task.first_edge, task.n_edges);
+    }
+
+    TraceRange<trace_edge_t> out_edges(const trace_region_t & region) const {
+      return edge_range(region.first_edge, region.n_edges);
+    }
+
+    // Task or region with the given ID, or NULL
+    const trace_task_t * find_task(uint64_t id) const {
+      uint32_t entry = find_entry(id);
+      if (entry == TRACE_FILE_NONE || (entry & TRACE_FILE_REGION_BIT)) {
+        return NULL;
+      }
+      return &task_records[entry];
+    }
+
+    const trace_region_t * find_region(uint64_t id) const {
+      uint32_t entry = find_entry(id);
+      if (entry == TRACE_FILE_NONE || !(entry & TRACE_FILE_REGION_BIT)) {
+        return NULL;
+      }
+      return &region_records[entry & ~TRACE_FILE_REGION_BIT];
+    }
+};
+
+
+/* Call f(record) for every record of range, split into contiguous chunks over
+ * n_threads threads (0 for one per hardware thread). f must be safe to call
+ * concurrently.
+ */
+template <typename T, typename F>
+static void trace_parallel_for(const TraceRange<T> & range, unsigned n_threads, F f)
+{
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const uint64_t n = range.size();
+  if (n_threads == 1 || n < n_threads) {
+    for (const T & record : range) {
+      f(record);
+    }
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < n_threads; t++) {
+    TraceRange<T> chunk = range.slice(n * t / n_threads, n * (t + 1) / n_threads);
+    threads.emplace_back([chunk, &f]() {
+      for (const T & record : chunk) {
+        f(record);
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+}
+
+/* Reduce range in parallel: each thread folds its chunk into a copy of init
+ * with fold(accumulator, record), and the partial results are merged in
+ * chunk order with combine(accumulator, partial).
+ */
+template <typename T, typename R, typename Fold, typename Combine>
+static R trace_parallel_reduce(const TraceRange<T> & range, unsigned n_threads,
+                               const R & init, Fold fold, Combine combine)
+{
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const uint64_t n = range.size();
+  if (n < n_threads) {
+    n_threads = 1;
+  }
+  std::vector<R> partials(n_threads, init);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < n_threads; t++) {
+    TraceRange<T> chunk = range.slice(n * t / n_threads, n * (t + 1) / n_threads);
+    R * partial = &partials[t];
+    auto work = [chunk, partial, &fold]() {
+      for (const T & record : chunk) {
+        fold(*partial, record);
+      }
+    };
+    if (n_threads == 1) {
+      work();
+    } else {
+      threads.emplace_back(work);
+    }
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  R result = init;
+  for (const R & partial : partials) {
+    combine(result, partial);
+  }
+  return result;
+}
+
+#endif // TRACE_FILE_H
@@ -0,0 +1,136 @@
+#ifndef TRACING_CONTROL_H
+#define TRACING_CONTROL_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "ompt.h"
+#include "OMPT_helpers.hpp"
+#include "Task.hpp"
+
+/******************************************************************************\
+ * Pausing and resuming collection at run time, so that only part of a long
+ * run is traced.
+ *
+ * Tree-mode callbacks test tracing_paused with one relaxed load and return
+ * straight away while it is set. Collection can be toggled with SIGUSR2,
+ * by writing "pause" or "resume" to the file named by TASK_TREE_CONTROL_FILE,
+ * or from the program with omp_control_tool(omp_control_tool_pause) and
+ * omp_control_tool(omp_control_tool_start). TASK_TREE_START_PAUSED=1 starts
+ * the run paused.
+ *
+ * Each resume opens a new window. Tasks and regions that begin while paused
+ * are not recorded, so their OMPT data stays empty. A task created in a window
+ * whose encountering task was not recorded is attached to its nearest
+ * recorded ancestor, found by walking up the runtime's task stack. Threads
+ * drop their per-task timing state the first time they see a new window,
+ * since the callbacks that would have kept it current were skipped.
+\******************************************************************************/
+
+static std::atomic<bool> tracing_paused{false};
+// Incremented by every resume
+static std::atomic<uint32_t> tracing_window{0};
+static std::atomic<bool> tracing_control_stop{false};
+
+static inline bool tracing_is_paused()
+{
+  return tracing_paused.load(std::memory_order_relaxed);
+}
+
+static inline uint32_t current_tracing_window()
+{
+  return tracing_window.load(std::memory_order_relaxed);
+}
+
+/* Both are async-signal-safe */
+static void pause_tracing()
+{
+  tracing_paused.store(true, std::memory_order_relaxed);
+}
+
+static void resume_tracing()
+{
+  if (tracing_paused.load(std::memory_order_relaxed)) {
+    tracing_window.fetch_add(1, std::memory_order_relaxed);
+    tracing_paused.store(false, std::memory_order_release);
+  }
+}
+
+static void toggle_tracing_handler(int signum)
+{
+  if (tracing_is_paused()) {
+    resume_tracing();
+  } else {
+    pause_tracing();
+  }
+}
+
+/* The innermost task on this thread's task stack that was recorded, or NULL.
+ * Level 0 is the encountering task itself.
+ */
+static Task * find_traced_ancestor()
+{
+  ompt_data_t * task_data = NULL;
+  for (int level = 0; ompt_get_task_info(level, NULL, &task_data, NULL, NULL, NULL) == 2; level++) {
+    if (task_data != NULL && task_data->ptr != NULL) {
+      return (Task *) task_data->ptr;
+    }
+  }
+  return NULL;
+}
+
+/* Poll the control file for "pause" or "resume", acting only when its
+ * contents change so that the signal and omp_control_tool still work
+ */
+static void watch_control_file(std::string path, uint64_t interval_ms)
+{
+  std::string last;
+  while (!tracing_control_stop.load(std::memory_order_relaxed)) {
+    FILE * file = fopen(path.c_str(), "r");
+    if (file != NULL) {
+      char command[16] = {0};
+      if (fscanf(file, "%15s", command) == 1 && last != command) {
+        last = command;
+        if (strcmp(command, "pause") == 0) {
+          pause_tracing();
+        } else if (strcmp(command, "resume") == 0) {
+          resume_tracing();
+        }
+      }
+      fclose(file);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+}
+
+/* Read the tracing controls from the environment */
+static void configure_tracing_control()
+{
+  char * start_paused = getenv("TASK_TREE_START_PAUSED");
+  if (start_paused != NULL && strcmp(start_paused, "0") != 0) {
+    pause_tracing();
+  }
+  char * control_file = getenv("TASK_TREE_CONTROL_FILE");
+  if (control_file != NULL) {
+    char * interval = getenv("TASK_TREE_CONTROL_INTERVAL");
+    std::thread watcher(watch_control_file, std::string(control_file),
+                        interval ? strtoull(interval, NULL, 10) : 100);
+    watcher.detach();
+  }
+}
+
+/* Stop reacting to controls; the outputs are about to be written */
+static void stop_tracing_control()
+{
+  tracing_control_stop.store(true, std::memory_order_relaxed);
+  pause_tracing();
+}
+
+#endif // TRACING_CONTROL_H
@@ -17,7 +17,8 @@ template <class vertex_id_map,
           class shape_map,
           class status_map,
           class codeptr_ra_map,
-          class dependences_map
+          class dependences_map,
+          class locks_map
          >
 class vertex_writer
 {
@@ -28,14 +29,16 @@ class vertex_writer
                   shape_map s_m,
                   status_map stat_m,
                   codeptr_ra_map cra_m,
-                  dependences_map dep_m
+                  dependences_map dep_m,
+                  locks_map lock_m
                  ) : vid_m(vid_m), 
                      vtype_m(vtype_m),
                      c_m(c_m),
                      s_m(s_m),
                      stat_m(stat_m),
                      cra_m(cra_m),
-                     dep_m(dep_m)
+                     dep_m(dep_m),
+                     lock_m(lock_m)
                  {}
     template <class vertex>
     void operator() (std::ostream &out,
@@ -53,6 +56,11 @@ class vertex_writer
           << "codeptr_ra: "
           << cra_m[v]
           << "\n";
+      for (auto & lock : lock_m[v]) {
+        out << "Lock "
+            << lock
+            << "\n";
+      }
       if (dep_m[v].size() > 0) {
         out << "Deps: ";
         for (auto dep : dep_m[v]) {
@@ -75,6 +83,7 @@ class vertex_writer
     status_map stat_m;
     codeptr_ra_map cra_m; 
     dependences_map dep_m; 
+    locks_map lock_m;
 };
 
 
@@ -85,7 +94,8 @@ template <class vertex_id_map,
           class shape_map,
           class status_map,
           class codeptr_ra_map,
-          class dependences_map
+          class dependences_map,
+          class locks_map
          >
 inline vertex_writer<vertex_id_map, 
                      vertex_type_map,
@@ -93,7 +103,8 @@ inline vertex_writer<vertex_id_map,
                      shape_map,
                      status_map,
                      codeptr_ra_map,
-                     dependences_map
+                     dependences_map,
+                     locks_map
                     >
 make_vertex_writer(vertex_id_map vid_m, 
                    vertex_type_map vtype_m,
@@ -101,7 +112,8 @@ make_vertex_writer(vertex_id_map vid_m,
                    shape_map s_m,
                    status_map stat_m,
                    codeptr_ra_map cra_m,
-                   dependences_map dep_m
+                   dependences_map dep_m,
+                   locks_map lock_m
                   )
 {
   return vertex_writer<vertex_id_map, 
@@ -110,22 +122,55 @@ make_vertex_writer(vertex_id_map vid_m,
                        shape_map,
                        status_map,
                        codeptr_ra_map,
-                       dependences_map
+                       dependences_map,
+                       locks_map
                       >(vid_m, 
                         vtype_m,
                         c_m, 
                         s_m,
                         stat_m,
                         cra_m,
-                        dep_m
+                        dep_m,
+                        lock_m
                        ); 
 }
 
 
+enum class VertexType {ExplicitTask, ImplicitTask, ParallelRegion,
+                       Barrier, Taskwait, Taskgroup, Worksharing}; 
+
+// Ancestry edges go from a creator to what it created. Join edges go from a
+// task to the sync point (taskwait, taskgroup or barrier) that joined it.
+// Dependence edges go from a task to a sibling that depends on it.
+enum class EdgeType {Ancestry, Join, Dependence};
 
+/* Draws join and dependence edges distinctly so the ancestry tree stands out */
+template <class edge_type_map>
+class edge_writer
+{
+  public:
+    edge_writer(edge_type_map etype_m) : etype_m(etype_m) {}
+    template <class edge>
+    void operator() (std::ostream &out,
+                     const edge& e) const 
+    {
+      if (etype_m[e] == EdgeType::Join) {
+        out << "[style=dashed]";
+      } else if (etype_m[e] == EdgeType::Dependence) {
+        out << "[style=dotted, color=blue]";
+      }
+    }
+  private:
+    edge_type_map etype_m;
+};
 
+template <class edge_type_map>
+inline edge_writer<edge_type_map>
+make_edge_writer(edge_type_map etype_m)
+{
+  return edge_writer<edge_type_map>(etype_m);
+}
 
-enum class VertexType {ExplicitTask, ImplicitTask, ParallelRegion}; 
 
 // A vertex represents a task.
 // A task can either be implicit, such as when an "omp parallel" directive
@@ -139,9 +184,16 @@ typedef struct vertex_properties {
   std::string status;
   std::string codeptr_ra;
   std::vector<std::string> dependences; 
+  // Lock contention of a task or region, one entry per lock call site
+  std::vector<std::string> locks;
+  VertexType type;
+  const void * codeptr;
+  // Structural hash of the subtree rooted here, see SubtreeHash.hpp
+  uint64_t subtree_hash;
 } vprops_t;
 
 struct edge_properties {
+  EdgeType edge_type = EdgeType::Ancestry;
 };
 
 struct dag_properties {
@@ -207,6 +259,38 @@ const vprops_t construct_vprops(VertexType vtype,
       status = "Created";
       break;
     }
+    case VertexType::Barrier:
+    {
+      vtype_label = "Barrier";
+      color = "lightblue";
+      shape = "diamond";
+      status = "Joined";
+      break;
+    }
+    case VertexType::Taskwait:
+    {
+      vtype_label = "Taskwait";
+      color = "lightblue";
+      shape = "diamond";
+      status = "Joined";
+      break;
+    }
+    case VertexType::Taskgroup:
+    {
+      vtype_label = "Taskgroup";
+      color = "lightblue";
+      shape = "diamond";
+      status = "Joined";
+      break;
+    }
+    case VertexType::Worksharing:
+    {
+      vtype_label = "Worksharing";
+      color = "palegreen";
+      shape = "hexagon";
+      status = "Completed";
+      break;
+    }
   }
   
   // Convert codeptr_ra to string
@@ -215,12 +299,15 @@ const vprops_t construct_vprops(VertexType vtype,
   std::string codeptr_ra_str(oss.str());
 
   // Construct vertex properties struct
-  const vprops_t vp = {omp_entity_id,
-                       vtype_label,
-                       color,
-                       shape,
-                       status,
-                       codeptr_ra_str};
+  vprops_t vp = {omp_entity_id,
+                 vtype_label,
+                 color,
+                 shape,
+                 status,
+                 codeptr_ra_str};
+  vp.type = vtype;
+  vp.codeptr = codeptr_ra;
+  vp.subtree_hash = 0;
   return vp; 
 }
 
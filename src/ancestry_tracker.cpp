@@ -1,6 +1,8 @@
 #include <iostream>
 #include <vector> 
 #include <unordered_map>
+#include <map>
+#include <set>
 //#include <memory> // make_unique
 #include <csignal> // Need signal handling to dump tree on interrupt
 #include <inttypes.h>
@@ -16,22 +18,55 @@
 #define BUILD_TREE_ON_FINALIZE
 #define PRINT_SUMMARY_TASK_REGIONS 
 #define PRINT_SUMMARY_PARALLEL_REGIONS
+#define WRITE_ANCESTRY_INDEX
+#define WRITE_TRACE_FILE
+#define WRITE_SUBTREE_HASHES
+#define WRITE_GRAPH_FILE
+#define PRINT_SUMMARY_SYNC_REGIONS
+#define PRINT_SUMMARY_LOOPS
+#define PRINT_SUMMARY_LOCKS
+#define PRINT_SUMMARY_THREADS
+#define PRINT_SUMMARY_REGION_PROFILE
+#define PRINT_SUMMARY_MEMORY
+#define PRINT_SUMMARY_NUMA
+//#define RECORD_CALLBACKS
+// Chunk-level loop tracking; needs a runtime with ompt_callback_dispatch
+//#define TRACK_LOOP_DISPATCH
 
 #include "OMPT_helpers.hpp" 
 
 
+#include "Timing.hpp"
 #include "ToolData.hpp" 
 #include "Task.hpp" 
 #include "Tree.hpp"
+#include "AncestryIndex.hpp"
+#include "TraceFile.hpp"
+#include "GraphFile.hpp"
+#include "BlockCompression.hpp"
+#include "OutputNaming.hpp"
+#include "FilteredExport.hpp"
+#include "CompressedTree.hpp"
 
 
 
 static tool_data_t* tool_data_ptr;
 
+#ifdef RECORD_CALLBACKS
+#include "callback_recording.hpp"
+#endif
 
 #include "implicit_task_callbacks.hpp"
 #include "explicit_task_creation.hpp" 
 #include "parallel_region_callbacks.hpp" 
+#include "sync_region_callbacks.hpp"
+#include "task_schedule_callbacks.hpp"
+#include "task_dependences_callbacks.hpp"
+#include "control_tool_callbacks.hpp"
+#include "work_callbacks.hpp"
+#include "mutex_callbacks.hpp"
+#include "counters_callbacks.hpp"
+#include "granularity_callbacks.hpp"
 
 void add_parallel_region_vertex(ParallelRegion * pr) {
   // Synchronize access to the tree and the id_to_vertex map
@@ -59,7 +94,10 @@ void add_task_vertex(Task * t) {
   } else {
     vt = VertexType::ImplicitTask;
   }
-  const auto vp = construct_vprops(vt, t->get_id(), t->get_codeptr_ra());
+  auto vp = construct_vprops(vt, t->get_id(), t->get_codeptr_ra());
+  for (Task * producer : t->get_dependency_parents()) {
+    vp.dependences.push_back(std::to_string(producer->get_id()));
+  }
   // Add a new vertex to the tree
   const vertex_t v = boost::add_vertex(vp, tool_data_ptr->tree);
   // Update the id_to_vertex map
@@ -124,24 +162,484 @@ void add_edges(tool_data_t * tool_data) {
 } 
 
 
+vertex_t add_sync_region_vertex(const sync_event_t & event, const std::string & status) {
+  VertexType vt;
+  if (event.kind == ompt_sync_region_barrier) {
+    vt = VertexType::Barrier;
+  } else if (event.kind == ompt_sync_region_taskwait) {
+    vt = VertexType::Taskwait;
+  } else {
+    vt = VertexType::Taskgroup;
+  }
+  auto vp = construct_vprops(vt, event.id, event.codeptr_ra);
+  vp.status = status;
+  const vertex_t v = boost::add_vertex(vp, tool_data_ptr->tree);
+  tool_data_ptr->id_to_vertex.insert( {event.id, v} );
+  return v;
+}
+
+void add_join_edge(vertex_t from, vertex_t to) {
+  edge_properties ep;
+  ep.edge_type = EdgeType::Join;
+  boost::add_edge(from, to, ep, tool_data_ptr->tree);
+}
+
+/* Add a join vertex for every sync point. Taskwaits and taskgroups hang off
+ * the encountering task and are joined by the children they waited for. All
+ * threads' events for the same barrier instance are merged into one vertex
+ * that hangs off the parallel region and is joined by its implicit tasks.
+ */
+void add_sync_regions(tool_data_t * tool_data) {
+  boost::lock_guard<boost::mutex> tree_lock(tool_data->tree_mtx);
+  boost::lock_guard<boost::mutex> map_lock(tool_data->id_to_vertex_mtx);
+  auto id_to_vertex = &(tool_data->id_to_vertex);
+
+  // Explicit task vertices by (creator ID, index among its children)
+  typedef std::pair<uint64_t, uint32_t> child_key_t;
+  std::unordered_map<child_key_t, vertex_t, boost::hash<child_key_t> > child_to_vertex;
+  for (auto e : tool_data->id_to_task) {
+    Task * t = e.second;
+    auto search = id_to_vertex->find(t->get_id());
+    if (t->get_type() == TaskType::Explicit && !t->is_initial() &&
+        search != id_to_vertex->end()) {
+      child_to_vertex.insert( {child_key_t(t->get_parent_id(), t->get_child_index()),
+                               search->second} );
+    }
+  }
+
+  // Barrier events of all threads, grouped by instance
+  typedef std::pair<uint64_t, uint32_t> barrier_key_t;
+  std::map<barrier_key_t, std::vector<const sync_event_t *> > barriers;
+
+  for (auto td : tool_data->threads) {
+    for (const sync_event_t & event : td->sync_events) {
+      if (event.kind == ompt_sync_region_barrier && event.parallel_id != 0) {
+        barriers[barrier_key_t(event.parallel_id, event.instance)].push_back(&event);
+        continue;
+      }
+      auto task_search = id_to_vertex->find(event.task_id);
+      if (task_search == id_to_vertex->end()) {
+        continue;
+      }
+      const vertex_t v = add_sync_region_vertex(event,
+        "Waited " + std::to_string(event.wait_time) + " ns");
+      boost::add_edge(task_search->second, v, tool_data->tree);
+      if (event.kind == ompt_sync_region_barrier) {
+        continue;
+      }
+      for (uint32_t i = event.join_begin; i < event.join_end; i++) {
+        auto child_search = child_to_vertex.find(child_key_t(event.task_id, i));
+        if (child_search != child_to_vertex.end()) {
+          add_join_edge(child_search->second, v);
+        }
+      }
+    }
+  }
+
+  for (auto & b : barriers) {
+    uint64_t wait_time = 0;
+    for (auto event : b.second) {
+      wait_time += event->wait_time;
+    }
+    const vertex_t v = add_sync_region_vertex(*b.second.front(),
+      "Waited " + std::to_string(wait_time) + " ns over " +
+      std::to_string(b.second.size()) + " threads");
+    auto region_search = id_to_vertex->find(b.first.first);
+    if (region_search != id_to_vertex->end()) {
+      boost::add_edge(region_search->second, v, tool_data->tree);
+    }
+    for (auto event : b.second) {
+      auto task_search = id_to_vertex->find(event->task_id);
+      if (task_search != id_to_vertex->end()) {
+        add_join_edge(task_search->second, v);
+      }
+    }
+  }
+}
+
+/* Add a vertex for every thread's share of every worksharing construct, as a
+ * child of the implicit task that encountered it
+ */
+void add_worksharing(tool_data_t * tool_data) {
+  boost::lock_guard<boost::mutex> tree_lock(tool_data->tree_mtx);
+  boost::lock_guard<boost::mutex> map_lock(tool_data->id_to_vertex_mtx);
+  auto id_to_vertex = &(tool_data->id_to_vertex);
+  for (auto td : tool_data->threads) {
+    for (const loop_event_t & event : td->loop_events) {
+      auto task_search = id_to_vertex->find(event.task_id);
+      if (task_search == id_to_vertex->end()) {
+        continue;
+      }
+      auto vp = construct_vprops(VertexType::Worksharing, event.id, event.codeptr_ra);
+      vp.vertex_type = worksharing_name(event.wstype);
+      uint64_t time = event.end_time > event.begin_time ? event.end_time - event.begin_time : 0;
+      vp.status = "Time " + std::to_string(time) + " ns, count " + std::to_string(event.count);
+      if (event.chunks > 0) {
+        vp.status += ", " + std::to_string(event.chunks) + " chunks";
+      }
+      const vertex_t v = boost::add_vertex(vp, tool_data->tree);
+      id_to_vertex->insert( {event.id, v} );
+      boost::add_edge(task_search->second, v, tool_data->tree);
+    }
+  }
+}
+
+/* Lock acquisitions from one call site, summed over mutex records */
+typedef std::pair<int, const void *> lock_site_t;
+typedef struct lock_totals {
+  uint64_t acquisitions;
+  uint64_t wait_time;
+  uint64_t max_wait;
+  uint64_t hold_time;
+} lock_totals_t;
+
+static void add_lock_record(lock_totals_t & totals, const mutex_record_t & record)
+{
+  totals.acquisitions += record.acquisitions;
+  totals.wait_time += record.wait_time;
+  totals.max_wait = record.max_wait > totals.max_wait ? record.max_wait : totals.max_wait;
+  totals.hold_time += record.hold_time;
+}
+
+/* Attach each task's lock contention, and that of the tasks bound to each
+ * parallel region, to their vertices: one line per lock call site, the
+ * sites with the longest waits first
+ */
+void add_lock_contention(tool_data_t * tool_data) {
+  std::unordered_map<uint64_t, std::map<lock_site_t, lock_totals_t>> contention;
+  for (auto td : tool_data->threads) {
+    for (const mutex_record_t & record : td->mutex_records) {
+      if (record.acquisitions == 0) {
+        continue;
+      }
+      lock_site_t site(record.kind, record.codeptr_ra);
+      add_lock_record(contention[record.task_id][site], record);
+      if (record.region_id != 0) {
+        add_lock_record(contention[record.region_id][site], record);
+      }
+    }
+  }
+  boost::lock_guard<boost::mutex> tree_lock(tool_data->tree_mtx);
+  boost::lock_guard<boost::mutex> map_lock(tool_data->id_to_vertex_mtx);
+  for (auto & e : contention) {
+    auto search = tool_data->id_to_vertex.find(e.first);
+    if (search == tool_data->id_to_vertex.end()) {
+      continue;
+    }
+    std::vector<std::pair<lock_site_t, lock_totals_t>> sites(e.second.begin(), e.second.end());
+    std::sort(sites.begin(), sites.end(), [](const std::pair<lock_site_t, lock_totals_t> & a,
+                                             const std::pair<lock_site_t, lock_totals_t> & b) {
+      return a.second.wait_time > b.second.wait_time;
+    });
+    std::vector<std::string> & locks = tool_data->tree[search->second].locks;
+    for (auto & site : sites) {
+      char line[160];
+      snprintf(line, sizeof(line), "%s %p: %" PRIu64 " acquired, wait %" PRIu64
+               " ns (max %" PRIu64 "), hold %" PRIu64 " ns", mutex_kind_name(site.first.first),
+               site.first.second, site.second.acquisitions, site.second.wait_time,
+               site.second.max_wait, site.second.hold_time);
+      locks.push_back(line);
+    }
+  }
+}
+
+/* Lock contention per call site, over all tasks, the longest waits first */
+void print_lock_summary(tool_data_t * tool_data) {
+  struct site_stats { lock_totals_t totals; std::set<uint64_t> tasks; };
+  std::map<lock_site_t, site_stats> sites;
+  for (auto td : tool_data->threads) {
+    for (const mutex_record_t & record : td->mutex_records) {
+      if (record.acquisitions == 0) {
+        continue;
+      }
+      site_stats & s = sites[lock_site_t(record.kind, record.codeptr_ra)];
+      add_lock_record(s.totals, record);
+      s.tasks.insert(record.task_id);
+    }
+  }
+  std::vector<std::pair<lock_site_t, site_stats *>> order;
+  for (auto & e : sites) {
+    order.push_back( {e.first, &e.second} );
+  }
+  std::sort(order.begin(), order.end(), [](const std::pair<lock_site_t, site_stats *> & a,
+                                           const std::pair<lock_site_t, site_stats *> & b) {
+    return a.second->totals.wait_time > b.second->totals.wait_time;
+  });
+  for (auto & e : order) {
+    const lock_totals_t & t = e.second->totals;
+    printf("  %s at %p: acquired=%" PRIu64 " by %zu tasks, wait=%" PRIu64
+           " ns (avg %.0f, max %" PRIu64 "), hold=%" PRIu64 " ns\n",
+           mutex_kind_name(e.first.first), e.first.second, t.acquisitions,
+           e.second->tasks.size(), t.wait_time, (double) t.wait_time / t.acquisitions,
+           t.max_wait, t.hold_time);
+  }
+}
+
+/* Load imbalance of worksharing constructs per call site. The threads'
+ * shares of each construct instance are matched by region and instance;
+ * the instance's imbalance is its slowest thread's time over the mean time.
+ */
+void print_loop_summary(tool_data_t * tool_data) {
+  typedef std::pair<uint64_t, uint64_t> instance_key_t;
+  struct instance_stats { const loop_event_t * event; uint64_t threads; uint64_t total_time;
+                          uint64_t max_time; uint64_t chunks; uint64_t max_chunks; };
+  std::map<instance_key_t, instance_stats> instances;
+  for (auto td : tool_data->threads) {
+    for (const loop_event_t & event : td->loop_events) {
+      instance_stats & s = instances[instance_key_t(event.region_id, event.instance)];
+      uint64_t time = event.end_time > event.begin_time ? event.end_time - event.begin_time : 0;
+      s.event = &event;
+      s.threads++;
+      s.total_time += time;
+      s.max_time = time > s.max_time ? time : s.max_time;
+      s.chunks += event.chunks;
+      s.max_chunks = event.chunks > s.max_chunks ? event.chunks : s.max_chunks;
+    }
+  }
+  typedef std::pair<int, const void *> site_t;
+  struct site_stats { uint64_t instances; uint64_t threads; uint64_t time; uint64_t chunks;
+                      double imbalance; double max_imbalance; };
+  std::map<site_t, site_stats> sites;
+  for (auto & e : instances) {
+    const instance_stats & s = e.second;
+    site_stats & site = sites[site_t(s.event->wstype, s.event->codeptr_ra)];
+    double mean = (double) s.total_time / s.threads;
+    double imbalance = mean > 0 ? s.max_time / mean : 1.0;
+    site.instances++;
+    site.threads += s.threads;
+    site.time += s.max_time;
+    site.chunks += s.chunks;
+    site.imbalance += imbalance;
+    site.max_imbalance = imbalance > site.max_imbalance ? imbalance : site.max_imbalance;
+  }
+  for (auto & e : sites) {
+    const site_stats & s = e.second;
+    printf("  %s at %p: count=%" PRIu64 ", avg threads=%.1f, time=%" PRIu64
+           " ns, imbalance (max/mean) avg=%.2f max=%.2f", worksharing_name(e.first.first),
+           e.first.second, s.instances, (double) s.threads / s.instances, s.time,
+           s.imbalance / s.instances, s.max_imbalance);
+    if (s.chunks > 0) {
+      printf(", chunks=%" PRIu64, s.chunks);
+    }
+    printf("\n");
+  }
+}
+
+/* For every parallel region, print how many tasks each thread created,
+ * executed and stole, a histogram of tasks executed per thread, and each
+ * thread's busy time in the region
+ */
+void print_thread_summary(tool_data_t * tool_data) {
+  typedef std::pair<uint32_t, thread_region_stats_t> thread_stats_t;
+  std::map<uint64_t, std::vector<thread_stats_t> > regions;
+  uint64_t dependences = 0, dependence_edges = 0;
+  for (auto td : tool_data->threads) {
+    dependences += td->dependences_resolved;
+    dependence_edges += td->dependence_edges;
+    for (auto & e : td->region_stats) {
+      regions[e.first].push_back(thread_stats_t(td->index, e.second));
+    }
+  }
+  printf("  %" PRIu64 " dependences resolved into %" PRIu64 " edges\n",
+         dependences, dependence_edges);
+  const int histogram_width = 40;
+  for (auto & r : regions) {
+    uint64_t executed = 0, stolen = 0, max_executed = 0;
+    for (auto & t : r.second) {
+      executed += t.second.tasks_executed;
+      stolen += t.second.tasks_stolen;
+      if (t.second.tasks_executed > max_executed) {
+        max_executed = t.second.tasks_executed;
+      }
+    }
+    printf("  Region %" PRIu64 ": %" PRIu64 " explicit tasks executed, %" PRIu64
+           " stolen (%.1f%%)\n", r.first, executed, stolen,
+           executed ? 100.0 * stolen / executed : 0.0);
+    for (auto & t : r.second) {
+      const thread_region_stats_t & s = t.second;
+      int bar = max_executed ? (int)(histogram_width * s.tasks_executed / max_executed) : 0;
+      printf("    thread %3u (team thread %3d): created=%" PRIu64 " executed=%" PRIu64
+             " stolen=%" PRIu64 " (%.1f%%) busy=%" PRIu64 " ns |%.*s\n",
+             t.first, s.thread_num, s.tasks_created, s.tasks_executed, s.tasks_stolen,
+             s.tasks_executed ? 100.0 * s.tasks_stolen / s.tasks_executed : 0.0,
+             s.busy_time, bar, "########################################");
+    }
+  }
+}
+
+
+/* Per thread: the NUMA node its arena is on and how many of the task and
+ * region objects it touched were on another node
+ */
+void print_numa_summary(tool_data_t * tool_data) {
+  uint64_t local = 0, remote = 0;
+  for (auto td : tool_data->threads) {
+    uint64_t accesses = td->local_accesses + td->remote_accesses;
+    printf("  thread %3u: node %d, %" PRIu64 " chunks, accesses local=%" PRIu64
+           " remote=%" PRIu64 " (%.1f%% remote)\n", td->index, td->numa_node,
+           td->arena->get_num_chunks(), td->local_accesses, td->remote_accesses,
+           accesses ? 100.0 * td->remote_accesses / accesses : 0.0);
+    local += td->local_accesses;
+    remote += td->remote_accesses;
+  }
+  printf("  total: accesses local=%" PRIu64 " remote=%" PRIu64 " (%.1f%% remote)\n",
+         local, remote, local + remote ? 100.0 * remote / (local + remote) : 0.0);
+}
+
+/* Aggregate parallel region lifetimes per call site: how often the region
+ * ran, its total/min/max duration, fork/join overhead, team size and nesting
+ */
+void print_region_profile(tool_data_t * tool_data) {
+  struct region_profile {
+    uint64_t count;
+    uint64_t total_time;
+    uint64_t min_time;
+    uint64_t max_time;
+    uint64_t fork_overhead;
+    uint64_t join_overhead;
+    uint64_t team_size;
+    uint32_t max_nesting_level;
+  };
+  std::map<const void *, region_profile> profiles;
+  for (auto e : tool_data->id_to_parallel_region) {
+    ParallelRegion * pr = e.second;
+    auto insert_result = profiles.insert( {pr->get_codeptr_ra(), region_profile()} );
+    region_profile & p = insert_result.first->second;
+    if (insert_result.second) {
+      memset(&p, 0, sizeof(p));
+      p.min_time = UINT64_MAX;
+    }
+    uint64_t duration = pr->get_duration();
+    p.count++;
+    p.total_time += duration;
+    p.min_time = duration < p.min_time ? duration : p.min_time;
+    p.max_time = duration > p.max_time ? duration : p.max_time;
+    p.fork_overhead += pr->get_fork_overhead();
+    p.join_overhead += pr->get_join_overhead();
+    p.team_size += pr->get_team_size();
+    if (pr->get_nesting_level() > p.max_nesting_level) {
+      p.max_nesting_level = pr->get_nesting_level();
+    }
+  }
+  for (auto & e : profiles) {
+    const region_profile & p = e.second;
+    printf("  Region at %p: count=%" PRIu64 ", total=%" PRIu64 " ns, min=%" PRIu64
+           " ns, max=%" PRIu64 " ns, avg fork=%" PRIu64 " ns, avg join=%" PRIu64
+           " ns, avg team size=%.1f, max nesting=%u\n",
+           e.first, p.count, p.total_time, p.min_time, p.max_time,
+           p.fork_overhead / p.count, p.join_overhead / p.count,
+           (double) p.team_size / p.count, p.max_nesting_level);
+  }
+}
+
+
+/* Add an edge from every task to each sibling that depends on it */
+void add_dependence_edges(tool_data_t * tool_data) {
+  auto id_to_vertex = &(tool_data->id_to_vertex);
+  for (auto e : tool_data->id_to_task) {
+    Task * t = e.second;
+    auto consumer_search = id_to_vertex->find(t->get_id());
+    if (consumer_search == id_to_vertex->end()) {
+      continue;
+    }
+    for (Task * producer : t->get_dependency_parents()) {
+      auto producer_search = id_to_vertex->find(producer->get_id());
+      if (producer_search != id_to_vertex->end()) {
+        edge_properties ep;
+        ep.edge_type = EdgeType::Dependence;
+        boost::add_edge(producer_search->second, consumer_search->second, ep,
+                        tool_data->tree);
+      }
+    }
+  }
+}
+
+/* Hash every subtree of the tree over vertex types, call sites and child
+ * hashes
+ */
+void hash_tree(tool_data_t * tool_data) {
+  tree_t & tree = tool_data->tree;
+  const uint32_t n = boost::num_vertices(tree);
+  std::vector<subtree_hash_vertex_t> & vertices = tool_data->tree_hashes;
+  std::vector<uint32_t> parents(n, SUBTREE_HASH_NONE);
+  vertices.assign(n, subtree_hash_vertex_t());
+  for (uint32_t v = 0; v < n; v++) {
+    std::pair<uint32_t, uint64_t> site = tool_data->call_sites.lookup(tree[v].codeptr);
+    vertices[v].id = tree[v].vertex_id;
+    vertices[v].type = (uint32_t) tree[v].type;
+    vertices[v].module = site.first;
+    vertices[v].offset = site.second;
+    vertices[v].site_hash = site_hash(vertices[v].type,
+                                      tool_data->call_sites.get_modules()[site.first],
+                                      site.second);
+  }
+  boost::graph_traits<tree_t>::edge_iterator ei, ei_end;
+  for (boost::tie(ei, ei_end) = boost::edges(tree); ei != ei_end; ++ei) {
+    if (tree[*ei].edge_type == EdgeType::Ancestry) {
+      parents[boost::target(*ei, tree)] = boost::source(*ei, tree);
+    }
+  }
+  compute_subtree_hashes(vertices, parents, tool_data->tree_hash_children,
+                         tool_data->tree_hash_roots);
+  for (uint32_t v = 0; v < n; v++) {
+    tree[v].subtree_hash = vertices[v].subtree_hash;
+  }
+}
+
 void build_tree(tool_data_t * tool_data) {
   add_vertices(tool_data);
   add_edges(tool_data); 
+  add_sync_regions(tool_data);
+  add_worksharing(tool_data);
+  add_lock_contention(tool_data);
+  add_dependence_edges(tool_data);
+  hash_tree(tool_data);
+}
+
+/* Print time spent in each kind of sync region per call site */
+void print_sync_region_summary(tool_data_t * tool_data) {
+  typedef std::pair<int, const void *> site_t;
+  struct sync_stats { uint64_t count; uint64_t time; uint64_t wait_time; uint64_t max_wait_time; };
+  std::map<site_t, sync_stats> stats;
+  for (auto td : tool_data->threads) {
+    for (const sync_event_t & event : td->sync_events) {
+      sync_stats & s = stats[site_t(event.kind, event.codeptr_ra)];
+      s.count++;
+      s.time += event.end_time > event.begin_time ? event.end_time - event.begin_time : 0;
+      s.wait_time += event.wait_time;
+      if (event.wait_time > s.max_wait_time) {
+        s.max_wait_time = event.wait_time;
+      }
+    }
+  }
+  static const char * kind_names[] = {NULL, "Barrier", "Taskwait", "Taskgroup"};
+  for (auto & e : stats) {
+    const char * name = e.first.first >= 1 && e.first.first <= 3 ? kind_names[e.first.first] : "Sync";
+    printf("  %s at %p: count=%" PRIu64 ", time=%" PRIu64 " ns, wait=%" PRIu64
+           " ns, max wait=%" PRIu64 " ns\n", name, e.first.second, e.second.count,
+           e.second.time, e.second.wait_time, e.second.max_wait_time);
+  }
+}
+
+/* Outputs are block-compressed when the tool was built with a codec, unless
+ * TASK_TREE_COMPRESS=0
+ */
+bool compress_outputs() {
+  char * env_var = getenv("TASK_TREE_COMPRESS");
+  if (env_var != NULL && strcmp(env_var, "0") == 0) {
+    return false;
+  }
+  return block_compression_available();
 }
 
 void write_tree(tree_t tree) {
   // Get dotfile name for task tree visualization from environment
-  char * env_var;
-  std::string tree_dotfile;
-  env_var = getenv("TASK_TREE_DOTFILE");
-  if (env_var == NULL) {
+  if (getenv("TASK_TREE_DOTFILE") == NULL) {
     printf("TASK_TREE_DOTFILE not specified\n");
-    tree_dotfile = "./tree.dot"; 
-  } else {
-    tree_dotfile = env_var;
   }
+  std::string tree_dotfile = get_output_path("TASK_TREE_DOTFILE", "./tree.dot");
   // Open the stream to the dotfile for the task ancestry tree
-  std::ofstream out(tree_dotfile);
+  ToolOutputStream out(tree_dotfile, compress_outputs());
   // Construct custom vertex writer
   auto tree_vw = make_vertex_writer(
     boost::get(&vertex_properties::vertex_id, tree),
@@ -150,11 +648,610 @@ void write_tree(tree_t tree) {
     boost::get(&vertex_properties::shape, tree),
     boost::get(&vertex_properties::status, tree),
     boost::get(&vertex_properties::codeptr_ra, tree),
-    boost::get(&vertex_properties::dependences, tree)
+    boost::get(&vertex_properties::dependences, tree),
+    boost::get(&vertex_properties::locks, tree)
   );
+  auto tree_ew = make_edge_writer(boost::get(&edge_properties::edge_type, tree));
   // Write out the task ancestry tree 
-  boost::write_graphviz(out, tree, tree_vw); 
+  boost::write_graphviz(out, tree, tree_vw, tree_ew); 
+
+}
+
+void write_index(const tree_t & tree) {
+  // Get filename for the ancestry query index from environment
+  std::string index_file = get_output_path("TASK_TREE_INDEXFILE", "./tree.idx");
+  // Flatten the tree into an ID and a parent index per vertex
+  const uint32_t n = boost::num_vertices(tree);
+  std::vector<uint64_t> ids(n);
+  std::vector<uint32_t> parents(n, ANCESTRY_INDEX_NONE);
+  for (uint32_t v = 0; v < n; v++) {
+    ids[v] = tree[v].vertex_id;
+  }
+  boost::graph_traits<tree_t>::edge_iterator ei, ei_end;
+  for (boost::tie(ei, ei_end) = boost::edges(tree); ei != ei_end; ++ei) {
+    if (tree[*ei].edge_type == EdgeType::Ancestry) {
+      parents[boost::target(*ei, tree)] = boost::source(*ei, tree);
+    }
+  }
+  write_ancestry_index_file(index_file, ids, parents);
+}
+
+/* TASK_TREE_SHAPES=1 writes the DOT file in hash-consed form, with one node
+ * per distinct subtree shape
+ */
+bool write_shapes() {
+  char * env_var = getenv("TASK_TREE_SHAPES");
+  return env_var != NULL && strcmp(env_var, "1") == 0;
+}
+
+/* A vertex of the tree as the compressed tree is built from the records:
+ * its parent's ID is 0 for a root
+ */
+typedef struct shape_vertex {
+  uint64_t id;
+  uint64_t parent_id;
+  const void * codeptr_ra;
+  uint32_t type;
+  uint32_t depth;
+} shape_vertex_t;
+
+/* Hash-cons the tree straight from the task, region, sync region and
+ * worksharing records, with the same vertices build_tree would add. Every
+ * record's depth is one more than its parent's, so walking the vertices
+ * deepest first adds every vertex after its children. (IDs do not give that
+ * order: the runtime hands them out from per-thread blocks.) Only the shapes
+ * of the children of vertices not yet added are held on top of one sort
+ * entry per vertex.
+ */
+void build_compressed_tree(tool_data_t * tool_data, CompressedTree & compressed) {
+  auto is_vertex = [&](uint64_t id) {
+    return tool_data->id_to_task.count(id) != 0 ||
+           tool_data->id_to_parallel_region.count(id) != 0;
+  };
+  std::vector<shape_vertex_t> vertices;
+  vertices.reserve(tool_data->id_to_task.size() + tool_data->id_to_parallel_region.size());
+  for (auto e : tool_data->id_to_parallel_region) {
+    ParallelRegion * pr = e.second;
+    uint64_t parent_id = is_vertex(pr->get_parent_id()) ? pr->get_parent_id() : 0;
+    vertices.push_back( {pr->get_id(), parent_id, pr->get_codeptr_ra(),
+                         (uint32_t) VertexType::ParallelRegion, pr->get_depth()} );
+  }
+  for (auto e : tool_data->id_to_task) {
+    Task * t = e.second;
+    uint64_t parent_id = !t->is_initial() && is_vertex(t->get_parent_id()) ? t->get_parent_id() : 0;
+    VertexType vt = t->get_type() == TaskType::Explicit ? VertexType::ExplicitTask
+                                                        : VertexType::ImplicitTask;
+    vertices.push_back( {t->get_id(), parent_id, t->get_codeptr_ra(), (uint32_t) vt,
+                         t->get_depth()} );
+  }
+  // One vertex per barrier instance, as in add_sync_regions
+  typedef std::pair<uint64_t, uint32_t> barrier_key_t;
+  std::map<barrier_key_t, const sync_event_t *> barriers;
+  for (auto td : tool_data->threads) {
+    for (const sync_event_t & event : td->sync_events) {
+      if (event.kind == ompt_sync_region_barrier && event.parallel_id != 0) {
+        barriers.insert( {barrier_key_t(event.parallel_id, event.instance), &event} );
+        continue;
+      }
+      auto search = tool_data->id_to_task.find(event.task_id);
+      if (search == tool_data->id_to_task.end()) {
+        continue;
+      }
+      VertexType vt = event.kind == ompt_sync_region_barrier ? VertexType::Barrier :
+                      event.kind == ompt_sync_region_taskwait ? VertexType::Taskwait
+                                                              : VertexType::Taskgroup;
+      vertices.push_back( {event.id, event.task_id, event.codeptr_ra, (uint32_t) vt,
+                           search->second->get_depth() + 1} );
+    }
+    for (const loop_event_t & event : td->loop_events) {
+      auto search = tool_data->id_to_task.find(event.task_id);
+      if (search != tool_data->id_to_task.end()) {
+        vertices.push_back( {event.id, event.task_id, event.codeptr_ra,
+                             (uint32_t) VertexType::Worksharing,
+                             search->second->get_depth() + 1} );
+      }
+    }
+  }
+  for (auto & b : barriers) {
+    auto search = tool_data->id_to_parallel_region.find(b.first.first);
+    bool has_parent = search != tool_data->id_to_parallel_region.end();
+    vertices.push_back( {b.second->id, has_parent ? b.first.first : 0, b.second->codeptr_ra,
+                         (uint32_t) VertexType::Barrier,
+                         has_parent ? search->second->get_depth() + 1 : 0} );
+  }
+  std::sort(vertices.begin(), vertices.end(), [](const shape_vertex_t & a,
+                                                 const shape_vertex_t & b) {
+    return a.depth > b.depth;
+  });
+
+  std::unordered_map<uint64_t, std::vector<uint32_t> > pending;
+  std::vector<uint32_t> child_shapes, root_shapes;
+  for (const shape_vertex_t & v : vertices) {
+    child_shapes.clear();
+    auto search = pending.find(v.id);
+    if (search != pending.end()) {
+      child_shapes.swap(search->second);
+      pending.erase(search);
+    }
+    std::pair<uint32_t, uint64_t> site = tool_data->call_sites.lookup(v.codeptr_ra);
+    uint32_t shape = compressed.add_vertex(v.type, site.first, site.second,
+                                           site_hash(v.type,
+                                                     tool_data->call_sites.get_modules()[site.first],
+                                                     site.second),
+                                           child_shapes);
+    if (v.parent_id != 0) {
+      pending[v.parent_id].push_back(shape);
+    } else {
+      root_shapes.push_back(shape);
+    }
+  }
+  if (!pending.empty()) {
+    printf("Compressed tree: children of %zu vertices not deeper than their parent left out\n",
+           pending.size());
+  }
+  compressed.finish(root_shapes, tool_data->call_sites.get_modules());
+}
+
+/* Write the DOT file in hash-consed form, without building the tree */
+void write_compressed_tree(tool_data_t * tool_data) {
+  static const char * type_names[] = {"Explicit Task", "Implicit Task", "Parallel Region",
+                                      "Barrier", "Taskwait", "Taskgroup", "Worksharing"};
+  CompressedTree compressed;
+  build_compressed_tree(tool_data, compressed);
+  printf("Compressed tree: %" PRIu64 " vertices in %" PRIu64 " shapes (%zu bytes)\n",
+         compressed.get_num_vertices(), compressed.get_num_shapes(),
+         compressed.get_memory_usage());
+  std::string tree_dotfile = get_output_path("TASK_TREE_DOTFILE", "./tree.dot");
+  ToolOutputStream out(tree_dotfile, compress_outputs());
+  compressed.write_dot(out, type_names, sizeof(type_names) / sizeof(type_names[0]));
+}
+
+/* Write the subtree hashes, for comparing the tree with other runs' */
+void write_hashes(tool_data_t * tool_data) {
+  std::string hash_file = get_output_path("TASK_TREE_HASHFILE", "./tree.hash");
+  write_subtree_hash_file(hash_file, tool_data->tree_hashes, tool_data->tree_hash_children,
+                          tool_data->tree_hash_roots, tool_data->call_sites.get_modules());
+  printf("Tree hash: %016" PRIx64 "\n",
+         forest_hash(tool_data->tree_hashes.data(), tool_data->tree_hash_roots.data(),
+                     tool_data->tree_hash_roots.size()));
+}
+
+/* Write the tree and its join and dependence edges as CSR arrays, and as
+ * GraphML when TASK_TREE_GRAPHML is set. The tree stores each vertex's
+ * out-edges together, so the CSR arrays fill in one pass over the vertices.
+ */
+void write_graph(const tree_t & tree) {
+  const uint64_t n = boost::num_vertices(tree);
+  const uint64_t n_edges = boost::num_edges(tree);
+  graph_columns_t graph;
+  graph.offsets.reserve(n + 1);
+  graph.targets.reserve(n_edges);
+  graph.edge_types.reserve(n_edges);
+  graph.ids.reserve(n);
+  graph.codeptrs.reserve(n);
+  graph.subtree_hashes.reserve(n);
+  graph.vertex_types.reserve(n);
+  for (uint64_t v = 0; v < n; v++) {
+    const vprops_t & vp = tree[v];
+    graph.offsets.push_back(graph.targets.size());
+    graph.ids.push_back(vp.vertex_id);
+    graph.codeptrs.push_back((uint64_t) vp.codeptr);
+    graph.subtree_hashes.push_back(vp.subtree_hash);
+    graph.vertex_types.push_back((uint8_t) vp.type);
+    boost::graph_traits<tree_t>::out_edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = boost::out_edges(v, tree); ei != ei_end; ++ei) {
+      graph.targets.push_back(boost::target(*ei, tree));
+      graph.edge_types.push_back((uint8_t) tree[*ei].edge_type);
+    }
+  }
+  graph.offsets.push_back(graph.targets.size());
+
+  write_graph_file(get_output_path("TASK_TREE_GRAPHFILE", "./tree.csr"), graph);
+  if (getenv("TASK_TREE_GRAPHML") != NULL) {
+    write_graphml_file(get_output_path("TASK_TREE_GRAPHML", "./tree.graphml"), graph);
+  }
+}
 
+/* Write every task, region and edge to the binary trace, straight from the
+ * tool's records
+ */
+void write_trace(tool_data_t * tool_data) {
+  std::string trace_file = get_output_path("TASK_TREE_TRACEFILE", "./tree.trace");
+  std::vector<trace_task_t> tasks;
+  std::vector<trace_region_t> regions;
+  std::vector<trace_edge_t> edges;
+  tasks.reserve(tool_data->id_to_task.size());
+  regions.reserve(tool_data->id_to_parallel_region.size());
+  edges.reserve(tool_data->id_to_task.size() + tool_data->id_to_parallel_region.size());
+  for (auto e : tool_data->id_to_parallel_region) {
+    ParallelRegion * pr = e.second;
+    trace_region_t region;
+    memset(&region, 0, sizeof(region));
+    region.id = pr->get_id();
+    region.parent_id = pr->get_parent_id();
+    region.codeptr_ra = (uint64_t) pr->get_codeptr_ra();
+    region.duration = pr->get_duration();
+    region.fork_overhead = pr->get_fork_overhead();
+    region.join_overhead = pr->get_join_overhead();
+    region.requested_team_size = pr->get_requested_team_size();
+    region.team_size = pr->get_team_size();
+    region.nesting_level = pr->get_nesting_level();
+    region.child_index = pr->get_child_index();
+    regions.push_back(region);
+    edges.push_back( {region.parent_id, region.id, TraceEdgeType::Ancestry, 0} );
+  }
+  for (auto e : tool_data->id_to_task) {
+    Task * t = e.second;
+    trace_task_t task;
+    memset(&task, 0, sizeof(task));
+    task.id = t->get_id();
+    task.parent_id = t->get_parent_id();
+    task.region_id = t->get_region_id();
+    task.codeptr_ra = (uint64_t) t->get_codeptr_ra();
+    task.exec_time = t->get_exec_time();
+    task.flags = (t->get_type() == TaskType::Implicit ? TRACE_TASK_IMPLICIT : 0) |
+                 (t->is_initial() ? TRACE_TASK_INITIAL : 0) |
+                 (t->has_dependences() ? TRACE_TASK_DEPENDENCES : 0);
+    task.state = (uint32_t) t->get_state();
+    task.creating_thread = t->get_creating_thread();
+    task.executing_thread = t->get_executing_thread();
+    task.thread_num = t->get_thread_num();
+    task.child_index = t->get_child_index();
+    tasks.push_back(task);
+    if (!t->is_initial()) {
+      edges.push_back( {task.parent_id, task.id, TraceEdgeType::Ancestry, 0} );
+    }
+    for (Task * child : t->get_dependency_children()) {
+      edges.push_back( {task.id, child->get_id(), TraceEdgeType::Dependence, 0} );
+    }
+  }
+  write_trace_file(trace_file, tasks, regions, edges);
+}
+
+/* Memory owned by the tool, measured by walking its data structures. Not
+ * walked: the granularity-mode tasks and counters-mode regions still
+ * running, which only the runtime's ompt_data_t point to.
+ */
+void print_memory_usage(tool_data_t * tool_data) {
+  size_t task_bytes = 0;
+  size_t label_bytes = 0;
+  for (auto e : tool_data->id_to_task) {
+    task_bytes += e.second->get_memory_usage();
+#ifdef TRACK_SP_LABELS
+    label_bytes += e.second->get_label().get_memory_usage();
+#endif
+  }
+  size_t region_bytes = 0;
+  for (auto e : tool_data->id_to_parallel_region) {
+    region_bytes += e.second->get_memory_usage();
+  }
+  size_t thread_bytes = vector_bytes(tool_data->threads);
+  for (auto td : tool_data->threads) {
+    thread_bytes += sizeof(thread_data_t);
+    thread_bytes += vector_bytes(td->sync_events);
+    thread_bytes += vector_bytes(td->open_sync_events);
+    thread_bytes += vector_bytes(td->implicit_frames);
+    thread_bytes += hash_map_bytes(td->region_stats);
+    thread_bytes += vector_bytes(td->mutex_records);
+    thread_bytes += hash_map_bytes(td->mutex_record_index);
+    thread_bytes += vector_bytes(td->held_mutexes);
+    thread_bytes += vector_bytes(td->loop_events);
+    thread_bytes += vector_bytes(td->loop_chunks);
+    thread_bytes += vector_bytes(td->open_loops);
+    thread_bytes += vector_bytes(td->timeline_events);
+    thread_bytes += vector_bytes(td->counter_regions);
+    thread_bytes += vector_bytes(td->counters.depth_histogram);
+    thread_bytes += hash_map_bytes(td->grain_sites);
+    for (auto & site : td->grain_sites) {
+      thread_bytes += vector_bytes(site.second.levels);
+    }
+    thread_bytes += vector_bytes(td->grain_frames);
+#ifdef RECORD_CALLBACKS
+    thread_bytes += vector_bytes(td->recorded_callbacks);
+#endif
+  }
+  // Vertices and edges of the tree, with the heap buffers of their labels
+  const tree_t & tree = tool_data->tree;
+  size_t tree_bytes = 0;
+  boost::graph_traits<tree_t>::vertex_iterator vi, vi_end;
+  for (boost::tie(vi, vi_end) = boost::vertices(tree); vi != vi_end; ++vi) {
+    const vertex_properties & vp = tree[*vi];
+    tree_bytes += sizeof(std::vector<void *>) + sizeof(vertex_properties);
+    tree_bytes += boost::out_degree(*vi, tree) *
+                  (sizeof(vertex_t) + sizeof(void *) + sizeof(edge_properties));
+    for (const std::string * str : {&vp.vertex_type, &vp.color, &vp.shape,
+                                    &vp.status, &vp.codeptr_ra}) {
+      tree_bytes += string_heap_bytes(*str);
+    }
+    tree_bytes += string_vector_bytes(vp.dependences);
+    tree_bytes += string_vector_bytes(vp.locks);
+  }
+
+  const size_t rows = 8;
+  const char * names[rows] = {"tasks", "task labels", "id_to_task",
+                              "parallel regions", "id_to_parallel_region",
+                              "thread data", "id_to_vertex", "tree"};
+  const size_t bytes[rows] = {task_bytes, label_bytes,
+                              hash_map_bytes(tool_data->id_to_task),
+                              region_bytes,
+                              hash_map_bytes(tool_data->id_to_parallel_region),
+                              thread_bytes,
+                              hash_map_bytes(tool_data->id_to_vertex),
+                              tree_bytes};
+  size_t total = 0;
+  for (size_t i = 0; i < rows; i++) {
+    printf("  %-24s %zu\n", names[i], bytes[i]);
+    total += bytes[i];
+  }
+  printf("  %-24s %zu\n", "total", total);
+  printf("  %-24s %" PRId64 "\n", "peak", tool_data->memory.peak.load());
+  if (tool_data->spill.get_num_spilled() > 0) {
+    printf("  %-24s %" PRIu64 " tasks, %" PRIu64 " bytes\n", "spilled to disk",
+           tool_data->spill.get_num_spilled(), tool_data->spill.get_bytes_spilled());
+  }
+}
+
+/* Print the tool's live memory counters on SIGUSR1 */
+void memory_snapshot_handler(int signum) {
+  print_memory_snapshot(tool_data_ptr->memory);
+}
+
+/* NUMA node for the calling thread's arena: the node of the first processor
+ * of the thread's OpenMP place, or of the first place in its partition if it
+ * is not bound to one place. Unbound threads use the node they run on.
+ */
+int get_place_numa_node() {
+#ifdef TOOL_NUMA
+  if (numa_available() >= 0 && ompt_get_place_num && ompt_get_place_proc_ids) {
+    int place = ompt_get_place_num();
+    if (place < 0 && ompt_get_partition_place_nums) {
+      int partition[1];
+      if (ompt_get_partition_place_nums(1, partition) > 0) {
+        place = partition[0];
+      }
+    }
+    if (place >= 0) {
+      int proc_ids[256];
+      int n_procs = ompt_get_place_proc_ids(place, 256, proc_ids);
+      if (n_procs > 0) {
+        int node = numa_node_of_cpu(proc_ids[0]);
+        if (node >= 0) {
+          return node;
+        }
+      }
+    }
+  }
+#endif
+  return arena_default_node();
+}
+
+/* Read the memory limit, above which completed tasks are spilled to disk */
+void configure_memory_limit(tool_data_t * tool_data) {
+  char * env_var = getenv("TASK_TREE_MEMORY_LIMIT");
+  if (env_var == NULL) {
+    return;
+  }
+  tool_data->memory.limit = parse_memory_size(env_var);
+  tool_data->spill.set_path(get_output_path("TASK_TREE_SPILLFILE", "./tree.spill"));
+}
+
+/* TASK_TREE_TIMELINE names a Chrome trace-event JSON file to write task and
+ * region timelines to, in tree mode
+ */
+void configure_timeline(tool_data_t * tool_data) {
+  if (tool_data->mode != ToolMode::Tree || getenv("TASK_TREE_TIMELINE") == NULL) {
+    return;
+  }
+  TimelineWriter * timeline = new TimelineWriter();
+  if (timeline->open(get_output_path("TASK_TREE_TIMELINE", "./tree.json"), get_timestamp())) {
+    tool_data->timeline = timeline;
+  } else {
+    delete timeline;
+  }
+}
+
+/* Write out the events each thread still holds, including the slices of the
+ * tasks running now, and finish the timeline
+ */
+void close_timeline(tool_data_t * tool_data) {
+  TimelineWriter * timeline = tool_data->timeline;
+  if (timeline == NULL) {
+    return;
+  }
+  uint64_t now = get_timestamp();
+  // A signal may have interrupted this thread inside timeline_record, holding
+  // its buffer's lock and perhaps the writer's, which other threads can be
+  // waiting for with their own buffer locked. Nothing is waited for then:
+  // buffers that are busy are dropped, and the file is left unterminated if
+  // the writer is.
+  bool interrupted = false;
+  if (current_thread_data != NULL) {
+    interrupted = !current_thread_data->timeline_mtx.try_lock();
+    if (!interrupted) {
+      current_thread_data->timeline_mtx.unlock();
+    }
+  }
+  bool dropped = false;
+  boost::lock_guard<boost::mutex> lock(tool_data->threads_mtx);
+  for (thread_data_t * td : tool_data->threads) {
+    boost::unique_lock<boost::mutex> td_lock(td->timeline_mtx, boost::defer_lock);
+    if (!interrupted) {
+      td_lock.lock();
+    } else if (!td_lock.try_lock()) {
+      dropped = true;
+      continue;
+    }
+    Task * task = td->current_task;
+    uint64_t start = td->current_task_start;
+    if (task != NULL && start != 0 && td->timeline != NULL) {
+      timeline_event_t event = {start, now - start, task->get_id(),
+                                (uint64_t) task->get_codeptr_ra(), td->index,
+                                task->get_type() == TaskType::Explicit
+                                  ? TimelineEventKind::ExplicitTask
+                                  : TimelineEventKind::ImplicitTask};
+      td->timeline_events.push_back(event);
+    }
+    if (!timeline->write(td->timeline_events.data(), td->timeline_events.size(), !interrupted)) {
+      dropped = true;
+    }
+    td->timeline_events.clear();
+    td->timeline = NULL;
+  }
+  if (!timeline->close(tool_data->threads.size(), !interrupted)) {
+    printf("Timeline: interrupted while writing, %s is incomplete\n",
+           timeline->get_path().c_str());
+    dropped = true;
+  }
+  tool_data->timeline = NULL;
+  // Threads whose buffers were skipped still point at the writer, and an
+  // interrupted write may still be inside it
+  if (!dropped) {
+    delete timeline;
+  }
+}
+
+/* Sum the threads' live counters into the shared memory segment every
+ * interval_ms. The threads never wait for the publisher: their counters are
+ * read without synchronization, and a round is skipped if the thread list is
+ * locked by a thread registering itself.
+ */
+void publish_live_stats(tool_data_t * tool_data, uint64_t interval_ms) {
+  live_stats_values_t values;
+  memset(&values, 0, sizeof(values));
+  while (!tool_data->live_stats_stop.load(std::memory_order_relaxed)) {
+    boost::unique_lock<boost::mutex> lock(tool_data->threads_mtx, boost::try_to_lock);
+    if (lock.owns_lock()) {
+      values.threads = tool_data->threads.size();
+      values.tasks_created = 0;
+      values.tasks_completed = 0;
+      values.parallel_regions = 0;
+      for (thread_data_t * td : tool_data->threads) {
+        values.tasks_created += td->live.tasks_created.load(std::memory_order_relaxed);
+        values.tasks_completed += td->live.tasks_completed.load(std::memory_order_relaxed);
+        values.parallel_regions += td->live.parallel_regions.load(std::memory_order_relaxed);
+        values.max_depth = std::max(values.max_depth,
+                                    td->live.max_depth.load(std::memory_order_relaxed));
+      }
+      lock.unlock();
+      values.time = live_stats_now();
+      values.updates++;
+      tool_data->live_stats->publish(values);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+}
+
+/* TASK_TREE_LIVE_STATS=1 publishes live counts to the shared memory segment
+ * /ompt_tree.<pid>, any other value names the segment. They are refreshed
+ * every TASK_TREE_LIVE_INTERVAL milliseconds (100 by default).
+ */
+void configure_live_stats(tool_data_t * tool_data) {
+  char * env_var = getenv("TASK_TREE_LIVE_STATS");
+  if (env_var == NULL || strcmp(env_var, "0") == 0) {
+    return;
+  }
+  std::string name = env_var;
+  if (name == "1") {
+    name = "/ompt_tree." + std::to_string(getpid());
+  } else if (name[0] != '/') {
+    name = "/" + name;
+  }
+  LiveStats * live_stats = new LiveStats();
+  if (!live_stats->create(name)) {
+    delete live_stats;
+    return;
+  }
+  printf("Publishing live statistics to shared memory segment %s\n", name.c_str());
+  char * interval = getenv("TASK_TREE_LIVE_INTERVAL");
+  tool_data->live_stats = live_stats;
+  tool_data->live_stats_thread = std::thread(publish_live_stats, tool_data,
+                                             interval ? strtoull(interval, NULL, 10) : 100);
+}
+
+/* Stop publishing and remove the segment */
+void stop_live_stats(tool_data_t * tool_data) {
+  if (tool_data->live_stats == NULL) {
+    return;
+  }
+  tool_data->live_stats_stop.store(true, std::memory_order_relaxed);
+  if (tool_data->live_stats_thread.joinable()) {
+    tool_data->live_stats_thread.join();
+  }
+  delete tool_data->live_stats;
+  tool_data->live_stats = NULL;
+}
+
+/* Stream the DOT file through the export filters, without building the tree */
+void write_filtered_dotfile(tool_data_t * tool_data, const export_filter_t & filter) {
+  std::string tree_dotfile = get_output_path("TASK_TREE_DOTFILE", "./tree.dot");
+  ToolOutputStream out(tree_dotfile, compress_outputs());
+  uint64_t n = write_filtered_tree(tool_data, filter, out);
+  std::cout << "Number of vertices in filtered task tree: " << n << std::endl;
+}
+
+/* Finish the timeline, then write the DOT file, the binary trace, the
+ * ancestry index, the subtree hashes and the CSR graph. The full tree is only
+ * built when the full DOT file, the index, the hashes or the graph need it;
+ * with the export filters or TASK_TREE_SHAPES on, the DOT file is written
+ * from the records and the other three are skipped unless their file is
+ * named in the environment.
+ */
+void write_outputs(tool_data_t * tool_data) {
+  stop_tracing_control();
+  close_timeline(tool_data);
+  // Tasks spilled to disk are needed again from here on
+  reload_spilled_tasks(tool_data);
+
+  export_filter_t filter = get_export_filter();
+  bool filtered = export_filter_active(filter);
+  bool shapes = !filtered && write_shapes();
+  // With the export filters or the shapes on, the index, hashes and graph are
+  // written only when their file is named explicitly, so that such a run does
+  // not build the full tree just for their defaults
+  bool streamed = filtered || shapes;
+  bool write_index_file = false;
+  bool write_hash_file = false;
+  bool write_graph_file = false;
+#ifdef WRITE_ANCESTRY_INDEX
+  write_index_file = !streamed || getenv("TASK_TREE_INDEXFILE") != NULL;
+#endif
+#ifdef WRITE_SUBTREE_HASHES
+  write_hash_file = !streamed || getenv("TASK_TREE_HASHFILE") != NULL;
+#endif
+#ifdef WRITE_GRAPH_FILE
+  write_graph_file = !streamed || getenv("TASK_TREE_GRAPHFILE") != NULL;
+#endif
+  bool need_tree = !streamed || write_index_file || write_hash_file || write_graph_file;
+  if (filtered) {
+    write_filtered_dotfile(tool_data, filter);
+  } else if (shapes) {
+    write_compressed_tree(tool_data);
+  }
+#ifdef WRITE_TRACE_FILE
+  write_trace(tool_data);
+#endif
+  if (!need_tree) {
+    return;
+  }
+
+  // Build the tree
+  build_tree(tool_data);
+  tree_t task_tree = tool_data->tree;
+
+  std::cout << "Number of vertices in task tree: " << boost::num_vertices(task_tree) << std::endl;
+
+  if (!streamed) {
+    write_tree(task_tree); 
+  }
+  if (write_index_file) {
+    write_index(task_tree);
+  }
+  if (write_hash_file) {
+    write_hashes(tool_data);
+  }
+  if (write_graph_file) {
+    write_graph(task_tree);
+  }
 }
 
 /******************************************************************************\
@@ -163,18 +1260,61 @@ void write_tree(tree_t tree) {
 \******************************************************************************/
 void signal_handler(int signum) {
 
-#ifdef DEBUG
-  printf("\n\nTool caught signal: %d\n", signum);
+  DEBUG_EVENT(Signal, signum, 0, 0, 0);
+  stop_live_stats(tool_data_ptr);
+  merge_task_maps(tool_data_ptr);
+
+#ifdef PRINT_SUMMARY_SYNC_REGIONS
+  printf("Sync Regions:\n");
+  print_sync_region_summary(tool_data_ptr);
 #endif
-  
-  // Build the tree
-  build_tree(tool_data_ptr);
-  tree_t task_tree = tool_data_ptr->tree;
 
-  std::cout << "Number of vertices in task tree: " << boost::num_edges(task_tree) << std::endl;
+#ifdef PRINT_SUMMARY_LOOPS
+  printf("Worksharing:\n");
+  print_loop_summary(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_LOCKS
+  printf("Locks:\n");
+  print_lock_summary(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_REGION_PROFILE
+  printf("Parallel Region Profile:\n");
+  print_region_profile(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_THREADS
+  printf("Threads:\n");
+  print_thread_summary(tool_data_ptr);
+#endif
 
-  // Write the tree
-  write_tree(task_tree); 
+#ifdef PRINT_SUMMARY_NUMA
+  printf("NUMA:\n");
+  print_numa_summary(tool_data_ptr);
+#endif
+  
+  if (tool_data_ptr->mode == ToolMode::Counters) {
+    printf("Counters:\n");
+    print_counters(tool_data_ptr);
+  } else if (tool_data_ptr->mode == ToolMode::Granularity) {
+    printf("Task Granularity:\n");
+    print_granularity_report(tool_data_ptr);
+  } else {
+    // Build and write the tree
+    write_outputs(tool_data_ptr);
+  }
+
+#ifdef PRINT_SUMMARY_MEMORY
+  printf("Tool Memory:\n");
+  print_memory_usage(tool_data_ptr);
+#endif
+#ifdef RECORD_CALLBACKS
+  write_callback_log(tool_data_ptr);
+#endif
+#ifdef DEBUG
+  dump_debug_rings(get_output_path("TASK_TREE_DEBUGFILE", "./tree.debug"));
+#endif
 
   exit(signum);
 }
@@ -206,14 +1346,64 @@ int ompt_initialize(ompt_function_lookup_t lookup,
 
   ompt_get_unique_id = (ompt_get_unique_id_t) lookup("ompt_get_unique_id"); 
 
+  // Counters mode is the default; TASK_TREE_MODE=tree records every task,
+  // TASK_TREE_MODE=granularity profiles task sizes per call site
+  char * mode = getenv("TASK_TREE_MODE");
+  if (mode != NULL && strcmp(mode, "tree") == 0) {
+    tool_data_ptr->mode = ToolMode::Tree;
+  } else if (mode != NULL && strcmp(mode, "granularity") == 0) {
+    tool_data_ptr->mode = ToolMode::Granularity;
+  } else {
+    tool_data_ptr->mode = ToolMode::Counters;
+  }
+  char * cutoff = getenv("TASK_TREE_GRAIN_CUTOFF");
+  tool_data_ptr->grain_cutoff = cutoff ? strtoull(cutoff, NULL, 10) : GRAIN_CUTOFF_DEFAULT;
+
   // Determine which OMPT callbacks the tool will invoke 
-  register_callback(ompt_callback_task_create);
-  register_callback(ompt_callback_implicit_task);
-  register_callback(ompt_callback_parallel_begin);
-  register_callback(ompt_callback_parallel_end);
+  if (tool_data_ptr->mode == ToolMode::Counters) {
+    register_callback_variant(ompt_callback_task_create, _counters);
+    register_callback_variant(ompt_callback_implicit_task, _counters);
+    register_callback_variant(ompt_callback_parallel_begin, _counters);
+    register_callback_variant(ompt_callback_parallel_end, _counters);
+    register_callback_variant(ompt_callback_task_schedule, _counters);
+  } else if (tool_data_ptr->mode == ToolMode::Granularity) {
+    register_callback_variant(ompt_callback_task_create, _granularity);
+    register_callback_variant(ompt_callback_implicit_task, _granularity);
+    register_callback_variant(ompt_callback_parallel_begin, _granularity);
+    register_callback_variant(ompt_callback_sync_region, _granularity);
+    register_callback_variant(ompt_callback_task_schedule, _granularity);
+  } else {
+    register_callback(ompt_callback_task_create);
+    register_callback(ompt_callback_implicit_task);
+    register_callback(ompt_callback_parallel_begin);
+    register_callback(ompt_callback_parallel_end);
+    register_callback(ompt_callback_sync_region);
+    register_callback_t(ompt_callback_sync_region_wait, ompt_callback_sync_region_t);
+    register_callback(ompt_callback_task_schedule);
+    register_callback(ompt_callback_task_dependences);
+    register_callback(ompt_callback_control_tool);
+    register_callback(ompt_callback_work);
+    register_callback(ompt_callback_mutex_acquire);
+    register_callback_t(ompt_callback_mutex_acquired, ompt_callback_mutex_t);
+    register_callback_t(ompt_callback_mutex_released, ompt_callback_mutex_t);
+#ifdef TRACK_LOOP_DISPATCH
+    register_callback(ompt_callback_dispatch);
+#endif
+    // SIGUSR2 pauses and resumes collection
+    signal(SIGUSR2, toggle_tracing_handler);
+    configure_tracing_control();
+  }
 
   // Register signal handlers for graph visualization 
   signal(SIGINT, signal_handler); 
+  signal(SIGUSR1, memory_snapshot_handler);
+
+  configure_memory_limit(tool_data_ptr);
+  configure_timeline(tool_data_ptr);
+  configure_live_stats(tool_data_ptr);
+
+  // Place each thread's arena by its OpenMP place
+  arena_node_of_thread = get_place_numa_node;
 
   printf("\n\n\n");
   printf("=================================================================\n");
@@ -234,6 +1424,9 @@ void ompt_finalize(ompt_data_t *tool_data)
   printf("=================================================================\n");
   printf("\n\n\n");
 
+  stop_live_stats(tool_data_ptr);
+  merge_task_maps(tool_data_ptr);
+
 #ifdef PRINT_SUMMARY_TASK_REGIONS
   printf("Tasks:\n");
   for (auto e : tool_data_ptr->id_to_task) {
@@ -249,14 +1442,58 @@ void ompt_finalize(ompt_data_t *tool_data)
     printf("\n"); 
   }
 #endif
+
+#ifdef PRINT_SUMMARY_SYNC_REGIONS
+  printf("Sync Regions:\n");
+  print_sync_region_summary(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_LOOPS
+  printf("Worksharing:\n");
+  print_loop_summary(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_LOCKS
+  printf("Locks:\n");
+  print_lock_summary(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_REGION_PROFILE
+  printf("Parallel Region Profile:\n");
+  print_region_profile(tool_data_ptr);
+#endif
+
+#ifdef PRINT_SUMMARY_THREADS
+  printf("Threads:\n");
+  print_thread_summary(tool_data_ptr);
+#endif
   
-  // Build the tree
-  build_tree(tool_data_ptr);
-  tree_t task_tree = tool_data_ptr->tree;
+  if (tool_data_ptr->mode == ToolMode::Counters) {
+    printf("Counters:\n");
+    print_counters(tool_data_ptr);
+  } else if (tool_data_ptr->mode == ToolMode::Granularity) {
+    printf("Task Granularity:\n");
+    print_granularity_report(tool_data_ptr);
+  } else {
+    // Build and write the tree
+    write_outputs(tool_data_ptr);
+  }
 
-  std::cout << "Number of vertices in task tree: " << boost::num_vertices(task_tree) << std::endl;
+#ifdef PRINT_SUMMARY_MEMORY
+  printf("Tool Memory:\n");
+  print_memory_usage(tool_data_ptr);
+#endif
+#ifdef RECORD_CALLBACKS
+  write_callback_log(tool_data_ptr);
+#endif
+#ifdef DEBUG
+  dump_debug_rings(get_output_path("TASK_TREE_DEBUGFILE", "./tree.debug"));
+#endif
 
-  write_tree(task_tree); 
+#ifdef PRINT_SUMMARY_NUMA
+  printf("NUMA:\n");
+  print_numa_summary(tool_data_ptr);
+#endif
 
   printf("0: ompt_event_runtime_shutdown\n"); 
 
@@ -267,6 +1504,9 @@ void ompt_finalize(ompt_data_t *tool_data)
   for ( auto e : tool_data_ptr->id_to_parallel_region ) {
     delete e.second; 
   }
+  for ( auto td : tool_data_ptr->threads ) {
+    free_thread_data(td); 
+  }
   delete (tool_data_t*)tool_data->ptr; 
 }
 
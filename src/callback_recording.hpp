@@ -0,0 +1,42 @@
+#include <algorithm>
+
+#include "CallbackRecord.hpp"
+
+
+/* Append a record of the current callback to the calling thread's log */
+static void record_callback(CallbackKind kind,
+                            const ompt_data_t * d0, const ompt_data_t * d1,
+                            const ompt_data_t * d2,
+                            uint64_t a0, uint64_t a1, uint64_t a2,
+                            const void * codeptr_ra)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  callback_record_t record;
+  record.seq = tool_data_ptr->callback_seq++;
+  record.thread = td->index;
+  record.kind = kind;
+  record.reserved = 0;
+  record.data[0] = (uint64_t) d0;
+  record.data[1] = (uint64_t) d1;
+  record.data[2] = (uint64_t) d2;
+  record.args[0] = a0;
+  record.args[1] = a1;
+  record.args[2] = a2;
+  record.codeptr_ra = (uint64_t) codeptr_ra;
+  td->recorded_callbacks.push_back(record);
+}
+
+/* Merge the per-thread logs back into invocation order and write them out */
+void write_callback_log(tool_data_t * tool_data) {
+  std::string log_file = get_output_path("TASK_TREE_CALLBACK_LOG", "./callbacks.rec");
+  std::vector<callback_record_t> records;
+  for (auto td : tool_data->threads) {
+    records.insert(records.end(), td->recorded_callbacks.begin(),
+                   td->recorded_callbacks.end());
+  }
+  std::sort(records.begin(), records.end(),
+            [](const callback_record_t & a, const callback_record_t & b) {
+              return a.seq < b.seq;
+            });
+  write_callback_log(log_file, tool_data->threads.size(), records);
+}
@@ -0,0 +1,26 @@
+
+/* OMPT callback for omp_control_tool, which lets the program itself mark the
+ * phases to trace. omp_control_tool_start resumes collection, and
+ * omp_control_tool_pause and omp_control_tool_end pause it. Returns 1 if
+ * collection is running afterwards and 0 if it is paused.
+ */
+static int
+on_ompt_callback_control_tool(
+    uint64_t command,
+    uint64_t modifier,
+    void *arg,
+    const void *codeptr_ra)
+{
+  switch (command) {
+    case omp_control_tool_start:
+      resume_tracing();
+      break;
+    case omp_control_tool_pause:
+    case omp_control_tool_end:
+      pause_tracing();
+      break;
+    default:
+      break;
+  }
+  return tracing_is_paused() ? 0 : 1;
+}
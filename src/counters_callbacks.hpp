@@ -0,0 +1,190 @@
+/******************************************************************************\
+ * Callbacks for counters mode.
+ *
+ * In counters mode the tool keeps no record of individual tasks or regions:
+ * each callback only updates counts in the calling thread's data, which are
+ * merged at finalize. A task's ompt_data_t value holds its depth in the upper
+ * 32 bits and the number of children it has created so far in the lower 32,
+ * which only the thread executing the task updates. A running parallel region
+ * points to a small region_counters_t that lives until parallel_end.
+\******************************************************************************/
+
+#define COUNTER_DEPTH(value) ((uint32_t) ((value) >> 32))
+#define COUNTER_CHILDREN(value) ((uint32_t) (value))
+
+static inline void count_depth(tree_counters_t & counters, uint32_t depth)
+{
+  if (counters.depth_histogram.size() <= depth) {
+    counters.depth_histogram.resize(depth + 1, 0);
+  }
+  counters.depth_histogram[depth]++;
+}
+
+static void
+on_ompt_callback_task_create_counters(
+    ompt_data_t *encountering_task_data,
+    const omp_frame_t *encountering_task_frame,
+    ompt_data_t* new_task_data,
+    int type,
+    int has_dependences,
+    const void *codeptr_ra)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  tree_counters_t & counters = td->counters;
+  live_count(td->live.tasks_created);
+  if (type & ompt_task_initial) {
+    counters.initial_tasks++;
+    count_depth(counters, 0);
+    new_task_data->value = 0;
+    return;
+  }
+  uint32_t depth = 1;
+  if (encountering_task_data) {
+    depth = COUNTER_DEPTH(encountering_task_data->value) + 1;
+    encountering_task_data->value++;
+  }
+  new_task_data->value = (uint64_t) depth << 32;
+  counters.explicit_tasks++;
+  count_depth(counters, depth);
+  live_depth(td->live, depth);
+  std::vector<region_counters_t *> & regions = td->counter_regions;
+  if (!regions.empty()) {
+    regions.back()->tasks.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+static void
+on_ompt_callback_implicit_task_counters(
+    ompt_scope_endpoint_t endpoint,
+    ompt_data_t *parallel_data,
+    ompt_data_t *task_data,
+    unsigned int team_size,
+    unsigned int thread_num)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  if (endpoint == ompt_scope_begin) {
+    region_counters_t * region = parallel_data ? (region_counters_t *) parallel_data->ptr : NULL;
+    uint32_t depth = region ? region->depth + 1 : 1;
+    task_data->value = (uint64_t) depth << 32;
+    td->counters.implicit_tasks++;
+    count_depth(td->counters, depth);
+    live_count(td->live.tasks_created);
+    live_depth(td->live, depth);
+    td->counter_regions.push_back(region);
+  } else if (endpoint == ompt_scope_end) {
+    td->counters.fanout_histogram[counter_bucket(COUNTER_CHILDREN(task_data->value))]++;
+    live_count(td->live.tasks_completed);
+    if (!td->counter_regions.empty()) {
+      td->counter_regions.pop_back();
+    }
+  }
+}
+
+static void
+on_ompt_callback_parallel_begin_counters(
+  ompt_data_t *encountering_task_data,
+  const omp_frame_t *encountering_task_frame,
+  ompt_data_t* parallel_data,
+  uint32_t requested_team_size,
+  ompt_invoker_t invoker,
+  const void *codeptr_ra)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  region_counters_t * region =
+    new (arena_allocate(sizeof(region_counters_t))) region_counters_t();
+  region->depth = 1;
+  region->tasks = 0;
+  if (encountering_task_data) {
+    region->depth = COUNTER_DEPTH(encountering_task_data->value) + 1;
+    encountering_task_data->value++;
+  }
+  parallel_data->ptr = region;
+  td->counters.parallel_regions++;
+  count_depth(td->counters, region->depth);
+  live_count(td->live.parallel_regions);
+  live_depth(td->live, region->depth);
+}
+
+static void
+on_ompt_callback_parallel_end_counters(
+  ompt_data_t *parallel_data,
+  ompt_data_t *encountering_task_data,
+  ompt_invoker_t invoker,
+  const void *codeptr_ra)
+{
+  region_counters_t * region = (region_counters_t *) parallel_data->ptr;
+  if (region == NULL) {
+    return;
+  }
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  td->counters.region_tasks_histogram[counter_bucket(region->tasks.load())]++;
+  region->~region_counters_t();
+  arena_free(region, sizeof(region_counters_t));
+  parallel_data->ptr = NULL;
+}
+
+static void
+on_ompt_callback_task_schedule_counters(
+    ompt_data_t *prior_task_data,
+    ompt_task_status_t prior_task_status,
+    ompt_data_t *next_task_data)
+{
+  if (prior_task_data && prior_task_status == ompt_task_complete) {
+    thread_data_t * td = get_thread_data(tool_data_ptr);
+    td->counters.fanout_histogram[counter_bucket(COUNTER_CHILDREN(prior_task_data->value))]++;
+    live_count(td->live.tasks_completed);
+  }
+}
+
+
+/* Merge the threads' counts and print them */
+void print_counters(tool_data_t * tool_data) {
+  tree_counters_t total;
+  total.initial_tasks = total.implicit_tasks = total.explicit_tasks = 0;
+  total.parallel_regions = 0;
+  memset(total.fanout_histogram, 0, sizeof(total.fanout_histogram));
+  memset(total.region_tasks_histogram, 0, sizeof(total.region_tasks_histogram));
+  printf("  Explicit tasks created per thread:\n");
+  for (auto td : tool_data->threads) {
+    const tree_counters_t & c = td->counters;
+    printf("    thread %3u: %" PRIu64 "\n", td->index, c.explicit_tasks);
+    total.initial_tasks += c.initial_tasks;
+    total.implicit_tasks += c.implicit_tasks;
+    total.explicit_tasks += c.explicit_tasks;
+    total.parallel_regions += c.parallel_regions;
+    if (total.depth_histogram.size() < c.depth_histogram.size()) {
+      total.depth_histogram.resize(c.depth_histogram.size(), 0);
+    }
+    for (size_t d = 0; d < c.depth_histogram.size(); d++) {
+      total.depth_histogram[d] += c.depth_histogram[d];
+    }
+    for (int b = 0; b < COUNTER_BUCKETS; b++) {
+      total.fanout_histogram[b] += c.fanout_histogram[b];
+      total.region_tasks_histogram[b] += c.region_tasks_histogram[b];
+    }
+  }
+  printf("  Initial tasks: %" PRIu64 "\n", total.initial_tasks);
+  printf("  Implicit tasks: %" PRIu64 "\n", total.implicit_tasks);
+  printf("  Explicit tasks: %" PRIu64 "\n", total.explicit_tasks);
+  printf("  Parallel regions: %" PRIu64 "\n", total.parallel_regions);
+  printf("  Tree depth: %zu\n", total.depth_histogram.size());
+  printf("  Tasks and regions by depth:\n");
+  for (size_t d = 0; d < total.depth_histogram.size(); d++) {
+    printf("    %4zu: %" PRIu64 "\n", d, total.depth_histogram[d]);
+  }
+  // Bucket b > 0 holds counts in [2^(b-1), 2^b - 1]
+  printf("  Tasks by number of children:\n");
+  for (int b = 0; b < COUNTER_BUCKETS; b++) {
+    if (total.fanout_histogram[b] > 0) {
+      printf("    %10" PRIu64 "-%-10" PRIu64 ": %" PRIu64 "\n",
+             b ? UINT64_C(1) << (b - 1) : 0, b ? (UINT64_C(1) << b) - 1 : 0, total.fanout_histogram[b]);
+    }
+  }
+  printf("  Parallel regions by number of explicit tasks:\n");
+  for (int b = 0; b < COUNTER_BUCKETS; b++) {
+    if (total.region_tasks_histogram[b] > 0) {
+      printf("    %10" PRIu64 "-%-10" PRIu64 ": %" PRIu64 "\n",
+             b ? UINT64_C(1) << (b - 1) : 0, b ? (UINT64_C(1) << b) - 1 : 0, total.region_tasks_histogram[b]);
+    }
+  }
+}
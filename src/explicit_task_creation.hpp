@@ -11,40 +11,54 @@ on_ompt_callback_task_create(
     int has_dependences,
     const void *codeptr_ra)
 {
-#ifdef DEBUG
-  printf("\nENTERING OMPT_TASK_CREATE\n");
-  if(new_task_data->ptr) {
-    printf("0: new_task_data initially not null\n");
-  } 
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  // The initial task also sets up the implicit parallel region, which the
+  // replay has to hand back from ompt_get_parallel_info
+  ompt_data_t * initial_parallel_data = NULL;
+  if (type & ompt_task_initial) {
+    ompt_get_parallel_info(0, &initial_parallel_data, NULL);
+  }
+  record_callback(CallbackKind::TaskCreate, encountering_task_data, new_task_data,
+                  initial_parallel_data, type, has_dependences, 0, codeptr_ra);
 #endif
+  if (new_task_data->ptr) {
+    DEBUG_EVENT(TaskDataNotNull, (uintptr_t) new_task_data->ptr, 0, 0, 0);
+  }
 
-  new_task_data->value = ompt_get_unique_id();
-  char buffer[2048];
-  format_task_type(type, buffer);
+  uint64_t task_id = ompt_get_unique_id();
 
-  //there is no parallel_begin callback for implicit parallel region
-  //thus it is initialized in initial task
+  //there is no parallel_begin callback for implicit parallel region, so it
+  //has no ParallelRegion object. Its parallel_data is left NULL, which the
+  //callbacks that cast it to a ParallelRegion* treat as untracked.
   if(type & ompt_task_initial)
   {
     ompt_data_t *parallel_data;
     ompt_get_parallel_info(0, &parallel_data, NULL);
-#ifdef DEBUG
-    if(parallel_data->ptr)
-      printf("%s\n", "0: parallel_data initially not null");
-#endif
-    parallel_data->value = ompt_get_unique_id();
+    if (parallel_data->ptr) {
+      DEBUG_EVENT(ParallelDataNotNull, parallel_data->value, 0, 0, 0);
+    }
+    parallel_data->ptr = NULL;
   }
 
-  uint64_t task_id = new_task_data->value;
-  uint64_t parent_task_id = encountering_task_data ? encountering_task_data->value : 0; 
+  // Task data holds a pointer to the tool's Task object, so the parent can
+  // be reached without a map lookup
+  Task * parent = encountering_task_data ? (Task *) encountering_task_data->ptr : NULL;
+  // The encountering task may have begun while collection was paused
+  if (parent == NULL && current_tracing_window() > 0 && !(type & ompt_task_initial)) {
+    parent = find_traced_ancestor();
+  }
+  uint64_t parent_task_id = parent ? parent->get_id() : 0; 
 
 
   // Create a task object to represent this task
-#ifdef DEBUG
-  printf("\nCreating task object for task %lu\n", task_id);
-#endif
-  
+  DEBUG_EVENT(TaskCreate, task_id, parent_task_id, type, (uintptr_t) codeptr_ra);
   Task * t = new Task(task_id, parent_task_id, TaskType::Explicit, codeptr_ra);
+  new_task_data->ptr = t;
+  t->set_trace_window(current_tracing_window());
+  t->set_has_dependences(has_dependences != 0);
 
   // Handle initial task case
   if (type == 1) {
@@ -52,6 +66,32 @@ on_ompt_callback_task_create(
     tool_data_ptr->initial_task_id = task_id; 
   }
 
+  if (type != 1 && parent != NULL) {
+#ifdef TRACK_SP_LABELS
+    t->set_label(SPLabel(parent->get_label(), parent->get_sp_state(),
+                         parent->get_sp_state().spawned, 0));
+#endif
+    t->set_child_index(parent->spawn_child());
+    t->set_depth(parent->get_depth() + 1);
+  } else {
+#ifdef TRACK_SP_LABELS
+    t->set_label(SPLabel::initial());
+#endif
+  }
+
+  // The new task is bound to its creator's parallel region
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  note_numa_access(td, parent);
+  uint64_t region_id = parent ? parent->get_region_id() : 0;
+  t->set_region_id(region_id);
+  t->set_creating_thread(td->index);
+  get_region_stats(td, region_id).tasks_created++;
+  live_count(td->live.tasks_created);
+  live_depth(td->live, t->get_depth());
+  if (td->timeline != NULL && parent != NULL) {
+    timeline_record(td, TimelineEventKind::FlowStart, get_timestamp(), 0, task_id, codeptr_ra);
+  }
+
   register_task(t, tool_data_ptr); 
 
   
@@ -0,0 +1,276 @@
+/******************************************************************************\
+ * Callbacks for granularity mode.
+ *
+ * Granularity mode looks for tasks that are too small to pay for themselves.
+ * Each task gets a small grain_task_t from the thread's arena, and each
+ * scheduling point charges the elapsed time to the task that was running.
+ * When a task completes its numbers are added to the executing thread's table
+ * for its call site and the record is freed, so nothing grows with the number
+ * of tasks. The tables are merged at finalize.
+ *
+ * The cost of creating a task is estimated from the time between two
+ * consecutive task creations by the same task while it keeps running, which
+ * covers the runtime's work for one creation plus whatever the creator does
+ * in between. It is an upper bound, and exact for creation loops and for
+ * recursive patterns such as fib that create their children back to back.
+\******************************************************************************/
+
+#ifndef GRAIN_CUTOFF_DEFAULT
+// Tasks shorter than this (in nanoseconds) are flagged as too fine-grained
+#define GRAIN_CUTOFF_DEFAULT 10000
+#endif
+
+static inline grain_task_t * new_grain_task(const void * codeptr_ra,
+                                            const void * parent_codeptr_ra,
+                                            uint32_t depth)
+{
+  grain_task_t * task = (grain_task_t *) arena_allocate(sizeof(grain_task_t));
+  memset(task, 0, sizeof(grain_task_t));
+  task->codeptr_ra = codeptr_ra;
+  task->parent_codeptr_ra = parent_codeptr_ra;
+  task->depth = depth;
+  return task;
+}
+
+/* Charge the time since the last switch to the running task and make next
+ * the running task
+ */
+static inline void switch_grain_task(thread_data_t * td, grain_task_t * next, uint64_t now)
+{
+  grain_task_t * prior = td->grain_current;
+  if (prior) {
+    prior->exec_time += now - td->grain_current_start;
+    prior->last_create_time = 0;
+  }
+  if (next && next->start_time == 0) {
+    next->start_time = now;
+  }
+  td->grain_current = next;
+  td->grain_current_start = now;
+}
+
+/* Add a completed explicit task to its call site's statistics */
+static void complete_grain_task(thread_data_t * td, grain_task_t * task, uint64_t now)
+{
+  grain_site_t & site = td->grain_sites[task->codeptr_ra];
+  site.tasks++;
+  if (task->parent_codeptr_ra == task->codeptr_ra) {
+    site.recursive_tasks++;
+  }
+  site.exec_time += task->exec_time;
+  if (task->create_cost > 0) {
+    site.create_cost += task->create_cost;
+    site.create_samples++;
+  }
+  if (site.levels.size() <= task->depth) {
+    site.levels.resize(task->depth + 1, grain_level_t());
+  }
+  grain_level_t & level = site.levels[task->depth];
+  level.tasks++;
+  level.inclusive_time += now - task->start_time;
+}
+
+static void
+on_ompt_callback_task_create_granularity(
+    ompt_data_t *encountering_task_data,
+    const omp_frame_t *encountering_task_frame,
+    ompt_data_t* new_task_data,
+    int type,
+    int has_dependences,
+    const void *codeptr_ra)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+  live_count(td->live.tasks_created);
+  if (type & ompt_task_initial) {
+    grain_task_t * initial = new_grain_task(NULL, NULL, 0);
+    new_task_data->ptr = initial;
+    switch_grain_task(td, initial, now);
+    return;
+  }
+  grain_task_t * creator = encountering_task_data ? (grain_task_t *) encountering_task_data->ptr : NULL;
+  grain_task_t * task = new_grain_task(codeptr_ra, creator ? creator->codeptr_ra : NULL,
+                                       creator ? creator->depth + 1 : 1);
+  if (creator) {
+    if (creator->last_create_time != 0) {
+      task->create_cost = now - creator->last_create_time;
+    }
+    creator->last_create_time = now;
+  }
+  live_depth(td->live, task->depth);
+  new_task_data->ptr = task;
+}
+
+static void
+on_ompt_callback_implicit_task_granularity(
+    ompt_scope_endpoint_t endpoint,
+    ompt_data_t *parallel_data,
+    ompt_data_t *task_data,
+    unsigned int team_size,
+    unsigned int thread_num)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+  if (endpoint == ompt_scope_begin) {
+    // The region's depth was stored in its parallel_data by parallel_begin
+    uint32_t depth = parallel_data ? (uint32_t) parallel_data->value : 1;
+    grain_task_t * task = new_grain_task(NULL, NULL, depth);
+    task_data->ptr = task;
+    live_count(td->live.tasks_created);
+    live_depth(td->live, depth);
+    td->grain_frames.push_back(td->grain_current);
+    switch_grain_task(td, task, now);
+  } else if (endpoint == ompt_scope_end) {
+    grain_task_t * task = (grain_task_t *) task_data->ptr;
+    grain_task_t * encountering = NULL;
+    if (!td->grain_frames.empty()) {
+      encountering = td->grain_frames.back();
+      td->grain_frames.pop_back();
+    }
+    switch_grain_task(td, encountering, now);
+    live_count(td->live.tasks_completed);
+    if (task) {
+      arena_free(task, sizeof(grain_task_t));
+      task_data->ptr = NULL;
+    }
+  }
+}
+
+static void
+on_ompt_callback_parallel_begin_granularity(
+  ompt_data_t *encountering_task_data,
+  const omp_frame_t *encountering_task_frame,
+  ompt_data_t* parallel_data,
+  uint32_t requested_team_size,
+  ompt_invoker_t invoker,
+  const void *codeptr_ra)
+{
+  grain_task_t * encountering = encountering_task_data ? (grain_task_t *) encountering_task_data->ptr : NULL;
+  parallel_data->value = encountering ? encountering->depth + 1 : 1;
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  live_count(td->live.parallel_regions);
+  live_depth(td->live, parallel_data->value);
+}
+
+static void
+on_ompt_callback_sync_region_granularity(
+  ompt_sync_region_kind_t kind,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t *parallel_data,
+  ompt_data_t *task_data,
+  const void *codeptr_ra)
+{
+  // Creations on either side of a synchronization are not back to back
+  grain_task_t * task = task_data ? (grain_task_t *) task_data->ptr : NULL;
+  if (task) {
+    task->last_create_time = 0;
+  }
+}
+
+static void
+on_ompt_callback_task_schedule_granularity(
+    ompt_data_t *prior_task_data,
+    ompt_task_status_t prior_task_status,
+    ompt_data_t *next_task_data)
+{
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+  grain_task_t * prior = prior_task_data ? (grain_task_t *) prior_task_data->ptr : NULL;
+  grain_task_t * next = next_task_data ? (grain_task_t *) next_task_data->ptr : NULL;
+  switch_grain_task(td, next, now);
+  if (prior && prior_task_status == ompt_task_complete) {
+    live_count(td->live.tasks_completed);
+    if (prior->codeptr_ra != NULL) {
+      complete_grain_task(td, prior, now);
+    }
+    arena_free(prior, sizeof(grain_task_t));
+    prior_task_data->ptr = NULL;
+  }
+}
+
+
+/* Merge the threads' call site tables, print each site's average duration,
+ * creation cost and depth, and flag the sites whose tasks are shorter than
+ * the cutoff along with a suggested threshold
+ */
+void print_granularity_report(tool_data_t * tool_data) {
+  std::map<const void *, grain_site_t> sites;
+  for (auto td : tool_data->threads) {
+    for (auto & e : td->grain_sites) {
+      grain_site_t & site = sites[e.first];
+      const grain_site_t & s = e.second;
+      site.tasks += s.tasks;
+      site.recursive_tasks += s.recursive_tasks;
+      site.exec_time += s.exec_time;
+      site.create_cost += s.create_cost;
+      site.create_samples += s.create_samples;
+      if (site.levels.size() < s.levels.size()) {
+        site.levels.resize(s.levels.size(), grain_level_t());
+      }
+      for (size_t d = 0; d < s.levels.size(); d++) {
+        site.levels[d].tasks += s.levels[d].tasks;
+        site.levels[d].inclusive_time += s.levels[d].inclusive_time;
+      }
+    }
+  }
+
+  const uint64_t cutoff = tool_data->grain_cutoff;
+  printf("  Cutoff: %" PRIu64 " ns\n", cutoff);
+  printf("  %-18s %10s %12s %12s %10s %9s\n",
+         "codeptr_ra", "tasks", "avg ns", "create ns", "create/avg", "depth");
+  for (auto & e : sites) {
+    const grain_site_t & site = e.second;
+    double avg = (double) site.exec_time / site.tasks;
+    double create = site.create_samples ? (double) site.create_cost / site.create_samples : 0.0;
+    size_t min_depth = 0;
+    while (min_depth < site.levels.size() && site.levels[min_depth].tasks == 0) {
+      min_depth++;
+    }
+    printf("  %-18p %10" PRIu64 " %12.0f %12.0f %10.2f %4zu-%-4zu\n",
+           e.first, site.tasks, avg, create, avg > 0 ? create / avg : 0.0,
+           min_depth, site.levels.size() - 1);
+  }
+
+  printf("  Fine-grained call sites:\n");
+  size_t flagged = 0;
+  for (auto & e : sites) {
+    const grain_site_t & site = e.second;
+    double avg = (double) site.exec_time / site.tasks;
+    if (avg >= cutoff) {
+      continue;
+    }
+    flagged++;
+    printf("    %p: tasks average %.0f ns", e.first, avg);
+    if (site.create_samples > 0) {
+      printf(", creating one costs about %.0f ns",
+             (double) site.create_cost / site.create_samples);
+    }
+    printf("\n");
+    if (2 * site.recursive_tasks > site.tasks) {
+      // A recursive site stopped at depth d turns each task at depth d into
+      // a leaf doing its whole subtree's work, so pick the deepest level
+      // whose subtrees still reach the cutoff
+      int64_t threshold = -1;
+      for (size_t d = 0; d < site.levels.size(); d++) {
+        const grain_level_t & level = site.levels[d];
+        if (level.tasks > 0 && level.inclusive_time / level.tasks >= cutoff) {
+          threshold = d;
+        }
+      }
+      if (threshold >= 0) {
+        printf("      recursive: create tasks only up to depth %" PRId64
+               " and run deeper calls serially\n", threshold);
+      } else {
+        printf("      recursive: even the shallowest subtrees are below the cutoff,"
+               " run this site serially\n");
+      }
+    } else {
+      uint64_t factor = avg > 0 ? (uint64_t) (cutoff / avg) + 1 : 0;
+      printf("      make each task do about %" PRIu64 " times as much work"
+             " (e.g. a larger chunk or grainsize)\n", factor);
+    }
+  }
+  if (flagged == 0) {
+    printf("    none\n");
+  }
+}
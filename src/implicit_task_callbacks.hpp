@@ -13,50 +13,95 @@ on_ompt_callback_implicit_task(
     unsigned int team_size,
     unsigned int thread_num)
 {
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::ImplicitTask, parallel_data, task_data, NULL,
+                  endpoint, team_size, thread_num, NULL);
+#endif
   // Implicit task creation
   if (endpoint == ompt_scope_begin) {
-#ifdef DEBUG
-    printf("\nENTERING OMPT_IMPLICIT_TASK_CREATION\n");
-#endif 
-
-#ifdef DEBUG
-    if(task_data->ptr) {
-      printf("%s\n", "0: task_data initially not null");
+    if (task_data->ptr) {
+      DEBUG_EVENT(TaskDataNotNull, (uintptr_t) task_data->ptr, 0, 0, 0);
     }
-#endif 
-    task_data->value = ompt_get_unique_id();
-
-
-    uint64_t task_id = task_data->value;
-    uint64_t parallel_region_id = parallel_data->value;
+    ParallelRegion * region = (ParallelRegion *) parallel_data->ptr;
+    if (region == NULL) {
+      // The region began while collection was paused
+      return;
+    }
+    uint64_t task_id = ompt_get_unique_id();
+    uint64_t parallel_region_id = region->get_id();
     uint64_t thread_id = thread_num;
 
     // Create a task object to represent this task
-#ifdef DEBUG
-    printf("\nCreating task object for task %lu\n", task_id);
-#endif
+    DEBUG_EVENT(ImplicitTaskBegin, task_id, parallel_region_id, thread_num, team_size);
     void * codeptr_ra = NULL; 
     Task * task_ptr = new Task(task_id, parallel_region_id, TaskType::Implicit, codeptr_ra);
+    task_data->ptr = task_ptr;
+#ifdef TRACK_SP_LABELS
+    sp_state_t region_state;
+    memset(&region_state, 0, sizeof(region_state));
+    task_ptr->set_label(SPLabel(region->get_label(), region_state, thread_num, team_size));
+#endif
     register_task(task_ptr, tool_data_ptr); 
-    register_task_as_child_of_parallel_region(parallel_region_id, task_id, tool_data_ptr);
+    region->add_child(task_ptr, thread_num);
+
+    // Record which thread runs this implicit task and start timing it
+    thread_data_t * td = get_thread_data(tool_data_ptr);
+    note_numa_access(td, region);
+    uint64_t now = get_timestamp();
+    task_ptr->set_region_id(parallel_region_id);
+    task_ptr->set_thread_num(thread_id);
+    task_ptr->set_creating_thread(td->index);
+    task_ptr->set_executing_thread(td->index);
+    task_ptr->set_depth(region->get_depth() + 1);
+    live_count(td->live.tasks_created);
+    live_depth(td->live, task_ptr->get_depth());
+    get_region_stats(td, parallel_region_id).thread_num = thread_id;
+    region->note_implicit_begin(now, team_size);
+    implicit_frame_t frame = {task_ptr, region, parallel_region_id, now, 0, td->current_task, 0};
+    td->implicit_frames.push_back(frame);
+    switch_current_task(td, task_ptr, now);
 
   // Implicit task completion
   } else if (endpoint == ompt_scope_end) {
-#ifdef DEBUG
-    printf("\nENTERING OMPT_IMPLICIT_TASK_COMPLETION\n");
-#endif 
-
-
     // Warning! Trying to get the parallel region ID here will segfault 
-    uint64_t task_id = task_data->value;
+    Task * task_ptr = (Task *) task_data->ptr;
+    if (task_ptr == NULL) {
+      return;
+    }
+    uint64_t task_id = task_ptr->get_id();
+    DEBUG_EVENT(ImplicitTaskEnd, task_id, 0, 0, 0);
+    task_ptr->release_dependence_table();
     //complete_task(task_id, tool_data_ptr); 
 
+    // Busy time is the implicit task's lifetime minus the time its thread
+    // sat idle in sync regions
+    thread_data_t * td = get_thread_data(tool_data_ptr);
+    live_count(td->live.tasks_completed);
+    // Drop the frames above this task's, of implicit tasks whose end was
+    // missed while collection was paused
+    for (size_t i = td->implicit_frames.size(); i-- > 0; ) {
+      if (td->implicit_frames[i].task == task_ptr) {
+        td->implicit_frames.resize(i + 1);
+        break;
+      }
+    }
+    if (!td->implicit_frames.empty()) {
+      uint64_t now = get_timestamp();
+      implicit_frame_t frame = td->implicit_frames.back();
+      td->implicit_frames.pop_back();
+      uint64_t lifetime = now - frame.begin_time;
+      uint64_t busy = lifetime > frame.idle_time ? lifetime - frame.idle_time : 0;
+      get_region_stats(td, frame.region_id).busy_time += busy;
+      frame.region->note_implicit_end(now);
+      switch_current_task(td, frame.encountering_task, now);
+    }
+
   
   } else {
-#ifdef DEBUG
-    printf("Endpoint not equal to ompt_scope_begin or ompt_scope_end "
-           "encountered in implicit_task callback\n"); 
-#endif 
+    DEBUG_EVENT(ImplicitTaskBadEndpoint, endpoint, 0, 0, 0);
   }
 
 }
@@ -0,0 +1,149 @@
+
+static const char * mutex_kind_name(int kind)
+{
+  static const char * names[] = {"Mutex", "Lock", "Lock", "Nest lock", "Nest lock",
+                                 "Critical", "Atomic", "Ordered"};
+  return kind >= 0 && kind < (int) (sizeof(names) / sizeof(names[0])) ? names[kind] : names[0];
+}
+
+/* The lock most recently requested or acquired with this wait ID, or NULL */
+static inline held_mutex_t * find_held_mutex(thread_data_t * td, uint64_t wait_id, bool acquired)
+{
+  for (size_t i = td->held_mutexes.size(); i-- > 0; ) {
+    held_mutex_t & held = td->held_mutexes[i];
+    if (held.wait_id == wait_id && (held.acquired_time != 0) == acquired) {
+      return &held;
+    }
+  }
+  return NULL;
+}
+
+/* Index of the thread's record for this task, lock and call site, creating
+ * it on first use. Repeated acquisitions of the same lock hit the cache.
+ */
+static size_t find_mutex_record(thread_data_t * td, Task * task, ompt_mutex_kind_t kind,
+                                uint64_t wait_id, const void * codeptr_ra)
+{
+  uint64_t task_id = task ? task->get_id() : 0;
+  std::vector<mutex_record_t> & records = td->mutex_records;
+  if (td->cached_mutex_record < records.size()) {
+    const mutex_record_t & cached = records[td->cached_mutex_record];
+    if (cached.task_id == task_id && cached.wait_id == wait_id &&
+        cached.codeptr_ra == codeptr_ra) {
+      return td->cached_mutex_record;
+    }
+  }
+  mutex_key_t key = {task_id, wait_id, codeptr_ra};
+  auto insert_result = td->mutex_record_index.insert( {key, records.size()} );
+  if (insert_result.second) {
+    mutex_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.task_id = task_id;
+    record.region_id = task ? task->get_region_id() : 0;
+    record.wait_id = wait_id;
+    record.codeptr_ra = codeptr_ra;
+    record.kind = kind;
+    records.push_back(record);
+    account_memory(tool_data_ptr->memory, MemoryCategory::Locks, sizeof(mutex_record_t) +
+                   hash_map_node_bytes<decltype(td->mutex_record_index)>());
+  }
+  td->cached_mutex_record = insert_result.first->second;
+  return td->cached_mutex_record;
+}
+
+/* OMPT callback for a task requesting a lock, critical section, ordered
+ * region or lock-based atomic. The wait lasts until mutex_acquired; the
+ * request is attributed to the task running on this thread.
+ */
+static void
+on_ompt_callback_mutex_acquire(
+    ompt_mutex_kind_t kind,
+    unsigned int hint,
+    unsigned int impl,
+    omp_wait_id_t wait_id,
+    const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::MutexAcquire, NULL, NULL, NULL,
+                  kind, wait_id, hint, codeptr_ra);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  Task * task = td->current_task;
+  size_t index = find_mutex_record(td, task, kind, wait_id, codeptr_ra);
+
+  // A failed test lock, or a nest lock the task already holds, leaves a
+  // request that is never acquired; a new request replaces it
+  held_mutex_t * pending = find_held_mutex(td, wait_id, false);
+  if (pending == NULL) {
+    td->held_mutexes.push_back(held_mutex_t());
+    pending = &td->held_mutexes.back();
+  }
+  pending->wait_id = wait_id;
+  pending->record = index;
+  pending->acquire_time = get_timestamp();
+  pending->acquired_time = 0;
+}
+
+/* OMPT callback for a task getting the lock it requested */
+static void
+on_ompt_callback_mutex_acquired(
+    ompt_mutex_kind_t kind,
+    omp_wait_id_t wait_id,
+    const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::MutexAcquired, NULL, NULL, NULL,
+                  kind, wait_id, 0, codeptr_ra);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  held_mutex_t * held = find_held_mutex(td, wait_id, false);
+  if (held == NULL) {
+    // Requested while collection was paused
+    return;
+  }
+  uint64_t now = get_timestamp();
+  uint64_t wait = now - held->acquire_time;
+  mutex_record_t & record = td->mutex_records[held->record];
+  record.acquisitions++;
+  record.wait_time += wait;
+  record.max_wait = wait > record.max_wait ? wait : record.max_wait;
+  held->acquired_time = now;
+}
+
+/* OMPT callback for a task releasing a lock */
+static void
+on_ompt_callback_mutex_released(
+    ompt_mutex_kind_t kind,
+    omp_wait_id_t wait_id,
+    const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::MutexReleased, NULL, NULL, NULL,
+                  kind, wait_id, 0, codeptr_ra);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  held_mutex_t * held = find_held_mutex(td, wait_id, true);
+  if (held == NULL) {
+    return;
+  }
+  td->mutex_records[held->record].hold_time += get_timestamp() - held->acquired_time;
+  // Drop the lock, along with any request for it that was never acquired
+  std::vector<held_mutex_t> & mutexes = td->held_mutexes;
+  for (size_t i = mutexes.size(); i-- > 0; ) {
+    if (mutexes[i].wait_id == wait_id) {
+      mutexes.erase(mutexes.begin() + i);
+    }
+  }
+}
@@ -13,25 +13,52 @@ on_ompt_callback_parallel_begin(
   ompt_invoker_t invoker,
   const void *codeptr_ra)
 {
-#ifdef DEBUG
-  printf("\nENTERING PARALLEL_BEGIN\n"); 
-  if(parallel_data->ptr) {
-    printf("0: parallel_data initially not null\n");
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::ParallelBegin, encountering_task_data, parallel_data, NULL,
+                  requested_team_size, invoker, 0, codeptr_ra);
+#endif
+  if (parallel_data->ptr) {
+    DEBUG_EVENT(ParallelDataNotNull, (uintptr_t) parallel_data->ptr, 0, 0, 0);
   }
-#endif 
 
   // Get ID of this parallel region and its parent 
-  parallel_data->value = ompt_get_unique_id();
-  uint64_t parent_task_id = encountering_task_data->value;
-  uint64_t parallel_region_id = parallel_data->value; 
+  Task * parent = (Task *) encountering_task_data->ptr;
+  if (parent == NULL && current_tracing_window() > 0) {
+    parent = find_traced_ancestor();
+  }
+  uint64_t parent_task_id = parent ? parent->get_id() : 0;
+  uint64_t parallel_region_id = ompt_get_unique_id(); 
 
-#ifdef DEBUG
-  std::cout << "Creating ParallelRegion object" << std::endl;
-#endif
+  DEBUG_EVENT(ParallelBegin, parallel_region_id, parent_task_id,
+              requested_team_size, (uintptr_t) codeptr_ra);
   ParallelRegion * region = new ParallelRegion(parallel_region_id, 
                                                parent_task_id, 
                                                requested_team_size,
                                                codeptr_ra);
+  parallel_data->ptr = region;
+  region->set_begin_time(get_timestamp());
+
+  // A region nests inside the region of the implicit task currently running
+  // on this thread, if any
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  if (!td->implicit_frames.empty()) {
+    region->set_nesting_level(td->implicit_frames.back().region->get_nesting_level() + 1);
+  }
+
+  // The region is the encountering task's next child
+  if (parent) {
+#ifdef TRACK_SP_LABELS
+    region->set_label(SPLabel(parent->get_label(), parent->get_sp_state(),
+                              parent->get_sp_state().spawned, 0));
+#endif
+    region->set_child_index(parent->spawn_child());
+    region->set_depth(parent->get_depth() + 1);
+  }
+  live_count(td->live.parallel_regions);
+  live_depth(td->live, region->get_depth());
   register_parallel_region(region, tool_data_ptr); 
 
 
@@ -52,11 +79,39 @@ on_ompt_callback_parallel_end(
   ompt_invoker_t invoker,
   const void *codeptr_ra)
 {
-
-#ifdef DEBUG
-  printf("\nENTERING PARALLEL_END\n"); 
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::ParallelEnd, parallel_data, encountering_task_data, NULL,
+                  invoker, 0, 0, codeptr_ra);
 #endif
 
-  uint64_t parallel_id = parallel_data->value;
+  ParallelRegion * region = (ParallelRegion *) parallel_data->ptr;
+  if (region == NULL) {
+    // Began while collection was paused
+    return;
+  }
+  uint64_t parallel_id = region->get_id();
+  DEBUG_EVENT(ParallelEnd, parallel_id, 0, 0, 0);
+  region->set_end_time(get_timestamp());
+  timeline_record(get_thread_data(tool_data_ptr), TimelineEventKind::Region,
+                  region->get_begin_time(), region->get_duration(), parallel_id,
+                  region->get_codeptr_ra());
+
+  // Everything in the region, including explicit tasks bound to it, has
+  // completed at its implicit barrier
+  Task * parent = (Task *) encountering_task_data->ptr;
+  if (parent) {
+    sp_state_t parent_state = parent->get_sp_state();
+    uint32_t region_index = region->get_child_index();
+    if (parent_state.joined == region_index) {
+      parent_state.joined = region_index + 1;
+    }
+    if (parent_state.waited == region_index) {
+      parent_state.waited = region_index + 1;
+    }
+    parent->set_sp_state(parent_state);
+  }
 
 }
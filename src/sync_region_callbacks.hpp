@@ -0,0 +1,170 @@
+
+/* OMPT callback for taskwait, taskgroup and barrier regions.
+ * Each sync region is recorded as an event in the encountering thread's own
+ * buffer and becomes a join vertex in the tree when it is built. The
+ * encountering task's join state is advanced at the end of the region so
+ * that the series-parallel labels see the synchronization.
+ */
+static void
+on_ompt_callback_sync_region(
+  ompt_sync_region_kind_t kind,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t *parallel_data,
+  ompt_data_t *task_data,
+  const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::SyncRegion, parallel_data, task_data, NULL,
+                  kind, endpoint, 0, codeptr_ra);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  Task * task = (Task *) task_data->ptr;
+  DEBUG_EVENT(SyncRegion, kind, endpoint, task ? task->get_id() : 0, (uintptr_t) codeptr_ra);
+  note_numa_access(td, task);
+
+  if (endpoint == ompt_scope_begin) {
+    sync_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.id = ompt_get_unique_id();
+    event.kind = kind;
+    event.codeptr_ra = codeptr_ra;
+    event.begin_time = get_timestamp();
+    if (task) {
+      const sp_state_t & state = task->get_sp_state();
+      event.task_id = task->get_id();
+      event.instance = state.phase;
+      if (kind == ompt_sync_region_taskwait) {
+        // A taskwait joins the children created since the last one
+        event.join_begin = state.waited;
+      } else if (kind == ompt_sync_region_barrier) {
+        // A barrier joins everything not joined before
+        event.join_begin = state.joined;
+      } else {
+        // A taskgroup joins the children created inside it
+        event.join_begin = state.spawned;
+      }
+      event.join_end = state.spawned;
+      // The parent of an implicit task is its parallel region
+      if (kind == ompt_sync_region_barrier && task->get_type() == TaskType::Implicit) {
+        event.parallel_id = task->get_parent_id();
+        if (!td->implicit_frames.empty() && td->implicit_frames.back().task == task) {
+          td->implicit_frames.back().region->note_barrier_arrival(event.begin_time);
+        }
+      }
+    }
+    td->open_sync_events.push_back(td->sync_events.size());
+    td->sync_events.push_back(event);
+
+  } else if (endpoint == ompt_scope_end) {
+    if (td->open_sync_events.empty()) {
+      return;
+    }
+    sync_event_t & event = td->sync_events[td->open_sync_events.back()];
+    td->open_sync_events.pop_back();
+    event.end_time = get_timestamp();
+    if (task) {
+      sp_state_t state = task->get_sp_state();
+      switch (kind) {
+        case ompt_sync_region_taskwait:
+        {
+          if (state.waited < event.join_end) {
+            state.waited = event.join_end;
+          }
+          break;
+        }
+        case ompt_sync_region_taskgroup:
+        {
+          // Children created inside the taskgroup are now joined along with
+          // their descendants. Only extend the marks if nothing created
+          // before the taskgroup is still outstanding.
+          event.join_end = state.spawned;
+          if (state.joined >= event.join_begin) {
+            state.joined = event.join_end;
+          }
+          if (state.waited >= event.join_begin) {
+            state.waited = event.join_end;
+          }
+          break;
+        }
+        case ompt_sync_region_barrier:
+        {
+          // All tasks bound to the team have completed
+          state.phase++;
+          state.waited = state.spawned;
+          state.joined = state.spawned;
+          break;
+        }
+        default:
+          break;
+      }
+      task->set_sp_state(state);
+    }
+  }
+}
+
+
+/* OMPT callback for the time a thread spends waiting inside a sync region.
+ * The waiting time is attributed to the innermost open sync region of the
+ * same kind on this thread.
+ */
+static void
+on_ompt_callback_sync_region_wait(
+  ompt_sync_region_kind_t kind,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t *parallel_data,
+  ompt_data_t *task_data,
+  const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::SyncRegionWait, parallel_data, task_data, NULL,
+                  kind, endpoint, 0, codeptr_ra);
+#endif
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+
+  // Time the outermost wait on this thread. Tasks executed while waiting are
+  // not idle time; everything else is charged to the current implicit task.
+  if (endpoint == ompt_scope_begin) {
+    if (td->wait_depth == 0) {
+      switch_current_task(td, td->current_task, now);
+      td->wait_begin_time = now;
+      td->wait_task = td->current_task;
+      td->task_time_in_wait = 0;
+      td->current_task_start = 0;
+    }
+    td->wait_depth++;
+  } else if (endpoint == ompt_scope_end && td->wait_depth > 0) {
+    if (td->wait_depth == 1) {
+      switch_current_task(td, td->current_task, now);
+      uint64_t wait = now - td->wait_begin_time;
+      uint64_t idle = wait > td->task_time_in_wait ? wait - td->task_time_in_wait : 0;
+      if (!td->implicit_frames.empty()) {
+        td->implicit_frames.back().idle_time += idle;
+      }
+      td->wait_task = NULL;
+      td->current_task_start = td->current_task ? now : 0;
+    }
+    td->wait_depth--;
+  }
+
+  if (td->open_sync_events.empty()) {
+    return;
+  }
+  sync_event_t & event = td->sync_events[td->open_sync_events.back()];
+  if (event.kind != kind) {
+    return;
+  }
+  if (endpoint == ompt_scope_begin) {
+    event.wait_begin_time = now;
+  } else if (endpoint == ompt_scope_end && event.wait_begin_time != 0) {
+    event.wait_time += now - event.wait_begin_time;
+    event.wait_begin_time = 0;
+  }
+}
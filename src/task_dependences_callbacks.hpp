@@ -0,0 +1,47 @@
+/* OMPT callback reporting the depend clause of a new task.
+ * The runtime reports each task's dependence addresses but not which earlier
+ * tasks they make it wait for, so the producers are found in the parent
+ * task's dependence table and the edges are recorded on both tasks.
+ */
+static void
+on_ompt_callback_task_dependences(
+    ompt_data_t *task_data,
+    const ompt_task_dependence_t *deps,
+    int ndeps)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  for (int i = 0; i < ndeps; i++) {
+    record_callback(CallbackKind::TaskDependence, task_data, NULL, NULL,
+                    (uint64_t) deps[i].variable_addr, deps[i].dependence_flags,
+                    ((uint64_t) i << 32) | (uint32_t) ndeps, NULL);
+  }
+#endif
+
+  Task * t = task_data ? (Task *) task_data->ptr : NULL;
+  if (t == NULL || ndeps <= 0) {
+    return;
+  }
+
+  // The parent is the task executing on this thread, which is creating t
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  Task * parent = td->current_task;
+  if (parent == NULL || parent->get_id() != t->get_parent_id()) {
+    parent = find_task(t->get_parent_id(), tool_data_ptr);
+  }
+  if (parent == NULL) {
+    DEBUG_EVENT(DependencesWithoutParent, t->get_id(), 0, 0, 0);
+    return;
+  }
+
+  size_t edges = parent->get_dependence_table()->resolve(t, deps, ndeps,
+    [](Task * producer, Task * consumer) {
+      producer->add_dependency_child(consumer);
+      consumer->add_dependency_parent(producer);
+    });
+  DEBUG_EVENT(TaskDependences, t->get_id(), ndeps, edges, 0);
+  td->dependences_resolved += ndeps;
+  td->dependence_edges += edges;
+}
@@ -0,0 +1,62 @@
+
+/* OMPT callback for task scheduling points.
+ * The first time a task is scheduled records the thread that executes it,
+ * which tells us whether it was stolen from the thread that created it. Every
+ * switch charges the elapsed time to the task that was running.
+ */
+static void
+on_ompt_callback_task_schedule(
+    ompt_data_t *prior_task_data,
+    ompt_task_status_t prior_task_status,
+    ompt_data_t *next_task_data)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::TaskSchedule, prior_task_data, next_task_data, NULL,
+                  prior_task_status, 0, 0, NULL);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+  Task * prior = prior_task_data ? (Task *) prior_task_data->ptr : NULL;
+  Task * next = next_task_data ? (Task *) next_task_data->ptr : NULL;
+  DEBUG_EVENT(TaskSchedule, prior ? prior->get_id() : 0, prior_task_status,
+              next ? next->get_id() : 0, 0);
+
+  note_numa_access(td, prior);
+  note_numa_access(td, next);
+
+  if (prior) {
+    if (prior_task_status == ompt_task_complete) {
+      prior->change_state(TaskState::Completed);
+    } else {
+      prior->change_state(TaskState::Suspended);
+    }
+  }
+
+  if (next) {
+    if (!next->has_executed()) {
+      next->set_executing_thread(td->index);
+      thread_region_stats_t & stats = get_region_stats(td, next->get_region_id());
+      stats.tasks_executed++;
+      if (next->get_creating_thread() != td->index) {
+        stats.tasks_stolen++;
+      }
+      if (!next->is_initial()) {
+        timeline_record(td, TimelineEventKind::FlowEnd, now, 0, next->get_id(), NULL);
+      }
+    }
+    next->change_state(TaskState::Running);
+  }
+
+  switch_current_task(td, next, now);
+
+  if (prior && prior_task_status == ompt_task_complete) {
+    // A completed task creates no more children
+    prior->release_dependence_table();
+    note_task_completed(prior, tool_data_ptr);
+    live_count(td->live.tasks_completed);
+  }
+}
@@ -0,0 +1,109 @@
+
+static const char * worksharing_name(int wstype)
+{
+  static const char * names[] = {"Worksharing", "Loop", "Sections", "Single", "Single",
+                                 "Workshare", "Distribute", "Taskloop"};
+  return wstype >= 0 && wstype < (int) (sizeof(names) / sizeof(names[0])) ? names[wstype] : names[0];
+}
+
+/* Close the chunk the thread was executing in a worksharing construct */
+static inline void close_loop_chunk(thread_data_t * td, loop_event_t & event, uint64_t now)
+{
+  if (event.chunks > 0) {
+    loop_chunk_t & chunk = td->loop_chunks[event.last_chunk];
+    if (chunk.end_time == 0) {
+      chunk.end_time = now;
+    }
+  }
+}
+
+/* OMPT callback for the begin and end of worksharing constructs.
+ * Each thread of the team records its own share in its buffer; the shares
+ * are matched up across threads at finalize to measure imbalance, and each
+ * becomes a child of its implicit task in the tree.
+ */
+static void
+on_ompt_callback_work(
+    ompt_work_type_t wstype,
+    ompt_scope_endpoint_t endpoint,
+    ompt_data_t *parallel_data,
+    ompt_data_t *task_data,
+    uint64_t count,
+    const void *codeptr_ra)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::Work, parallel_data, task_data, NULL,
+                  wstype, endpoint, count, codeptr_ra);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  uint64_t now = get_timestamp();
+  if (endpoint == ompt_scope_begin) {
+    Task * task = task_data ? (Task *) task_data->ptr : NULL;
+    loop_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.id = ompt_get_unique_id();
+    event.task_id = task ? task->get_id() : 0;
+    event.codeptr_ra = codeptr_ra;
+    event.wstype = wstype;
+    event.count = count;
+    event.begin_time = now;
+    event.instance = event.id;
+    if (task && !td->implicit_frames.empty() && td->implicit_frames.back().task == task) {
+      implicit_frame_t & frame = td->implicit_frames.back();
+      event.region_id = frame.region_id;
+      event.instance = frame.worksharing++;
+    }
+    td->open_loops.push_back(td->loop_events.size());
+    td->loop_events.push_back(event);
+    account_memory(tool_data_ptr->memory, MemoryCategory::Loops, sizeof(loop_event_t));
+
+  } else if (endpoint == ompt_scope_end) {
+    if (td->open_loops.empty()) {
+      return;
+    }
+    loop_event_t & event = td->loop_events[td->open_loops.back()];
+    td->open_loops.pop_back();
+    event.end_time = now;
+    close_loop_chunk(td, event, now);
+  }
+}
+
+
+#ifdef TRACK_LOOP_DISPATCH
+/* OMPT callback for each chunk of a loop, or section, handed to a thread.
+ * The chunk runs until the thread's next dispatch or the end of the
+ * construct. Needs a runtime that implements ompt_callback_dispatch.
+ */
+static void
+on_ompt_callback_dispatch(
+    ompt_data_t *parallel_data,
+    ompt_data_t *task_data,
+    ompt_dispatch_t kind,
+    ompt_data_t instance)
+{
+  if (tracing_is_paused()) {
+    return;
+  }
+#ifdef RECORD_CALLBACKS
+  record_callback(CallbackKind::Dispatch, parallel_data, task_data, NULL,
+                  kind, instance.value, 0, NULL);
+#endif
+
+  thread_data_t * td = get_thread_data(tool_data_ptr);
+  if (td->open_loops.empty()) {
+    return;
+  }
+  uint64_t now = get_timestamp();
+  loop_event_t & event = td->loop_events[td->open_loops.back()];
+  close_loop_chunk(td, event, now);
+  loop_chunk_t chunk = {td->open_loops.back(), instance.value, now, 0};
+  event.last_chunk = td->loop_chunks.size();
+  event.chunks++;
+  td->loop_chunks.push_back(chunk);
+  account_memory(tool_data_ptr->memory, MemoryCategory::Loops, sizeof(loop_chunk_t));
+}
+#endif
@@ -0,0 +1,113 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "AncestryIndex.hpp"
+
+/******************************************************************************\
+ * Command-line front end for the ancestry index written by the tool.
+ *
+ * Usage: ancestry_query <index file> <command> [task/region IDs...]
+ *        ancestry_query <index file> -
+ *
+ * Commands:
+ *   lca A B        lowest common ancestor of A and B
+ *   ancestor A B   1 if A is an ancestor of B, 0 otherwise
+ *   depth A        depth of A (roots have depth 0)
+ *   size A         number of vertices in the subtree rooted at A
+ *   parent A       parent of A
+ *   stats          number of vertices in the index
+ *
+ * With "-" the commands are read one per line from stdin, which lets scripts
+ * issue many queries against a single mapping of the index.
+\******************************************************************************/
+
+static void usage(const char * prog) {
+  printf("Usage: %s <index file> <lca|ancestor|depth|size|parent|stats> [IDs...]\n", prog);
+  printf("       %s <index file> -\n", prog);
+}
+
+static bool lookup(const AncestryIndex & index, const std::string & arg, uint32_t * v) {
+  uint64_t id = strtoull(arg.c_str(), NULL, 10);
+  *v = index.find(id);
+  if (*v == AncestryIndex::npos) {
+    printf("unknown id %" PRIu64 "\n", id);
+    return false;
+  }
+  return true;
+}
+
+static void run_query(const AncestryIndex & index, const std::vector<std::string> & args) {
+  if (args.empty()) {
+    return;
+  }
+  const std::string & cmd = args[0];
+  uint32_t a, b;
+  if (cmd == "stats") {
+    printf("%" PRIu64 "\n", index.size());
+  } else if (cmd == "lca" && args.size() == 3) {
+    if (lookup(index, args[1], &a) && lookup(index, args[2], &b)) {
+      uint32_t l = index.lca(a, b);
+      if (l == AncestryIndex::npos) {
+        printf("none\n");
+      } else {
+        printf("%" PRIu64 "\n", index.get_id(l));
+      }
+    }
+  } else if (cmd == "ancestor" && args.size() == 3) {
+    if (lookup(index, args[1], &a) && lookup(index, args[2], &b)) {
+      printf("%d\n", index.is_ancestor(a, b) ? 1 : 0);
+    }
+  } else if (cmd == "depth" && args.size() == 2) {
+    if (lookup(index, args[1], &a)) {
+      printf("%u\n", index.get_depth(a));
+    }
+  } else if (cmd == "size" && args.size() == 2) {
+    if (lookup(index, args[1], &a)) {
+      printf("%u\n", index.get_subtree_size(a));
+    }
+  } else if (cmd == "parent" && args.size() == 2) {
+    if (lookup(index, args[1], &a)) {
+      uint32_t p = index.get_parent(a);
+      if (p == AncestryIndex::npos) {
+        printf("none\n");
+      } else {
+        printf("%" PRIu64 "\n", index.get_id(p));
+      }
+    }
+  } else {
+    printf("bad query: %s\n", cmd.c_str());
+  }
+}
+
+int main(int argc, char ** argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  AncestryIndex index(argv[1]);
+  if (!index.is_open()) {
+    printf("Could not open ancestry index %s\n", argv[1]);
+    return 1;
+  }
+  if (strcmp(argv[2], "-") == 0) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      std::istringstream iss(line);
+      std::vector<std::string> args;
+      std::string word;
+      while (iss >> word) {
+        args.push_back(word);
+      }
+      run_query(index, args);
+    }
+  } else {
+    std::vector<std::string> args(argv + 2, argv + argc);
+    run_query(index, args);
+  }
+  return 0;
+}
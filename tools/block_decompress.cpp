@@ -0,0 +1,66 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "BlockCompression.hpp"
+
+/******************************************************************************\
+ * Decompress a block-compressed tool output.
+ *
+ * Usage: block_decompress <input.blk> <output> [threads]
+ *
+ * Blocks are independent, so worker threads claim blocks and write each one
+ * straight to its raw offset in the output.
+\******************************************************************************/
+
+int main(int argc, char ** argv) {
+  if (argc < 3) {
+    printf("Usage: %s <input.blk> <output> [threads]\n", argv[0]);
+    return 1;
+  }
+  BlockFileReader reader(argv[1]);
+  if (!reader.is_open()) {
+    printf("Could not open block file %s\n", argv[1]);
+    return 1;
+  }
+  int fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, reader.get_raw_size()) != 0) {
+    printf("Could not create %s\n", argv[2]);
+    return 1;
+  }
+  unsigned n_threads = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+  if (n_threads == 0) {
+    n_threads = 1;
+  }
+
+  std::atomic<size_t> next_block(0);
+  std::atomic<bool> failed(false);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; t++) {
+    workers.push_back(std::thread([&] {
+      std::vector<char> raw;
+      for (size_t i = next_block++; i < reader.get_num_blocks(); i = next_block++) {
+        const block_index_entry_t & entry = reader.get_block(i);
+        if (!reader.read_block(i, raw) ||
+            pwrite(fd, raw.data(), raw.size(), entry.raw_offset) != (ssize_t) raw.size()) {
+          failed = true;
+          return;
+        }
+      }
+    }));
+  }
+  for (auto & w : workers) {
+    w.join();
+  }
+  close(fd);
+  if (failed) {
+    printf("Decompression of %s failed\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
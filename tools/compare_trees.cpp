@@ -0,0 +1,81 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "SubtreeHash.hpp"
+
+/******************************************************************************\
+ * Compare the task trees of two runs from their subtree hash files
+ * (TASK_TREE_HASHFILE).
+ *
+ * Usage: compare_trees [-n max reports] <run A hash file> <run B hash file>
+ *
+ * Prints "identical" if the trees have the same structure. Otherwise it
+ * prints the divergences found walking both trees from the roots: vertices
+ * whose type or call site changed, and subtrees present in only one run, with
+ * their depth, IDs and sizes. Exits with 0 if the trees are identical, 1 if
+ * they differ and 2 on errors.
+\******************************************************************************/
+
+static const char * type_names[] = {"explicit task", "implicit task", "parallel region",
+                                    "barrier", "taskwait", "taskgroup", "worksharing"};
+
+static void usage(const char * prog) {
+  printf("Usage: %s [-n max reports] <hash file A> <hash file B>\n", prog);
+}
+
+static void print_vertex(const char * side, const SubtreeHashFile & file, uint32_t v) {
+  const subtree_hash_vertex_t & vertex = file[v];
+  printf("    %s: %s %" PRIu64 " at %s+0x%" PRIx64 ", %" PRIu64 " vertices\n", side,
+         vertex.type < sizeof(type_names) / sizeof(type_names[0]) ? type_names[vertex.type] : "?",
+         vertex.id, file.get_module(v), vertex.offset, vertex.subtree_size);
+}
+
+int main(int argc, char ** argv) {
+  uint64_t max_reports = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') {
+      max_reports = strtoull(optarg, NULL, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  SubtreeHashFile a(argv[optind]);
+  SubtreeHashFile b(argv[optind + 1]);
+  if (!a.is_open() || !b.is_open()) {
+    printf("Could not open %s\n", a.is_open() ? argv[optind + 1] : argv[optind]);
+    return 2;
+  }
+  if (a.get_forest_hash() == b.get_forest_hash()) {
+    printf("identical (%" PRIu64 " vertices)\n", a.size());
+    return 0;
+  }
+
+  printf("trees differ (%" PRIu64 " vs %" PRIu64 " vertices)\n", a.size(), b.size());
+  uint64_t reports = compare_subtree_hashes(a, b, max_reports,
+    [&](SubtreeDiff kind, uint32_t x, uint32_t y, uint32_t depth) {
+      if (kind == SubtreeDiff::Changed) {
+        printf("  depth %u: changed\n", depth);
+        print_vertex("A", a, x);
+        print_vertex("B", b, y);
+      } else if (kind == SubtreeDiff::OnlyInA) {
+        printf("  depth %u: only in A\n", depth);
+        print_vertex("A", a, x);
+      } else {
+        printf("  depth %u: only in B\n", depth);
+        print_vertex("B", b, y);
+      }
+    });
+  if (max_reports != 0 && reports == max_reports) {
+    printf("  (stopped after %" PRIu64 " differences, use -n to see more)\n", reports);
+  }
+  return 1;
+}
@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "LiveStats.hpp"
+
+/******************************************************************************\
+ * Watch a running job's live statistics (TASK_TREE_LIVE_STATS).
+ *
+ * Usage: live_monitor [-i seconds] [-n count] <pid | segment name>
+ *
+ * Attaches to the shared memory segment read-only and prints, every interval
+ * (1 second by default), the task creation and completion rates, the number
+ * of live tasks, the parallel region rate, the deepest task seen and the
+ * number of threads. A pid stands for the default segment /ompt_tree.<pid>.
+ * Stops after count lines, or when the job exits.
+\******************************************************************************/
+
+static void usage(const char * prog) {
+  printf("Usage: %s [-i seconds] [-n count] <pid | segment name>\n", prog);
+}
+
+static double rate(uint64_t now, uint64_t before, double seconds) {
+  return seconds > 0 ? (now - before) / seconds : 0.0;
+}
+
+int main(int argc, char ** argv) {
+  double interval = 1.0;
+  uint64_t count = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+    if (opt == 'i') {
+      interval = atof(optarg);
+    } else if (opt == 'n') {
+      count = strtoull(optarg, NULL, 10);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc || interval <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string name = argv[optind];
+  if (strspn(name.c_str(), "0123456789") == name.size()) {
+    name = "/ompt_tree." + name;
+  } else if (name[0] != '/') {
+    name = "/" + name;
+  }
+  LiveStats stats;
+  if (!stats.attach(name)) {
+    printf("Could not attach to live statistics segment %s\n", name.c_str());
+    return 1;
+  }
+  pid_t pid = stats.get_pid();
+
+  live_stats_values_t last;
+  stats.read(last);
+  printf("%10s %14s %14s %12s %12s %8s %8s\n", "time (s)", "created/s", "completed/s",
+         "live tasks", "regions/s", "depth", "threads");
+  uint64_t start = last.time;
+  for (uint64_t n = 0; count == 0 || n < count; n++) {
+    usleep((useconds_t) (interval * 1e6));
+    live_stats_values_t current;
+    stats.read(current);
+    if (current.updates == last.updates && kill(pid, 0) != 0 && errno == ESRCH) {
+      printf("Process %d has exited\n", (int) pid);
+      break;
+    }
+    double seconds = (current.time - last.time) * 1e-9;
+    uint64_t live = current.tasks_created > current.tasks_completed ?
+                    current.tasks_created - current.tasks_completed : 0;
+    printf("%10.1f %14.0f %14.0f %12" PRIu64 " %12.0f %8" PRIu64 " %8" PRIu64 "\n",
+           (current.time - start) * 1e-9,
+           rate(current.tasks_created, last.tasks_created, seconds),
+           rate(current.tasks_completed, last.tasks_completed, seconds),
+           live,
+           rate(current.parallel_regions, last.parallel_regions, seconds),
+           current.max_depth, current.threads);
+    fflush(stdout);
+    last = current;
+  }
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MergedDataset.hpp"
+
+/******************************************************************************\
+ * Merge the per-process outputs of a multi-process run into one dataset.
+ *
+ * Usage: merge_outputs -o <merged> [-j threads] <files...>
+ *
+ * The rank of each file is taken from the ".r<rank>" part of its name (as
+ * written when the tool runs under an MPI launcher), falling back to its
+ * position on the command line. Offsets of all entries are known up front, so
+ * worker threads copy files in chunks straight to their place in the output.
+ * Inputs are copied MERGE_BATCH_FILES at a time, so that runs with many ranks
+ * stay below the open file limit.
+\******************************************************************************/
+
+#define COPY_CHUNK_SIZE (4 << 20)
+#define MERGE_BATCH_FILES 256
+
+typedef struct copy_chunk {
+  size_t file;
+  uint64_t offset;
+  uint64_t size;
+} copy_chunk_t;
+
+static int64_t rank_from_name(const std::string & path, int64_t fallback)
+{
+  size_t slash = path.find_last_of('/');
+  size_t pos = slash == std::string::npos ? 0 : slash + 1;
+  while ((pos = path.find(".r", pos)) != std::string::npos) {
+    size_t end = pos + 2;
+    while (end < path.size() && path[end] >= '0' && path[end] <= '9') {
+      end++;
+    }
+    if (end > pos + 2 && (end == path.size() || path[end] == '.')) {
+      return strtoll(path.substr(pos + 2, end - pos - 2).c_str(), NULL, 10);
+    }
+    pos += 2;
+  }
+  return fallback;
+}
+
+int main(int argc, char ** argv) {
+  std::string output;
+  unsigned n_threads = std::thread::hardware_concurrency();
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      n_threads = atoi(argv[++i]);
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+  if (output.empty() || inputs.empty()) {
+    printf("Usage: %s -o <merged> [-j threads] <files...>\n", argv[0]);
+    return 1;
+  }
+  if (n_threads == 0) {
+    n_threads = 1;
+  }
+
+  // Lay out the entries and split their payloads into chunks. Each input is
+  // only open while it is being inspected here and while its batch is copied.
+  std::vector<int> in_fds(inputs.size(), -1);
+  std::vector<merged_entry_t> entries(inputs.size());
+  std::vector<copy_chunk_t> chunks;
+  uint64_t offset = merged_align(sizeof(merged_header_t));
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    int in_fd = open(inputs[i].c_str(), O_RDONLY);
+    if (in_fd < 0 || fstat(in_fd, &st) != 0) {
+      printf("Could not open %s\n", inputs[i].c_str());
+      return 1;
+    }
+    char head[8] = {0};
+    ssize_t n_head = pread(in_fd, head, sizeof(head), 0);
+    close(in_fd);
+
+    merged_entry_t & entry = entries[i];
+    memset(&entry, 0, sizeof(entry));
+    entry.rank = rank_from_name(inputs[i], i);
+    entry.kind = detect_output_kind(head, n_head > 0 ? n_head : 0);
+    if (entry.kind == OutputKind::Unknown) {
+      printf("%s is not an output of the tool\n", inputs[i].c_str());
+      return 1;
+    }
+    entry.offset = offset;
+    entry.size = st.st_size;
+    size_t slash = inputs[i].find_last_of('/');
+    std::string name = slash == std::string::npos ? inputs[i] : inputs[i].substr(slash + 1);
+    strncpy(entry.name, name.c_str(), MERGED_NAME_LEN - 1);
+
+    for (uint64_t done = 0; done < entry.size; done += COPY_CHUNK_SIZE) {
+      uint64_t size = entry.size - done < COPY_CHUNK_SIZE ? entry.size - done : COPY_CHUNK_SIZE;
+      chunks.push_back({i, done, size});
+    }
+    offset = merged_align(offset + entry.size);
+  }
+
+  merged_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MERGED_DATASET_MAGIC, 8);
+  header.version = MERGED_DATASET_VERSION;
+  header.n_entries = entries.size();
+  header.toc_offset = offset;
+
+  int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ssize_t toc_bytes = entries.size() * sizeof(merged_entry_t);
+  if (fd < 0 ||
+      pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      pwrite(fd, entries.data(), toc_bytes, offset) != toc_bytes) {
+    printf("Could not create %s\n", output.c_str());
+    return 1;
+  }
+
+  // Chunks are in input order, so each batch of files is a range of chunks
+  std::atomic<bool> failed(false);
+  size_t batch_chunk = 0;
+  for (size_t first = 0; first < inputs.size() && !failed; first += MERGE_BATCH_FILES) {
+    size_t last = first + MERGE_BATCH_FILES < inputs.size() ? first + MERGE_BATCH_FILES
+                                                            : inputs.size();
+    for (size_t i = first; i < last; i++) {
+      in_fds[i] = open(inputs[i].c_str(), O_RDONLY);
+      if (in_fds[i] < 0) {
+        printf("Could not open %s\n", inputs[i].c_str());
+        failed = true;
+      }
+    }
+    size_t batch_end = batch_chunk;
+    while (batch_end < chunks.size() && chunks[batch_end].file < last) {
+      batch_end++;
+    }
+    std::atomic<size_t> next_chunk(batch_chunk);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < n_threads && !failed; t++) {
+      workers.push_back(std::thread([&] {
+        std::vector<char> buffer(COPY_CHUNK_SIZE);
+        for (size_t c = next_chunk++; c < batch_end && !failed; c = next_chunk++) {
+          const copy_chunk_t & chunk = chunks[c];
+          const merged_entry_t & entry = entries[chunk.file];
+          if (pread(in_fds[chunk.file], buffer.data(), chunk.size, chunk.offset) != (ssize_t) chunk.size ||
+              pwrite(fd, buffer.data(), chunk.size, entry.offset + chunk.offset) != (ssize_t) chunk.size) {
+            failed = true;
+            return;
+          }
+        }
+      }));
+    }
+    for (auto & w : workers) {
+      w.join();
+    }
+    for (size_t i = first; i < last; i++) {
+      if (in_fds[i] >= 0) {
+        close(in_fds[i]);
+        in_fds[i] = -1;
+      }
+    }
+    batch_chunk = batch_end;
+  }
+  close(fd);
+  if (failed) {
+    printf("Merging into %s failed\n", output.c_str());
+    return 1;
+  }
+
+  for (const merged_entry_t & entry : entries) {
+    printf("rank %" PRId64 "\t%s\t%" PRIu64 " bytes\t%s\n", entry.rank,
+           output_kind_name(entry.kind), entry.size, entry.name);
+  }
+  return 0;
+}
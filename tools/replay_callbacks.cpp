@@ -0,0 +1,370 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// The tool itself, built into the harness so its callbacks can be called
+// directly
+#include "ancestry_tracker.cpp"
+#include "CallbackRecord.hpp"
+
+/******************************************************************************\
+ * Replay a callback log recorded with RECORD_CALLBACKS into the tool's
+ * callbacks, without an OpenMP runtime.
+ *
+ * Usage: replay_callbacks [-c] [-n] [-q] <callbacks.rec>
+ *   -c  replay the threads concurrently (see below)
+ *   -n  stop after the callbacks; skip ompt_finalize (tree build and output)
+ *   -q  send the tool's own output to /dev/null while timing
+ *
+ * One replay thread stands in for each recorded thread and delivers that
+ * thread's callbacks, so per-thread tool state sees the same threads as the
+ * recorded run. By default callbacks are delivered in the recorded global
+ * order: a thread waits until every earlier callback has returned before it
+ * invokes its next one. Only one callback runs at a time, so this measures
+ * the tool's cost per callback, not how it scales.
+ *
+ * With -c, a thread only waits for the earlier callbacks of other threads
+ * that touched the same ompt_data_t objects (a task is created before it is
+ * scheduled, an implicit task begins before its barriers, and so on), and
+ * otherwise runs as fast as it can. This keeps every order the tool relies
+ * on while letting threads contend for the tool's locks as they would in a
+ * real run.
+ *
+ * The OMPT entry points the tool looks up are stubs, so the measured time
+ * is the tool's own. Each callback goes to whatever function the tool
+ * registered for it, so TASK_TREE_MODE selects the mode that is measured.
+\******************************************************************************/
+
+typedef struct replay_op {
+  const callback_record_t * record;
+  ompt_data_t * data[3];
+  // With -c: for each object, the latest earlier record of another thread
+  // that touched it, all of which must return first; -1 for none
+  int64_t after[3];
+} replay_op_t;
+
+// Stand-ins for the runtime's ompt_data_t objects, one per recorded address
+static std::deque<ompt_data_t> replay_data;
+
+static std::atomic<uint64_t> replay_next_id(1);
+static thread_local ompt_data_t * replay_parallel_data = NULL;
+static thread_local ompt_data_t replay_thread_data;
+// Dependence list being reassembled from one record per dependence
+static thread_local std::vector<ompt_task_dependence_t> replay_deps;
+
+
+// Callbacks the tool registered, by ompt_callbacks_t
+static ompt_callback_t replay_callbacks[64];
+
+/* Stubbed OMPT entry points */
+static int replay_set_callback(ompt_callbacks_t which, ompt_callback_t callback) {
+  replay_callbacks[which] = callback;
+  return ompt_set_always;
+}
+
+static uint64_t replay_get_unique_id(void) {
+  return replay_next_id++;
+}
+
+static int replay_get_parallel_info(int ancestor_level, ompt_data_t ** parallel_data,
+                                    int * team_size) {
+  if (ancestor_level != 0 || replay_parallel_data == NULL) {
+    return 0;
+  }
+  if (parallel_data) {
+    *parallel_data = replay_parallel_data;
+  }
+  if (team_size) {
+    *team_size = 1;
+  }
+  return 2;
+}
+
+static ompt_data_t * replay_get_thread_data(void) {
+  return &replay_thread_data;
+}
+
+static int replay_unsupported() {
+  return 0;
+}
+
+static ompt_interface_fn_t replay_lookup(const char * name) {
+  if (strcmp(name, "ompt_set_callback") == 0) {
+    return (ompt_interface_fn_t) replay_set_callback;
+  } else if (strcmp(name, "ompt_get_unique_id") == 0) {
+    return (ompt_interface_fn_t) replay_get_unique_id;
+  } else if (strcmp(name, "ompt_get_parallel_info") == 0) {
+    return (ompt_interface_fn_t) replay_get_parallel_info;
+  } else if (strcmp(name, "ompt_get_thread_data") == 0) {
+    return (ompt_interface_fn_t) replay_get_thread_data;
+  }
+  return (ompt_interface_fn_t) replay_unsupported;
+}
+
+
+#define REPLAY_CALLBACK(name) ((name##_t) replay_callbacks[name])
+
+static void replay_one(const replay_op_t & op) {
+  const callback_record_t & r = *op.record;
+  const void * codeptr_ra = (const void *) r.codeptr_ra;
+  switch (r.kind) {
+    case CallbackKind::TaskCreate:
+      replay_parallel_data = op.data[2];
+      if (REPLAY_CALLBACK(ompt_callback_task_create)) {
+        REPLAY_CALLBACK(ompt_callback_task_create)(op.data[0], NULL, op.data[1], r.args[0],
+                                                   r.args[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::ImplicitTask:
+      if (REPLAY_CALLBACK(ompt_callback_implicit_task)) {
+        REPLAY_CALLBACK(ompt_callback_implicit_task)((ompt_scope_endpoint_t) r.args[0],
+                                                     op.data[0], op.data[1], r.args[1],
+                                                     r.args[2]);
+      }
+      break;
+    case CallbackKind::ParallelBegin:
+      if (REPLAY_CALLBACK(ompt_callback_parallel_begin)) {
+        REPLAY_CALLBACK(ompt_callback_parallel_begin)(op.data[0], NULL, op.data[1], r.args[0],
+                                                      (ompt_invoker_t) r.args[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::ParallelEnd:
+      if (REPLAY_CALLBACK(ompt_callback_parallel_end)) {
+        REPLAY_CALLBACK(ompt_callback_parallel_end)(op.data[0], op.data[1],
+                                                    (ompt_invoker_t) r.args[0], codeptr_ra);
+      }
+      break;
+    case CallbackKind::SyncRegion:
+      if (REPLAY_CALLBACK(ompt_callback_sync_region)) {
+        REPLAY_CALLBACK(ompt_callback_sync_region)((ompt_sync_region_kind_t) r.args[0],
+                                                   (ompt_scope_endpoint_t) r.args[1],
+                                                   op.data[0], op.data[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::SyncRegionWait:
+      if (replay_callbacks[ompt_callback_sync_region_wait]) {
+        ((ompt_callback_sync_region_t) replay_callbacks[ompt_callback_sync_region_wait])(
+          (ompt_sync_region_kind_t) r.args[0], (ompt_scope_endpoint_t) r.args[1],
+          op.data[0], op.data[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::TaskSchedule:
+      if (REPLAY_CALLBACK(ompt_callback_task_schedule)) {
+        REPLAY_CALLBACK(ompt_callback_task_schedule)(op.data[0], (ompt_task_status_t) r.args[0],
+                                                     op.data[1]);
+      }
+      break;
+    case CallbackKind::TaskDependence:
+    {
+      ompt_task_dependence_t dep;
+      dep.variable_addr = (void *) r.args[0];
+      dep.dependence_flags = r.args[1];
+      replay_deps.push_back(dep);
+      uint32_t index = r.args[2] >> 32;
+      uint32_t ndeps = (uint32_t) r.args[2];
+      if (index + 1 == ndeps) {
+        if (REPLAY_CALLBACK(ompt_callback_task_dependences)) {
+          REPLAY_CALLBACK(ompt_callback_task_dependences)(op.data[0], replay_deps.data(), ndeps);
+        }
+        replay_deps.clear();
+      }
+      break;
+    }
+    case CallbackKind::Work:
+      if (REPLAY_CALLBACK(ompt_callback_work)) {
+        REPLAY_CALLBACK(ompt_callback_work)((ompt_work_type_t) r.args[0],
+                                            (ompt_scope_endpoint_t) r.args[1],
+                                            op.data[0], op.data[1], r.args[2], codeptr_ra);
+      }
+      break;
+    case CallbackKind::Dispatch:
+#ifdef TRACK_LOOP_DISPATCH
+      if (REPLAY_CALLBACK(ompt_callback_dispatch)) {
+        ompt_data_t instance;
+        instance.value = r.args[1];
+        REPLAY_CALLBACK(ompt_callback_dispatch)(op.data[0], op.data[1],
+                                                (ompt_dispatch_t) r.args[0], instance);
+      }
+#endif
+      break;
+    case CallbackKind::MutexAcquire:
+      if (REPLAY_CALLBACK(ompt_callback_mutex_acquire)) {
+        REPLAY_CALLBACK(ompt_callback_mutex_acquire)((ompt_mutex_kind_t) r.args[0], r.args[2], 0,
+                                                     r.args[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::MutexAcquired:
+      if (replay_callbacks[ompt_callback_mutex_acquired]) {
+        ((ompt_callback_mutex_t) replay_callbacks[ompt_callback_mutex_acquired])(
+          (ompt_mutex_kind_t) r.args[0], r.args[1], codeptr_ra);
+      }
+      break;
+    case CallbackKind::MutexReleased:
+      if (replay_callbacks[ompt_callback_mutex_released]) {
+        ((ompt_callback_mutex_t) replay_callbacks[ompt_callback_mutex_released])(
+          (ompt_mutex_kind_t) r.args[0], r.args[1], codeptr_ra);
+      }
+      break;
+  }
+}
+
+
+int main(int argc, char ** argv) {
+  bool run_finalize = true;
+  bool quiet = false;
+  bool concurrent = false;
+  const char * log_file = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      concurrent = true;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      run_finalize = false;
+    } else if (strcmp(argv[i], "-q") == 0) {
+      quiet = true;
+    } else {
+      log_file = argv[i];
+    }
+  }
+  if (log_file == NULL) {
+    printf("Usage: %s [-c] [-n] [-q] <callbacks.rec>\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t n_threads;
+  std::vector<callback_record_t> records;
+  if (!read_callback_log(log_file, n_threads, records)) {
+    printf("Could not read callback log %s\n", log_file);
+    return 1;
+  }
+
+  // Give every recorded ompt_data_t address its own zeroed stand-in, and
+  // split the log into per-thread streams
+  std::unordered_map<uint64_t, ompt_data_t *> address_to_data;
+  // Last record that touched each address, as its index + 1 (0 for none)
+  std::unordered_map<uint64_t, int64_t> last_touch;
+  std::vector<std::vector<replay_op_t>> streams(n_threads);
+  for (size_t i = 0; i < records.size(); i++) {
+    replay_op_t op;
+    op.record = &records[i];
+    int n_after = 0;
+    for (int d = 0; d < 3; d++) {
+      op.after[d] = -1;
+    }
+    for (int d = 0; d < 3; d++) {
+      uint64_t address = records[i].data[d];
+      op.data[d] = NULL;
+      if (address != 0) {
+        int64_t & last = last_touch[address];
+        if (last > 0 && records[last - 1].thread != records[i].thread &&
+            std::find(op.after, op.after + n_after, last - 1) == op.after + n_after) {
+          op.after[n_after++] = last - 1;
+        }
+        last = i + 1;
+        auto search = address_to_data.find(address);
+        if (search == address_to_data.end()) {
+          ompt_data_t data;
+          data.value = 0;
+          replay_data.push_back(data);
+          search = address_to_data.insert( {address, &replay_data.back()} ).first;
+        }
+        op.data[d] = search->second;
+      }
+    }
+    if (records[i].thread >= n_threads) {
+      printf("Record %zu names thread %u of %u\n", i, records[i].thread, n_threads);
+      return 1;
+    }
+    streams[records[i].thread].push_back(op);
+  }
+
+  // Positions in the global order are the record indices
+  std::vector<std::vector<uint64_t>> stream_positions(n_threads);
+  for (size_t i = 0; i < records.size(); i++) {
+    stream_positions[records[i].thread].push_back(i);
+  }
+
+  int saved_stdout = -1;
+  if (quiet) {
+    fflush(stdout);
+    saved_stdout = dup(1);
+    freopen("/dev/null", "w", stdout);
+  }
+
+  ompt_data_t tool_data;
+  tool_data.value = 0;
+  ompt_initialize(replay_lookup, &tool_data);
+
+  std::atomic<uint64_t> next_position(0);
+  std::vector<std::atomic<bool>> returned(concurrent ? records.size() : 0);
+  for (auto & r : returned) {
+    r.store(false, std::memory_order_relaxed);
+  }
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < n_threads; t++) {
+    workers.push_back(std::thread([&, t] {
+      const std::vector<replay_op_t> & stream = streams[t];
+      const std::vector<uint64_t> & stream_position = stream_positions[t];
+      for (size_t i = 0; i < stream.size(); i++) {
+        if (concurrent) {
+          for (int64_t after : stream[i].after) {
+            if (after < 0) {
+              break;
+            }
+            while (!returned[after].load(std::memory_order_acquire)) {
+              std::this_thread::yield();
+            }
+          }
+          replay_one(stream[i]);
+          returned[stream_position[i]].store(true, std::memory_order_release);
+          continue;
+        }
+        while (next_position.load(std::memory_order_acquire) != stream_position[i]) {
+          std::this_thread::yield();
+        }
+        replay_one(stream[i]);
+        next_position.store(stream_position[i] + 1, std::memory_order_release);
+      }
+    }));
+  }
+  for (auto & w : workers) {
+    w.join();
+  }
+  auto replayed = std::chrono::steady_clock::now();
+  if (run_finalize) {
+    ompt_finalize(&tool_data);
+  }
+  auto finalized = std::chrono::steady_clock::now();
+
+  if (quiet) {
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+  }
+
+  double replay_s = std::chrono::duration<double>(replayed - begin).count();
+  double finalize_s = std::chrono::duration<double>(finalized - replayed).count();
+  if (concurrent) {
+    fprintf(stderr, "Replayed %zu callbacks from %u concurrent threads in %.6f s "
+            "(%.0f callbacks/s across all threads)\n",
+            records.size(), n_threads, replay_s, records.size() / replay_s);
+  } else {
+    fprintf(stderr, "Replayed %zu callbacks from %u threads one at a time in %.6f s "
+            "(%.0f ns per callback)\n",
+            records.size(), n_threads, replay_s, 1e9 * replay_s / records.size());
+  }
+  if (run_finalize) {
+    fprintf(stderr, "Finalize took %.6f s\n", finalize_s);
+  }
+  return 0;
+}
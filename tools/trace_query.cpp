@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "TraceFile.hpp"
+
+/******************************************************************************\
+ * Command-line front end for the binary trace written by the tool, and an
+ * example of the reader API.
+ *
+ * Usage: trace_query [-j threads] <trace file> [task/region IDs...]
+ *
+ * Without IDs, prints the number of records, the time it took to open the
+ * trace, and per-call-site task counts and execution times, computed with a
+ * parallel scan over the task records. With IDs, prints each task or region
+ * and its out-edges.
+\******************************************************************************/
+
+static void usage(const char * prog) {
+  printf("Usage: %s [-j threads] <trace file> [IDs...]\n", prog);
+}
+
+typedef struct site_stats {
+  uint64_t tasks;
+  uint64_t exec_time;
+} site_stats_t;
+
+typedef std::map<uint64_t, site_stats_t> site_map_t;
+
+static void print_edges(const TraceRange<trace_edge_t> & edges) {
+  for (const trace_edge_t & edge : edges) {
+    printf("  -> %" PRIu64 " (%s)\n", edge.target,
+           edge.type == TraceEdgeType::Ancestry ? "child" : "dependence");
+  }
+}
+
+static void print_record(const TraceReader & trace, uint64_t id) {
+  const trace_task_t * task = trace.find_task(id);
+  if (task != NULL) {
+    printf("task %" PRIu64 ": %s, parent %" PRIu64 ", region %" PRIu64
+           ", codeptr_ra 0x%" PRIx64 ", exec %" PRIu64 " ns, thread %u -> %u\n",
+           task->id,
+           (task->flags & TRACE_TASK_INITIAL) ? "initial" :
+           (task->flags & TRACE_TASK_IMPLICIT) ? "implicit" : "explicit",
+           task->parent_id, task->region_id, task->codeptr_ra, task->exec_time,
+           task->creating_thread, task->executing_thread);
+    print_edges(trace.out_edges(*task));
+    return;
+  }
+  const trace_region_t * region = trace.find_region(id);
+  if (region != NULL) {
+    printf("region %" PRIu64 ": parent %" PRIu64 ", codeptr_ra 0x%" PRIx64
+           ", team %u/%u, nesting %u, duration %" PRIu64 " ns\n",
+           region->id, region->parent_id, region->codeptr_ra,
+           region->team_size, region->requested_team_size,
+           region->nesting_level, region->duration);
+    print_edges(trace.out_edges(*region));
+    return;
+  }
+  printf("unknown id %" PRIu64 "\n", id);
+}
+
+int main(int argc, char ** argv) {
+  unsigned n_threads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    if (opt == 'j') {
+      n_threads = strtoul(optarg, NULL, 10);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  TraceReader trace(argv[optind]);
+  double open_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (!trace.is_open()) {
+    printf("Could not open trace %s\n", argv[optind]);
+    return 1;
+  }
+
+  if (optind + 1 < argc) {
+    for (int i = optind + 1; i < argc; i++) {
+      print_record(trace, strtoull(argv[i], NULL, 10));
+    }
+    return 0;
+  }
+
+  printf("tasks: %" PRIu64 "\n", trace.tasks().size());
+  printf("regions: %" PRIu64 "\n", trace.regions().size());
+  printf("edges: %" PRIu64 "\n", trace.edges().size());
+  printf("opened in %.6f s\n", open_time);
+
+  start = std::chrono::steady_clock::now();
+  site_map_t sites = trace_parallel_reduce(trace.tasks(), n_threads, site_map_t(),
+    [](site_map_t & acc, const trace_task_t & task) {
+      if (!(task.flags & (TRACE_TASK_IMPLICIT | TRACE_TASK_INITIAL))) {
+        site_stats_t & site = acc[task.codeptr_ra];
+        site.tasks++;
+        site.exec_time += task.exec_time;
+      }
+    },
+    [](site_map_t & acc, const site_map_t & partial) {
+      for (auto & e : partial) {
+        acc[e.first].tasks += e.second.tasks;
+        acc[e.first].exec_time += e.second.exec_time;
+      }
+    });
+  double scan_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("explicit tasks by call site (scanned in %.6f s):\n", scan_time);
+  for (auto & e : sites) {
+    printf("  0x%-16" PRIx64 " %10" PRIu64 " tasks %14" PRIu64 " ns\n",
+           e.first, e.second.tasks, e.second.exec_time);
+  }
+  return 0;
+}